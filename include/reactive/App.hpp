@@ -37,6 +37,8 @@ enum class Extension {
     ShaderObject,
     DeviceFault,
     ExtendedDynamicState,
+    DescriptorBuffer,  // Optional. Falls back to descriptor pools if unsupported.
+    PushDescriptor,
 };
 
 enum class Layer {
@@ -62,6 +64,9 @@ struct AppCreateInfo {
     ArrayProxy<Layer> layers;
     ArrayProxy<Extension> extensions;
 
+    // Pipeline cache loaded at startup and saved on shutdown. Null disables it.
+    const char* pipelineCacheFile = nullptr;
+
     // UI
     UIStyle style = UIStyle::Vulkan;
     const char* imguiIniFile = nullptr;
@@ -107,5 +112,9 @@ protected:
     vk::UniqueSurfaceKHR m_surface;
     std::unique_ptr<Swapchain> m_swapchain;
     bool m_running = true;
+
+    std::string m_pipelineCacheFile;
+    // From construction to the end of onStart()
+    CPUTimer m_startupTimer;
 };
 }  // namespace rv
@@ -1,12 +1,16 @@
 ﻿#pragma once
 #include <filesystem>
+#include <future>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <slang/slang.h>
 #include <slang/slang-com-ptr.h>
 
 namespace rv {
+class ThreadPool;
 
 namespace File {
 auto readFile(const std::filesystem::path& path) -> std::string;
@@ -34,17 +38,87 @@ void readBinary(const std::filesystem::path& filepath, std::vector<T>& vec) {
 }
 }  // namespace File
 
+// SPIR-V is cached in `cacheDirectory`, keyed by the shader path, source, entry points,
+// target and compiler options. An entry is used only if every file the module
+// imported still has the same contents, so a hit skips Slang entirely.
+// An empty `cacheDirectory` disables the cache.
+// The Slang session is kept across calls, so loaded modules are reused by later
+// calls. It is recreated when any file it read has changed.
+// NOTE: Not thread-safe. Use SlangCompilerPool to compile on several threads.
 class SlangCompiler
 {
 public:
-    SlangCompiler();
+    SlangCompiler(std::filesystem::path cacheDirectory = "shader_cache");
+
+    // NOTE: The file system of m_session refers to m_fileHashes
+    SlangCompiler(const SlangCompiler&) = delete;
+    auto operator=(const SlangCompiler&) -> SlangCompiler& = delete;
 
     std::vector<Slang::ComPtr<slang::IBlob>> compileShaders(
         const std::filesystem::path& shaderPath,
         const std::vector<std::string>& entryPointNames);
 
 private:
+    using Blobs = std::vector<Slang::ComPtr<slang::IBlob>>;
+
+    void createSession();
+
+    // Whether a file read by m_session has changed since
+    auto isSessionStale() const -> bool;
+
+    auto getCachePath(const std::filesystem::path& shaderPath,
+                      const std::string& source,
+                      const std::vector<std::string>& entryPointNames) const
+        -> std::filesystem::path;
+
+    // Returns empty if the entry is missing or stale
+    auto loadCache(const std::filesystem::path& cachePath, size_t entryPointCount) const -> Blobs;
+
+    void saveCache(const std::filesystem::path& cachePath,
+                   slang::IModule* slangModule,
+                   const Blobs& codes) const;
+
     Slang::ComPtr<slang::IGlobalSession> m_globalSession;
+    Slang::ComPtr<slang::ISession> m_session;
+    Slang::ComPtr<ISlangFileSystem> m_fileSystem;
+    std::filesystem::path m_cacheDirectory;
+
+    // Hashes of the files read by m_session, keyed by normalized path.
+    // Written by the file system of the session.
+    std::unordered_map<std::string, uint64_t> m_fileHashes;
+};
+
+struct ShaderCompileRequest {
+    std::filesystem::path shaderPath;
+    std::vector<std::string> entryPointNames;
+};
+
+// Compiles batches of shader files on a ThreadPool.
+// Each worker thread uses its own SlangCompiler, since global sessions of Slang
+// are not thread-safe.
+class SlangCompilerPool {
+public:
+    // 0 uses hardware_concurrency - 1
+    SlangCompilerPool(uint32_t threadCount = 0,
+                      std::filesystem::path cacheDirectory = "shader_cache");
+    ~SlangCompilerPool();
+
+    // One future per request with the codes in the order of its entryPointNames
+    auto compileShaders(const std::vector<ShaderCompileRequest>& requests)
+        -> std::vector<std::shared_future<std::vector<Slang::ComPtr<slang::IBlob>>>>;
+
+private:
+    auto acquireCompiler() -> SlangCompiler*;
+    void releaseCompiler(SlangCompiler* compiler);
+
+    std::filesystem::path m_cacheDirectory;
+
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<SlangCompiler>> m_compilers;
+    std::vector<SlangCompiler*> m_freeCompilers;
+
+    // NOTE: Declared last so that the workers are joined before the compilers are destroyed
+    std::unique_ptr<ThreadPool> m_threadPool;
 };
 
 }  // namespace rv
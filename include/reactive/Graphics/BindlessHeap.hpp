@@ -0,0 +1,73 @@
+#pragma once
+#include <mutex>
+
+#include "Context.hpp"
+
+namespace rv {
+// Binding of each array in the heap set
+enum class BindlessType : uint32_t {
+    SampledImage = 0,
+    StorageImage = 1,
+    StorageBuffer = 2,
+    Sampler = 3,
+};
+
+// Global descriptor set of update-after-bind, partially bound arrays.
+// Images and buffers created with `bindless = true` get a stable index, and shaders
+// index the arrays directly instead of binding per-material sets.
+// Pipelines created with `bindless = true` have the heap at set 0.
+// Shader side:
+//   [[vk::binding(0, 0)]] Texture2D sampledImages[];
+//   [[vk::binding(1, 0)]] RWTexture2D<float4> storageImages[];
+//   [[vk::binding(2, 0)]] RWByteAddressBuffer storageBuffers[];
+//   [[vk::binding(3, 0)]] SamplerState samplers[];
+// NOTE: Sampled images are written with ShaderReadOnlyOptimal and storage images with General.
+class BindlessHeap {
+public:
+    static constexpr uint32_t InvalidIndex = std::numeric_limits<uint32_t>::max();
+    static constexpr uint32_t SetIndex = 0;
+
+    static constexpr uint32_t MaxSampledImages = 16384;
+    static constexpr uint32_t MaxStorageImages = 4096;
+    static constexpr uint32_t MaxStorageBuffers = 16384;
+    static constexpr uint32_t MaxSamplers = 256;
+
+    BindlessHeap(const Context& context);
+
+    // Whether the device was created with the features the heap requires
+    static auto isSupported(const void* deviceCreateInfoPNext) -> bool;
+
+    // InvalidIndex if the binding is full
+    auto allocate(BindlessType type) -> uint32_t;
+
+    // The index is reused after the current frame slot of UploadRing is reused
+    void free(BindlessType type, uint32_t index);
+
+    void writeImage(BindlessType type, uint32_t index, const vk::DescriptorImageInfo& info);
+    void writeBuffer(uint32_t index, const vk::DescriptorBufferInfo& info);
+
+    auto getLayout() const -> vk::DescriptorSetLayout { return *m_layout; }
+    auto getDescriptorSet() const -> vk::DescriptorSet { return m_descSet; }
+    auto getCapacity(BindlessType type) const -> uint32_t {
+        return m_capacities[static_cast<uint32_t>(type)];
+    }
+
+private:
+    static constexpr uint32_t TypeCount = 4;
+
+    struct RetiredIndex;
+
+    void release(BindlessType type, uint32_t index);
+
+    const Context* m_context = nullptr;
+
+    vk::UniqueDescriptorPool m_pool;
+    vk::UniqueDescriptorSetLayout m_layout;
+    vk::DescriptorSet m_descSet;
+
+    std::mutex m_mutex;
+    std::array<uint32_t, TypeCount> m_capacities{};
+    std::array<uint32_t, TypeCount> m_counts{};
+    std::array<std::vector<uint32_t>, TypeCount> m_freeIndices;
+};
+}  // namespace rv
@@ -1,22 +1,36 @@
 #pragma once
+#include <variant>
+
 #include "Context.hpp"
+#include "MemoryAllocator.hpp"
 
 namespace rv {
 struct BufferCreateInfo {
     vk::BufferUsageFlags usage;
 
-    vk::MemoryPropertyFlags memory;
+    // MemoryUsage flags or MemoryIntent
+    std::variant<vk::MemoryPropertyFlags, MemoryIntent> memory;
 
     size_t size = 0;
 
+    // Register in BindlessHeap if usage has eStorageBuffer (see Buffer::getStorageBufferIndex())
+    bool bindless = false;
+
     std::string debugName;
 };
 
+struct BufferRange {
+    vk::DeviceSize offset = 0;
+    vk::DeviceSize size = 0;
+};
+
 class Buffer {
     friend class CommandBuffer;
+    friend class Defragmenter;
 
 public:
     Buffer(const Context& context, const BufferCreateInfo& createInfo);
+    ~Buffer();
 
     auto getBuffer() const -> vk::Buffer { return *m_buffer; }
     auto getSize() const -> vk::DeviceSize { return m_size; }
@@ -27,20 +41,51 @@ public:
     void unmap();
     void copy(const void* data);
 
-    void prepareStagingBuffer();
+    // Write `size` bytes of `data` to `offset`
+    void copy(const void* data, vk::DeviceSize offset, vk::DeviceSize size);
+
+    // Record a range written through map()
+    void markDirty(vk::DeviceSize offset, vk::DeviceSize size);
+
+    // Flush dirty ranges with one vkFlushMappedMemoryRanges.
+    // Only non-coherent memory has dirty ranges.
+    void flush();
+
+    // Make device writes visible to the host for non-coherent memory
+    void invalidate(vk::DeviceSize offset = 0, vk::DeviceSize size = VK_WHOLE_SIZE);
+
+    auto isHostCoherent() const -> bool { return m_isHostCoherent; }
+
+    // Index in BindlessHeap for buffers created with eStorageBuffer and `bindless = true`.
+    // BindlessHeap::InvalidIndex if not registered (also if the heap is missing or full).
+    auto getStorageBufferIndex() const -> uint32_t { return m_storageBufferIndex; }
+
+    // Sort and merge overlapping or adjacent ranges
+    static auto mergeRanges(std::vector<BufferRange> ranges) -> std::vector<BufferRange>;
 
 private:
+    auto getMappedMemoryRange(vk::DeviceSize offset, vk::DeviceSize size) const
+        -> vk::MappedMemoryRange;
+
+    // Allocate the index on first use and (re)write the heap descriptor
+    void writeBindlessBuffer();
+
     const Context* m_context = nullptr;
 
     vk::UniqueBuffer m_buffer;
-    vk::UniqueDeviceMemory m_memory;
+    MemoryAllocation m_allocation;
     vk::DeviceSize m_size = 0u;
+    vk::BufferUsageFlags m_usage;
+    bool m_bindless = false;
+    std::string m_debugName;
 
     // For host buffer
+    // NOTE: Host visible memory is persistently mapped by MemoryAllocator
     void* m_mapped = nullptr;
     bool m_isHostVisible;
+    bool m_isHostCoherent = true;
+    std::vector<BufferRange> m_dirtyRanges;
 
-    // For device buffer
-    BufferHandle m_stagingBuffer;
+    uint32_t m_storageBufferIndex = std::numeric_limits<uint32_t>::max();
 };
 }  // namespace rv
@@ -18,8 +18,24 @@ class Buffer;
 class GPUTimer;
 class Buffer;
 class DescriptorSet;
+struct UploadRingAllocation;
+
+struct BarrierStats {
+    // Barriers passed to barrier and transition calls
+    uint32_t requestedCount = 0;
+    // Barriers recorded after merging
+    uint32_t emittedCount = 0;
+    // Number of vkCmdPipelineBarrier2 calls
+    uint32_t batchCount = 0;
+};
 
+// NOTE: Barriers are not recorded immediately. They are collected and
+// flushed as one vkCmdPipelineBarrier2 before the next action command
+// (draw, dispatch, copy, trace, beginRendering, ...) or end().
+// Call flushBarriers() before recording into m_commandBuffer directly.
 class CommandBuffer {
+    friend class SubmitPool;
+
 public:
     CommandBuffer() = default;
 
@@ -36,7 +52,18 @@ public:
     void begin(vk::CommandBufferUsageFlags flags = {}) const;
     void end() const;
 
-    void bindDescriptorSet(PipelineHandle pipeline, DescriptorSetHandle descSet) const;
+    // With the descriptor buffer backend, DescriptorBuffer is bound once
+    // per command buffer and only the offset of the set is recorded.
+    // `dynamicOffsets` has one offset per dynamic buffer descriptor, ordered by binding number.
+    void bindDescriptorSet(PipelineHandle pipeline,
+                           DescriptorSetHandle descSet,
+                           ArrayProxy<uint32_t> dynamicOffsets = {}) const;
+
+    // Record the current resources of a push descriptor set at the pipeline's push set index
+    void pushDescriptorSet(PipelineHandle pipeline, DescriptorSetHandle descSet) const;
+
+    // Bind BindlessHeap at set 0. Stays bound across pipelines created with `bindless`.
+    void bindBindlessHeap(PipelineHandle pipeline) const;
     void bindPipeline(PipelineHandle pipeline) const;
     void pushConstants(PipelineHandle pipeline, const void* pushData) const;
 
@@ -122,9 +149,31 @@ public:
                        vk::AccessFlags dstAccessMask,
                        vk::DependencyFlags dependencyFlags = {});
 
+    // Record pending barriers now
+    void flushBarriers() const;
+
+    // Reset at begin()
+    auto getBarrierStats() const -> BarrierStats { return m_barrierStats; }
+
     // image
+    // Subresources that are already in `newLayout` and were only read are skipped.
+    // Barriers use the tracked last use of each subresource as the source scope.
     void transitionLayout(ImageHandle image, vk::ImageLayout newLayout) const;
 
+    void transitionLayout(ImageHandle image,
+                          vk::ImageLayout newLayout,
+                          uint32_t baseMipLevel,
+                          uint32_t levelCount = 1,
+                          uint32_t baseArrayLayer = 0,
+                          uint32_t layerCount = 1) const;
+
+    void transitionLayout(Image& image,
+                          vk::ImageLayout newLayout,
+                          uint32_t baseMipLevel,
+                          uint32_t levelCount = 1,
+                          uint32_t baseArrayLayer = 0,
+                          uint32_t layerCount = 1) const;
+
     void blitImage(ImageHandle srcImage,
                    ImageHandle dstImage,
                    vk::ImageBlit blit,
@@ -145,6 +194,20 @@ public:
 
     void copyBuffer(BufferHandle buffer, const void* data) const;
 
+    // Copy `size` bytes of `data` to `offset` of the buffer
+    void copyBuffer(BufferHandle buffer,
+                    const void* data,
+                    vk::DeviceSize offset,
+                    vk::DeviceSize size) const;
+
+    // `data` has the same layout as the buffer. All ranges are staged together
+    // and copied with a single vkCmdCopyBuffer.
+    void copyBuffer(BufferHandle buffer, const void* data, ArrayProxy<BufferRange> ranges) const;
+
+    void copyBuffer(BufferHandle srcBuffer,
+                    BufferHandle dstBuffer,
+                    ArrayProxy<vk::BufferCopy> copyRegions = {}) const;
+
     void copyBufferToImage(BufferHandle srcBuffer,
                            ImageHandle dstImage,
                            ArrayProxy<vk::BufferImageCopy> copyRegions = {}) const;
@@ -183,5 +246,38 @@ public:
     const Context* m_context = nullptr;
     vk::UniqueCommandBuffer m_commandBuffer;
     vk::QueueFlags m_queueFlags;
+
+private:
+    // Merge into a pending barrier of the same resource or append.
+    // Pending barriers that the new one depends on are flushed first.
+    void addImageBarrier(const vk::ImageMemoryBarrier2& barrier,
+                         vk::DependencyFlags dependencyFlags) const;
+    void addBufferBarrier(const vk::BufferMemoryBarrier2& barrier,
+                          vk::DependencyFlags dependencyFlags) const;
+    void addMemoryBarrier(const vk::MemoryBarrier2& barrier,
+                          vk::DependencyFlags dependencyFlags) const;
+
+    auto hasPendingBarriers() const -> bool;
+    // Whether a pending image or buffer barrier has `stage` in its destination scope
+    auto isPendingDstStage(vk::PipelineStageFlags2 stage) const -> bool;
+    void prepareBarrier(vk::DependencyFlags dependencyFlags) const;
+
+    // Staging memory for copyBuffer. See m_ownsStaging.
+    auto allocateStaging(vk::DeviceSize size) const -> UploadRingAllocation;
+
+    mutable std::vector<vk::ImageMemoryBarrier2> m_pendingImageBarriers;
+    mutable std::vector<vk::BufferMemoryBarrier2> m_pendingBufferBarriers;
+    mutable std::optional<vk::MemoryBarrier2> m_pendingMemoryBarrier;
+    mutable vk::DependencyFlags m_pendingDependencyFlags;
+    mutable BarrierStats m_barrierStats;
+
+    // Address of DescriptorBuffer bound by vkCmdBindDescriptorBuffersEXT
+    mutable vk::DeviceAddress m_boundDescriptorBuffer = 0;
+
+    // Set for command buffers of SubmitPool. Their submissions are not tied to a frame,
+    // so staging comes from dedicated buffers that SubmitPool releases once the fence
+    // has signaled, instead of the current UploadRing segment.
+    bool m_ownsStaging = false;
+    mutable std::vector<BufferHandle> m_stagingBuffers;
 };
 }  // namespace rv
@@ -11,6 +11,8 @@
 
 #include <vulkan/vulkan.hpp>
 
+#include "ArrayProxy.hpp"
+
 namespace std {
 template <>
 struct hash<vk::QueueFlags> {
@@ -54,6 +56,22 @@ class TopAccel;
 class GPUTimer;
 class CommandBuffer;
 class Fence;
+class MemoryAllocator;
+struct MemoryStats;
+enum class MemoryBudgetPolicy;
+class UploadRing;
+class UploadManager;
+class DescriptorAllocator;
+class DescriptorSetLayoutCache;
+class BindlessHeap;
+class DescriptorBuffer;
+class PipelineCache;
+class PipelineRegistry;
+class SubmitPool;
+class SubmitFuture;
+class ThreadPool;
+template <typename T>
+class PipelineFuture;
 
 using BufferHandle = std::shared_ptr<Buffer>;
 using ImageHandle = std::shared_ptr<Image>;
@@ -79,6 +97,7 @@ static constexpr vk::BufferUsageFlags Uniform =
 static constexpr vk::BufferUsageFlags Storage =
     vk::BufferUsageFlagBits::eStorageBuffer |
     vk::BufferUsageFlagBits::eTransferDst |
+    vk::BufferUsageFlagBits::eTransferSrc |
     vk::BufferUsageFlagBits::eShaderDeviceAddress;
 static constexpr vk::BufferUsageFlags Staging =
     vk::BufferUsageFlagBits::eTransferSrc |
@@ -87,24 +106,28 @@ static constexpr vk::BufferUsageFlags Vertex =
     vk::BufferUsageFlagBits::eStorageBuffer |
     vk::BufferUsageFlagBits::eShaderDeviceAddress |
     vk::BufferUsageFlagBits::eVertexBuffer |
-    vk::BufferUsageFlagBits::eTransferDst;
+    vk::BufferUsageFlagBits::eTransferDst |
+    vk::BufferUsageFlagBits::eTransferSrc;
 static constexpr vk::BufferUsageFlags Index =
     vk::BufferUsageFlagBits::eStorageBuffer |
     vk::BufferUsageFlagBits::eShaderDeviceAddress |
     vk::BufferUsageFlagBits::eIndexBuffer |
-    vk::BufferUsageFlagBits::eTransferDst;
+    vk::BufferUsageFlagBits::eTransferDst |
+    vk::BufferUsageFlagBits::eTransferSrc;
 static constexpr vk::BufferUsageFlags AccelVertex =
     vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR |
     vk::BufferUsageFlagBits::eStorageBuffer |
     vk::BufferUsageFlagBits::eShaderDeviceAddress |
     vk::BufferUsageFlagBits::eVertexBuffer |
-    vk::BufferUsageFlagBits::eTransferDst;
+    vk::BufferUsageFlagBits::eTransferDst |
+    vk::BufferUsageFlagBits::eTransferSrc;
 static constexpr vk::BufferUsageFlags AccelIndex =
     vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR |
     vk::BufferUsageFlagBits::eStorageBuffer |
     vk::BufferUsageFlagBits::eShaderDeviceAddress |
     vk::BufferUsageFlagBits::eIndexBuffer |
-    vk::BufferUsageFlagBits::eTransferDst;
+    vk::BufferUsageFlagBits::eTransferDst |
+    vk::BufferUsageFlagBits::eTransferSrc;
 static constexpr vk::BufferUsageFlags Indirect =
     vk::BufferUsageFlagBits::eStorageBuffer |
     vk::BufferUsageFlagBits::eTransferDst |
@@ -173,10 +196,38 @@ namespace QueueFlags{
 }
 // clang-format on
 
+// How memory is accessed. Preferred over raw MemoryUsage flags.
+enum class MemoryIntent {
+    GpuOnly,   // Never mapped
+    Upload,    // Written by the CPU once, e.g. staging buffers
+    Readback,  // Written by the GPU and read by the CPU
+    Dynamic,   // Written by the CPU every frame and read by the GPU
+};
+
+// Input of the scored memory type selection
+struct MemoryTypeRequest {
+    vk::MemoryPropertyFlags required;
+    vk::MemoryPropertyFlags preferred;
+    vk::MemoryPropertyFlags avoided;
+
+    // Heaps used only if no other heap fits (e.g. over budget)
+    uint32_t fallbackHeapBits = 0;
+};
+
+// Semaphore wait or signal operation of a submission
+// NOTE: value is ignored for binary semaphores
+struct SemaphoreSubmit {
+    vk::Semaphore semaphore;
+    uint64_t value = 0;
+    vk::PipelineStageFlags2 stageMask = vk::PipelineStageFlagBits2::eAllCommands;
+};
+
 class Context {
     friend class CommandBuffer;
 
 public:
+    ~Context();
+
     // Initialization
     void initInstance(bool enableValidation,
                       const std::vector<const char*>& layers,
@@ -201,10 +252,38 @@ public:
 
     auto getQueueFamily(vk::QueueFlags flag = QueueFlags::General) const -> uint32_t;
 
+    auto hasQueue(vk::QueueFlags flag) const -> bool { return m_queueFamilies.contains(flag); }
+
     auto getCommandPool(vk::QueueFlags flag = QueueFlags::General) const -> vk::CommandPool;
 
+    // NOTE: Small pool with eFreeDescriptorSet for ImGui.
+    // Sets of the engine are allocated by DescriptorAllocator.
     auto getDescriptorPool() const -> vk::DescriptorPool { return *m_descriptorPool; }
 
+    auto getDescriptorAllocator() const -> DescriptorAllocator& { return *m_descriptorAllocator; }
+
+    auto getDescriptorSetLayoutCache() const -> DescriptorSetLayoutCache& {
+        return *m_descriptorSetLayoutCache;
+    }
+
+    // Created if the device enables update-after-bind descriptor indexing
+    auto hasBindlessHeap() const -> bool { return m_bindlessHeap != nullptr; }
+    auto getBindlessHeap() const -> BindlessHeap&;
+
+    // Created if VK_EXT_descriptor_buffer is enabled.
+    // DescriptorSet falls back to pooled descriptor sets without it.
+    auto hasDescriptorBuffer() const -> bool { return m_descriptorBuffer != nullptr; }
+    auto getDescriptorBuffer() const -> DescriptorBuffer& { return *m_descriptorBuffer; }
+
+    // Passed to every pipeline creation
+    auto getPipelineCache() const -> PipelineCache& { return *m_pipelineCache; }
+
+    // create*Pipeline returns the existing pipeline for an identical create info
+    auto getPipelineRegistry() const -> PipelineRegistry& { return *m_pipelineRegistry; }
+
+    // Workers for pipeline creation and deferred host operations
+    auto getThreadPool() const -> ThreadPool& { return *m_threadPool; }
+
     // Command buffer
     auto allocateCommandBuffer(vk::QueueFlags flag = QueueFlags::General) const
         -> CommandBufferHandle;
@@ -217,13 +296,65 @@ public:
 
     void submit(CommandBufferHandle commandBuffer, FenceHandle fence = {}) const;
 
+    // Submit with vkQueueSubmit2.
+    // The timeline of the submitting queue is signaled in addition to `signals`
+    // and the returned point can be waited by other queues or the host.
+    auto submit(CommandBufferHandle commandBuffer,
+                ArrayProxy<SemaphoreSubmit> waits,
+                ArrayProxy<SemaphoreSubmit> signals = {},
+                FenceHandle fence = {}) const -> SemaphoreSubmit;
+
+    // Latest point submitted to the queue of the calling thread
+    auto getQueueTimeline(vk::QueueFlags flag = QueueFlags::General) const -> SemaphoreSubmit;
+
+    // Host wait for a timeline point
+    void waitSemaphore(const SemaphoreSubmit& point) const;
+    auto isSemaphoreSignaled(const SemaphoreSubmit& point) const -> bool;
+
+    // Blocks until the command buffer finishes
     void oneTimeSubmit(const std::function<void(CommandBufferHandle)>& command,
                        vk::QueueFlags flag = QueueFlags::General) const;
 
+    // Command buffer and fence are recycled after the returned future finishes
+    auto oneTimeSubmitAsync(const std::function<void(CommandBufferHandle)>& command,
+                            vk::QueueFlags flag = QueueFlags::General) const -> SubmitFuture;
+
+    // Reclaim the per-frame memory of slot `frameIndex`: UploadRing staging and retired
+    // resources, transient descriptor sets and descriptor buffer segments.
+    // Call once the previous submission that used the slot has completed.
+    // Swapchain calls it in waitNextFrame().
+    void beginFrame(uint32_t frameIndex) const;
+
+    // Reclaim every frame slot and finished one-time submissions.
+    // For apps without a Swapchain (headless) or work before the first frame.
+    // NOTE: Call only after all submitted work has completed (e.g. after waitIdle())
+    void collectGarbage() const;
+
     // Memory
     auto findMemoryTypeIndex(vk::MemoryRequirements requirements,
                              vk::MemoryPropertyFlags memoryProp) const -> uint32_t;
 
+    auto findMemoryTypeIndex(vk::MemoryRequirements requirements,
+                             const MemoryTypeRequest& request) const -> uint32_t;
+
+    static auto getMemoryTypeRequest(vk::MemoryPropertyFlags memoryProp) -> MemoryTypeRequest;
+
+    static auto getMemoryTypeRequest(MemoryIntent intent) -> MemoryTypeRequest;
+
+    auto getMemoryAllocator() const -> MemoryAllocator& { return *m_memoryAllocator; }
+
+    // Snapshot of live allocations per heap, memory type and debugName category
+    auto getMemoryStats() const -> MemoryStats;
+
+    // Soft limit on the memory reserved from a heap. 0 disables the limit.
+    void setMemoryBudget(uint32_t heapIndex,
+                         vk::DeviceSize budget,
+                         MemoryBudgetPolicy policy) const;
+
+    auto getUploadRing() const -> UploadRing& { return *m_uploadRing; }
+
+    auto getUploadManager() const -> UploadManager& { return *m_uploadManager; }
+
     // Physical device
     template <typename T>
     auto getPhysicalDeviceProperties2() const -> T {
@@ -236,6 +367,14 @@ public:
 
     auto getPhysicalDeviceLimits() const -> vk::PhysicalDeviceLimits;
 
+    auto getMemoryProperties() const -> const vk::PhysicalDeviceMemoryProperties& {
+        return m_memoryProperties;
+    }
+
+    auto isDeviceExtensionSupported(const char* extensionName) const -> bool;
+
+    auto isDeviceExtensionEnabled(const char* extensionName) const -> bool;
+
     // Debug
     auto debugEnabled() const -> bool { return m_debugMessenger.get(); }
 
@@ -268,6 +407,20 @@ public:
     auto createRayTracingPipeline(const RayTracingPipelineCreateInfo& createInfo) const
         -> RayTracingPipelineHandle;
 
+    // Built on the ThreadPool. Arrays referenced by the create infos are copied,
+    // so they may be freed after this returns.
+    auto createPipelinesAsync(ArrayProxy<GraphicsPipelineCreateInfo> createInfos) const
+        -> std::vector<PipelineFuture<GraphicsPipeline>>;
+
+    auto createPipelinesAsync(ArrayProxy<MeshShaderPipelineCreateInfo> createInfos) const
+        -> std::vector<PipelineFuture<MeshShaderPipeline>>;
+
+    auto createPipelinesAsync(ArrayProxy<ComputePipelineCreateInfo> createInfos) const
+        -> std::vector<PipelineFuture<ComputePipeline>>;
+
+    auto createPipelinesAsync(ArrayProxy<RayTracingPipelineCreateInfo> createInfos) const
+        -> std::vector<PipelineFuture<RayTracingPipeline>>;
+
     auto createImage(const ImageCreateInfo& createInfo) const -> ImageHandle;
 
     auto createBuffer(const BufferCreateInfo& createInfo) const -> BufferHandle;
@@ -299,6 +452,10 @@ private:
         std::thread::id tid{};
         vk::Queue queue{};
         vk::UniqueCommandPool commandPool;
+
+        // Signaled by every submission to this queue
+        vk::UniqueSemaphore timeline;
+        mutable uint64_t timelineValue = 0;
     };
     auto getThreadQueue(vk::QueueFlags flag) const -> const ThreadQueue&;
 
@@ -306,10 +463,27 @@ private:
     vk::UniqueDebugUtilsMessengerEXT m_debugMessenger;
     vk::UniqueDevice m_device;
     vk::PhysicalDevice m_physicalDevice;
+    std::vector<std::string> m_enabledDeviceExtensions;
+    vk::PhysicalDeviceMemoryProperties m_memoryProperties;
 
     mutable std::mutex m_queueMutex;
     mutable std::map<vk::QueueFlags, std::vector<ThreadQueue>> m_queues;
     std::unordered_map<vk::QueueFlags, uint32_t> m_queueFamilies;
     vk::UniqueDescriptorPool m_descriptorPool;
+
+    // NOTE: Declared after m_device so that blocks are freed before the device is destroyed.
+    std::unique_ptr<MemoryAllocator> m_memoryAllocator;
+    std::unique_ptr<DescriptorSetLayoutCache> m_descriptorSetLayoutCache;
+    std::unique_ptr<PipelineCache> m_pipelineCache;
+    std::unique_ptr<PipelineRegistry> m_pipelineRegistry;
+    std::unique_ptr<DescriptorAllocator> m_descriptorAllocator;
+    std::unique_ptr<BindlessHeap> m_bindlessHeap;
+    std::unique_ptr<DescriptorBuffer> m_descriptorBuffer;
+    std::unique_ptr<UploadRing> m_uploadRing;
+    std::unique_ptr<UploadManager> m_uploadManager;
+    std::unique_ptr<SubmitPool> m_submitPool;
+
+    // NOTE: Declared last so that pending tasks finish while everything above is alive.
+    std::unique_ptr<ThreadPool> m_threadPool;
 };
 }  // namespace rv
@@ -0,0 +1,72 @@
+#pragma once
+#include "Context.hpp"
+#include "MemoryAllocator.hpp"
+
+namespace rv {
+// Reported once per moved resource. Either buffer or image is set.
+// Addresses are 0 for images and for buffers without eShaderDeviceAddress.
+struct DefragmentationMove {
+    BufferHandle buffer;
+    ImageHandle image;
+    vk::DeviceAddress oldAddress = 0;
+    vk::DeviceAddress newAddress = 0;
+};
+
+struct DefragmentationStats {
+    uint32_t moveCount = 0;
+    vk::DeviceSize movedSize = 0;
+};
+
+// Incrementally moves registered resources out of sparsely used memory blocks
+// so that MemoryAllocator can release the emptied blocks.
+// Only sub-allocated, device local resources with eTransferSrc and eTransferDst are moved.
+// NOTE: Resources must not be written by the GPU while they are moved.
+class Defragmenter {
+public:
+    static constexpr vk::DeviceSize DefaultStepSize = 4ull * 1024 * 1024;
+
+    Defragmenter(const Context& context);
+
+    void addBuffer(BufferHandle buffer);
+    void addImage(ImageHandle image);
+
+    // Descriptors pointing to moved resources are rewritten.
+    // NOTE: The sets must not be used by pending command buffers during step().
+    void addDescriptorSet(DescriptorSetHandle descSet);
+
+    // e.g. rewrite device addresses stored in other buffers.
+    // Moved resources also get new BindlessHeap indices (read them from the resource).
+    void setMoveCallback(std::function<void(const DefragmentationMove&)> callback);
+
+    // Record copies of up to `maxSize` bytes into `commandBuffer`.
+    // The old memory is released once the current frame slot of UploadRing is reused,
+    // so `commandBuffer` must be submitted within this frame.
+    // Returns the moved size.
+    auto step(CommandBufferHandle commandBuffer, vk::DeviceSize maxSize = DefaultStepSize)
+        -> vk::DeviceSize;
+
+    auto getStats() const -> DefragmentationStats { return m_stats; }
+
+private:
+    auto isMovable(const Buffer& buffer) const -> bool;
+    auto isMovable(const Image& image) const -> bool;
+
+    void moveBuffer(CommandBufferHandle commandBuffer,
+                    BufferHandle buffer,
+                    const MemoryAllocation& allocation);
+    void moveImage(CommandBufferHandle commandBuffer,
+                   ImageHandle image,
+                   const MemoryAllocation& allocation);
+
+    void updateDescriptorSets(const std::function<bool(DescriptorSet&)>& replace);
+
+    const Context* m_context = nullptr;
+
+    std::vector<std::weak_ptr<Buffer>> m_buffers;
+    std::vector<std::weak_ptr<Image>> m_images;
+    std::vector<std::weak_ptr<DescriptorSet>> m_descSets;
+    std::function<void(const DefragmentationMove&)> m_moveCallback;
+
+    DefragmentationStats m_stats;
+};
+}  // namespace rv
@@ -0,0 +1,99 @@
+#pragma once
+#include <mutex>
+
+#include "Context.hpp"
+
+namespace rv {
+struct DescriptorAllocation {
+    vk::DescriptorSet descSet;
+
+    // Index of the persistent pool. UINT32_MAX for transient sets.
+    uint32_t pool = std::numeric_limits<uint32_t>::max();
+};
+
+struct DescriptorAllocatorStats {
+    uint32_t poolCount = 0;
+    uint32_t transientPoolCount = 0;
+    uint32_t liveSetCount = 0;
+    uint32_t transientSetCount = 0;
+};
+
+// Descriptor sets from chained pools.
+// When a pool is full, a new one is created. Its size per descriptor type is
+// learned from the sets allocated so far, and maxSets grows geometrically.
+// Pools are created without eFreeDescriptorSet: a persistent pool is reset
+// as a whole once all of its sets are freed, so it never fragments.
+// Transient sets live for one frame. Their pools are reset in bulk by
+// beginFrame() when the frame slot is reused, so they are never freed individually.
+// NOTE: beginFrame() is driven by Context::beginFrame(). Without a Swapchain, call
+// Context::collectGarbage() or transient pools keep growing.
+class DescriptorAllocator {
+public:
+    static constexpr uint32_t MinSetsPerPool = 64;
+    static constexpr uint32_t MaxSetsPerPool = 4096;
+
+    DescriptorAllocator(const Context& context);
+    ~DescriptorAllocator();
+
+    DescriptorAllocator(const DescriptorAllocator&) = delete;
+    auto operator=(const DescriptorAllocator&) -> DescriptorAllocator& = delete;
+
+    // `bindings` must match `layout`. They are used to size new pools.
+    auto allocate(vk::DescriptorSetLayout layout,
+                  ArrayProxy<vk::DescriptorSetLayoutBinding> bindings) -> DescriptorAllocation;
+
+    void free(const DescriptorAllocation& allocation);
+
+    // Valid until the current frame slot is reused
+    auto allocateTransient(vk::DescriptorSetLayout layout,
+                           ArrayProxy<vk::DescriptorSetLayoutBinding> bindings)
+        -> vk::DescriptorSet;
+
+    // NOTE: Must not be called while the GPU still uses transient sets
+    void setFrameCount(uint32_t frameCount);
+
+    // Called after the previous submission of `frameIndex` was waited
+    void beginFrame(uint32_t frameIndex);
+
+    auto getStats() const -> DescriptorAllocatorStats;
+
+private:
+    struct Pool {
+        vk::DescriptorPool pool;
+        uint32_t liveSetCount = 0;
+        bool full = false;
+    };
+
+    struct Frame {
+        std::vector<vk::DescriptorPool> pools;
+        uint32_t current = 0;
+        uint32_t setCount = 0;
+    };
+
+    // Record the descriptor counts of a set for pool sizing
+    void learn(ArrayProxy<vk::DescriptorSetLayoutBinding> bindings);
+
+    auto createPool(ArrayProxy<vk::DescriptorSetLayoutBinding> bindings) -> vk::DescriptorPool;
+
+    // Returns null if the pool is out of memory
+    auto tryAllocate(vk::DescriptorPool pool, vk::DescriptorSetLayout layout) const
+        -> vk::DescriptorSet;
+
+    const Context* m_context = nullptr;
+
+    mutable std::mutex m_mutex;
+
+    std::vector<Pool> m_pools;
+    // Empty pools that were reset, reused before creating new ones
+    std::vector<uint32_t> m_freePools;
+    uint32_t m_currentPool = std::numeric_limits<uint32_t>::max();
+
+    std::vector<Frame> m_frames;
+    uint32_t m_frameIndex = 0;
+
+    // Learned usage
+    std::map<vk::DescriptorType, uint64_t> m_descriptorCounts;
+    uint64_t m_setCount = 0;
+    uint32_t m_setsPerPool = MinSetsPerPool;
+};
+}  // namespace rv
@@ -0,0 +1,77 @@
+#pragma once
+#include <mutex>
+
+#include "Context.hpp"
+
+namespace rv {
+struct DescriptorBufferAllocation {
+    vk::DeviceSize offset = 0;
+    vk::DeviceSize size = 0;
+};
+
+// Backend of DescriptorSet for VK_EXT_descriptor_buffer.
+// One host visible buffer holds every set: descriptors are written with
+// vkGetDescriptorEXT straight into it, and sets are bound by offset.
+// The buffer is split into a persistent region managed by a free list
+// followed by one linear segment per in-flight frame for transient sets.
+// NOTE: Pipelines must be created with eDescriptorBufferEXT, so the classic
+// descriptor sets of BindlessHeap can't be used while this backend is active.
+class DescriptorBuffer {
+public:
+    static constexpr vk::DeviceSize DefaultPersistentSize = 4ull * 1024 * 1024;
+    static constexpr vk::DeviceSize DefaultFrameSize = 1ull * 1024 * 1024;
+
+    DescriptorBuffer(const Context& context,
+                     vk::DeviceSize persistentSize = DefaultPersistentSize,
+                     vk::DeviceSize frameSize = DefaultFrameSize);
+
+    auto allocate(vk::DeviceSize size) -> DescriptorBufferAllocation;
+
+    // The range is reused after the current frame slot of UploadRing is reused
+    void free(const DescriptorBufferAllocation& allocation);
+
+    // Valid until the current frame slot is reused
+    auto allocateTransient(vk::DeviceSize size) -> DescriptorBufferAllocation;
+
+    // NOTE: Must not be called while the GPU still uses the buffer
+    void setFrameCount(uint32_t frameCount);
+
+    // Called after the previous submission of `frameIndex` was waited
+    void beginFrame(uint32_t frameIndex);
+
+    // NOTE: Don't keep the pointer. setFrameCount() recreates the buffer.
+    auto getMapped(vk::DeviceSize offset) const -> void* { return m_mapped + offset; }
+
+    auto getDescriptorSize(vk::DescriptorType type) const -> size_t;
+
+    auto getBindingInfo() const -> vk::DescriptorBufferBindingInfoEXT;
+
+    auto getProperties() const -> const vk::PhysicalDeviceDescriptorBufferPropertiesEXT& {
+        return m_props;
+    }
+
+private:
+    struct RetiredRange;
+
+    void createBuffer(uint32_t frameCount);
+    void release(vk::DeviceSize offset, vk::DeviceSize size);
+
+    const Context* m_context = nullptr;
+    vk::PhysicalDeviceDescriptorBufferPropertiesEXT m_props;
+
+    std::mutex m_mutex;
+
+    vk::BufferUsageFlags m_usage;
+    BufferHandle m_buffer;
+    uint8_t* m_mapped = nullptr;
+
+    // Persistent region: [0, m_persistentSize)
+    vk::DeviceSize m_persistentSize = 0;
+    std::map<vk::DeviceSize, vk::DeviceSize> m_freeRanges;
+
+    // Frame segments follow the persistent region
+    vk::DeviceSize m_frameSize = 0;
+    std::vector<vk::DeviceSize> m_frameHeads;
+    uint32_t m_frameIndex = 0;
+};
+}  // namespace rv
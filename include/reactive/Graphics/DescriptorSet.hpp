@@ -1,49 +1,120 @@
 #pragma once
-#include <SPIRV-Reflect/spirv_reflect.h>
 #include <unordered_map>
 #include <variant>
 
 #include "ArrayProxy.hpp"
+#include "DescriptorAllocator.hpp"
+#include "DescriptorBuffer.hpp"
 #include "Image.hpp"
 #include "Shader.hpp"
 
 namespace rv {
 struct DescriptorSetCreateInfo {
     ArrayProxy<ShaderHandle> shaders;
+
+    // Only the reflected bindings of this set are used. Resources of bindless
+    // pipelines are at set 1, since BindlessHeap occupies set 0.
+    uint32_t set = 0;
+
     ArrayProxy<std::pair<const char*, std::variant<ArrayProxy<BufferHandle>, uint32_t>>> buffers;
     ArrayProxy<std::pair<const char*, std::variant<ArrayProxy<ImageHandle>, uint32_t>>> images;
     ArrayProxy<std::pair<const char*, std::variant<ArrayProxy<TopAccelHandle>, uint32_t>>> accels;
+
+    // Allocated from the per-frame pools of DescriptorAllocator
+    // (or the frame segment of DescriptorBuffer).
+    // Valid until the current frame slot is reused.
+    bool transient = false;
+
+    // Uniform or storage buffers bound with a dynamic offset. Each descriptor covers
+    // `range` bytes, so one large buffer can serve many draws with one set.
+    // NOTE: Not supported by the descriptor buffer backend.
+    ArrayProxy<std::pair<const char*, vk::DeviceSize>> dynamicBuffers;
+
+    // Push descriptor set (VK_KHR_push_descriptor). Nothing is allocated and
+    // CommandBuffer::pushDescriptorSet() records the current resources.
+    bool push = false;
 };
 
 class DescriptorSet {
 public:
     DescriptorSet(const Context& context, const DescriptorSetCreateInfo& createInfo);
+    ~DescriptorSet();
 
+    // Write only the bindings that were set since the last update
     void update();
 
+    // Slot of a resource name. Resolve once and use the slot overloads in hot paths.
+    auto getSlot(const std::string& name) const -> uint32_t;
+    auto getSlotCount() const -> uint32_t { return static_cast<uint32_t>(m_descriptors.size()); }
+
     void set(const std::string& name, ArrayProxy<BufferHandle> buffers);
     void set(const std::string& name, ArrayProxy<ImageHandle> images);
     void set(const std::string& name, ArrayProxy<TopAccelHandle> accels);
 
-    vk::DescriptorSetLayout getLayout() const { return *m_descSetLayout; }
-    vk::DescriptorSet getDescriptorSet() const { return *m_descSet; }
+    void set(uint32_t slot, ArrayProxy<BufferHandle> buffers);
+    void set(uint32_t slot, ArrayProxy<ImageHandle> images);
+    void set(uint32_t slot, ArrayProxy<TopAccelHandle> accels);
 
-private:
-    void addResources(ShaderHandle shader);
-    void updateBindingMap(const SpvReflectDescriptorBinding* binding, vk::ShaderStageFlags stage);
+    // Point descriptors of a moved resource to the new one.
+    // Returns true if any descriptor was replaced. Call update() afterwards.
+    auto replaceBuffer(vk::Buffer oldBuffer, const vk::DescriptorBufferInfo& newInfo) -> bool;
+    auto replaceImage(vk::ImageView oldView, const vk::DescriptorImageInfo& newInfo) -> bool;
 
-    const Context* m_context;
-    vk::UniqueDescriptorSet m_descSet;
-    vk::UniqueDescriptorSetLayout m_descSetLayout;
+    vk::DescriptorSetLayout getLayout() const { return m_descSetLayout; }
+    vk::DescriptorSet getDescriptorSet() const { return m_allocation.descSet; }
+
+    // With the descriptor buffer backend, the set has no vk::DescriptorSet
+    // and is bound by its offset in DescriptorBuffer.
+    auto usesDescriptorBuffer() const -> bool { return m_descriptorBuffer; }
+
+    auto isPush() const -> bool { return m_push; }
 
+    // Writes of every binding that has resources. dstSet is not set.
+    auto getPushWrites() -> const std::vector<vk::WriteDescriptorSet>&;
+
+    // Number of offsets CommandBuffer::bindDescriptorSet() takes, ordered by binding number
+    auto getDynamicOffsetCount() const -> uint32_t { return m_dynamicOffsetCount; }
+    auto getDescriptorBufferOffset() const -> vk::DeviceSize { return m_bufferAllocation.offset; }
+
+private:
     using BufferInfos = std::vector<vk::DescriptorBufferInfo>;
     using ImageInfos = std::vector<vk::DescriptorImageInfo>;
     using AccelInfos = std::vector<vk::WriteDescriptorSetAccelerationStructureKHR>;
     struct Descriptor {
         vk::DescriptorSetLayoutBinding binding;
         std::variant<BufferInfos, ImageInfos, AccelInfos> infos;
+        bool dirty = false;
+
+        // Offset of the binding in the set for the descriptor buffer backend
+        vk::DeviceSize bufferOffset = 0;
+
+        // Range of each buffer descriptor of a dynamic binding. 0 for the whole buffer.
+        vk::DeviceSize dynamicRange = 0;
     };
 
-    std::unordered_map<std::string, Descriptor> m_descriptors;
+    void addResources(ShaderHandle shader);
+    void markDirty(uint32_t slot);
+    void writeDescriptorBuffer(const Descriptor& descriptor) const;
+    auto makeWrite(const Descriptor& descriptor) const -> vk::WriteDescriptorSet;
+    void setDynamic(uint32_t slot, vk::DeviceSize range);
+    void updateBindingMap(const ShaderBinding& binding);
+
+    const Context* m_context;
+    uint32_t m_set = 0;
+    DescriptorAllocation m_allocation;
+    DescriptorBufferAllocation m_bufferAllocation;
+    bool m_transient = false;
+    bool m_descriptorBuffer = false;
+    bool m_push = false;
+    uint32_t m_dynamicOffsetCount = 0;
+    // NOTE: Owned by DescriptorSetLayoutCache
+    vk::DescriptorSetLayout m_descSetLayout;
+
+    // Indexed by slot
+    std::vector<Descriptor> m_descriptors;
+    std::unordered_map<std::string, uint32_t> m_slots;
+
+    std::vector<uint32_t> m_dirtySlots;
+    std::vector<vk::WriteDescriptorSet> m_writes;
 };
 }  // namespace rv
@@ -0,0 +1,36 @@
+#pragma once
+#include <mutex>
+
+#include "Context.hpp"
+
+namespace rv {
+// Descriptor set layouts shared by identical binding lists.
+// Sets and pipelines that reflect the same resources get the same layout handle,
+// so their pipeline layouts are compatible and no layout is created twice.
+// Layouts live until the Context is destroyed.
+class DescriptorSetLayoutCache {
+public:
+    DescriptorSetLayoutCache(const Context& context);
+
+    // The order of `bindings` doesn't matter
+    auto getOrCreate(ArrayProxy<vk::DescriptorSetLayoutBinding> bindings,
+                     vk::DescriptorSetLayoutCreateFlags flags = {}) -> vk::DescriptorSetLayout;
+
+    auto getLayoutCount() const -> uint32_t;
+
+private:
+    struct Entry {
+        vk::DescriptorSetLayoutCreateFlags flags;
+        std::vector<vk::DescriptorSetLayoutBinding> bindings;
+        vk::UniqueDescriptorSetLayout layout;
+    };
+
+    const Context* m_context = nullptr;
+
+    mutable std::mutex m_mutex;
+
+    // Entries with the same hash are compared binding by binding
+    std::unordered_map<size_t, std::vector<Entry>> m_layouts;
+    uint32_t m_layoutCount = 0;
+};
+}  // namespace rv
@@ -0,0 +1,272 @@
+#pragma once
+#include <algorithm>
+
+#include "Buffer.hpp"
+#include "CommandBuffer.hpp"
+#include "DescriptorSet.hpp"
+#include "UploadRing.hpp"
+
+namespace rv {
+struct GpuVectorCreateInfo {
+    // eTransferDst and eTransferSrc are always added.
+    // With eShaderDeviceAddress, an indirection buffer holding the current
+    // device address is also created (see getIndirectAddress()).
+    vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer;
+
+    size_t capacity = 0;
+
+    std::string debugName;
+};
+
+// Typed device local array that grows geometrically.
+// Elements are edited on a CPU shadow and upload() copies only the dirty ranges.
+// The device buffer is reallocated inside upload(). The old buffer is retired to
+// UploadRing and the registered descriptor sets are rewritten.
+// Descriptor sets can't be updated while pending command buffers use them, so a
+// reallocation with bound sets waits for the last submission to the queues given in
+// bind(). Other queues and the rest of the device keep running. Use reserve() or
+// getIndirectAddress() to avoid the stall on hot paths.
+// NOTE: Call upload() before recording commands that use the registered descriptor sets,
+// and from the thread that submits them. Queue timelines are per thread.
+template <typename T>
+class GpuVector {
+    static_assert(std::is_trivially_copyable_v<T>, "GpuVector requires a trivially copyable type");
+
+public:
+    static constexpr size_t MinCapacity = 16;
+
+    GpuVector(const Context& context, const GpuVectorCreateInfo& createInfo)
+        : m_context{&context},
+          m_usage{createInfo.usage | vk::BufferUsageFlagBits::eTransferDst |
+                  vk::BufferUsageFlagBits::eTransferSrc},
+          m_capacity{std::max(createInfo.capacity, MinCapacity)},
+          m_debugName{createInfo.debugName} {
+        m_shadow.reserve(m_capacity);
+        m_buffer = createBuffer(m_capacity);
+        if (m_usage & vk::BufferUsageFlagBits::eShaderDeviceAddress) {
+            m_addressBuffer = m_context->createBuffer({
+                .usage = vk::BufferUsageFlagBits::eStorageBuffer |
+                         vk::BufferUsageFlagBits::eShaderDeviceAddress |
+                         vk::BufferUsageFlagBits::eTransferDst,
+                .memory = MemoryIntent::GpuOnly,
+                .size = sizeof(vk::DeviceAddress),
+                .debugName = m_debugName + "::m_addressBuffer",
+            });
+            m_addressDirty = true;
+        }
+    }
+
+    GpuVector(const GpuVector&) = delete;
+    GpuVector& operator=(const GpuVector&) = delete;
+
+    auto size() const -> size_t { return m_shadow.size(); }
+    auto capacity() const -> size_t { return m_capacity; }
+    auto empty() const -> bool { return m_shadow.empty(); }
+    auto data() const -> const T* { return m_shadow.data(); }
+
+    auto operator[](size_t index) const -> const T& { return m_shadow[index]; }
+
+    // Returned reference marks the element dirty
+    auto modify(size_t index) -> T& {
+        markDirty(index, 1);
+        return m_shadow[index];
+    }
+
+    void set(size_t index, const T& value) {
+        m_shadow[index] = value;
+        markDirty(index, 1);
+    }
+
+    // Returns the index of the new element
+    auto push_back(const T& value) -> size_t {
+        grow(m_shadow.size() + 1);
+        m_shadow.push_back(value);
+        markDirty(m_shadow.size() - 1, 1);
+        return m_shadow.size() - 1;
+    }
+
+    // Returns the index of the first new element
+    auto append(ArrayProxy<T> values) -> size_t {
+        size_t first = m_shadow.size();
+        grow(first + values.size());
+        m_shadow.insert(m_shadow.end(), values.begin(), values.end());
+        markDirty(first, values.size());
+        return first;
+    }
+
+    void pop_back() { m_shadow.pop_back(); }
+
+    // Move the last element into `index` and shrink by one.
+    // Returns the previous index of the moved element so that
+    // references to it can be fixed up. Equals `index` if nothing moved.
+    auto eraseSwap(size_t index) -> size_t {
+        size_t last = m_shadow.size() - 1;
+        if (index != last) {
+            m_shadow[index] = m_shadow[last];
+            markDirty(index, 1);
+        }
+        m_shadow.pop_back();
+        return last;
+    }
+
+    void resize(size_t size, const T& value = T{}) {
+        size_t oldSize = m_shadow.size();
+        grow(size);
+        m_shadow.resize(size, value);
+        if (size > oldSize) {
+            markDirty(oldSize, size - oldSize);
+        }
+    }
+
+    void reserve(size_t capacity) { grow(capacity); }
+
+    // Keeps the device buffer
+    void clear() {
+        m_shadow.clear();
+        m_dirtyRanges.clear();
+    }
+
+    // Rewritten with the new buffer on reallocation.
+    // `queueFlags` are the queues whose submissions use the set.
+    void bind(DescriptorSetHandle descSet,
+              const std::string& name,
+              vk::QueueFlags queueFlags = QueueFlags::General) {
+        descSet->set(name, m_buffer);
+        m_descSets.push_back({descSet, name, queueFlags});
+    }
+
+    // Reallocate the device buffer if needed and record copies of the dirty ranges
+    void upload(CommandBufferHandle commandBuffer) {
+        if (m_buffer->getSize() < m_capacity * sizeof(T)) {
+            reallocate();
+        }
+        if (m_addressBuffer && m_addressDirty) {
+            vk::DeviceAddress address = m_buffer->getAddress();
+            commandBuffer->copyBuffer(m_addressBuffer, &address, 0, sizeof(address));
+            m_addressDirty = false;
+        }
+        // Drop ranges of elements removed after they were written
+        vk::DeviceSize usedSize = m_shadow.size() * sizeof(T);
+        std::erase_if(m_dirtyRanges, [&](BufferRange& range) {
+            range.size = std::min(range.size, usedSize - std::min(range.offset, usedSize));
+            return range.size == 0;
+        });
+        if (!m_dirtyRanges.empty()) {
+            commandBuffer->copyBuffer(m_buffer, m_shadow.data(), m_dirtyRanges);
+            m_dirtyRanges.clear();
+        }
+    }
+
+    auto hasPendingUploads() const -> bool {
+        return !m_dirtyRanges.empty() || m_addressDirty ||
+               m_buffer->getSize() < m_capacity * sizeof(T);
+    }
+
+    // NOTE: Changes when the buffer is reallocated
+    auto getBuffer() const -> BufferHandle { return m_buffer; }
+    auto getAddress() const -> vk::DeviceAddress { return m_buffer->getAddress(); }
+
+    // Address of a buffer that holds getAddress().
+    // It never changes, so shaders can keep it across reallocations.
+    auto getIndirectAddress() const -> vk::DeviceAddress {
+        RV_ASSERT(m_addressBuffer, "GpuVector was created without eShaderDeviceAddress.");
+        return m_addressBuffer->getAddress();
+    }
+
+private:
+    auto createBuffer(size_t capacity) const -> BufferHandle {
+        return m_context->createBuffer({
+            .usage = m_usage,
+            .memory = MemoryIntent::GpuOnly,
+            .size = capacity * sizeof(T),
+            .debugName = m_debugName,
+        });
+    }
+
+    void grow(size_t size) {
+        if (size <= m_capacity) {
+            return;
+        }
+        while (m_capacity < size) {
+            m_capacity *= 2;
+        }
+        m_shadow.reserve(m_capacity);
+    }
+
+    void reallocate() {
+        // The old buffer may still be read by in-flight frames
+        m_context->getUploadRing().retire(m_buffer);
+        m_buffer = createBuffer(m_capacity);
+
+        // The shadow is the source of truth, so upload everything instead of a GPU copy
+        m_dirtyRanges.clear();
+        markDirty(0, m_shadow.size());
+        m_addressDirty = m_addressBuffer != nullptr;
+
+        std::erase_if(m_descSets, [](const auto& binding) { return binding.descSet.expired(); });
+        if (m_descSets.empty()) {
+            return;
+        }
+
+        // NOTE: In-flight frames may still use the sets, so wait only for the queues that
+        // use them. Capacity grows geometrically, so this happens only a few times.
+        std::vector<vk::QueueFlags> waitedQueues;
+        for (const auto& binding : m_descSets) {
+            if (std::ranges::find(waitedQueues, binding.queueFlags) != waitedQueues.end()) {
+                continue;
+            }
+            SemaphoreSubmit point = m_context->getQueueTimeline(binding.queueFlags);
+            if (!m_context->isSemaphoreSignaled(point)) {
+                spdlog::debug("GpuVector: {} reallocated with bound descriptor sets. Waiting.",
+                              m_debugName);
+                m_context->waitSemaphore(point);
+            }
+            waitedQueues.push_back(binding.queueFlags);
+        }
+        for (auto& binding : m_descSets) {
+            DescriptorSetHandle handle = binding.descSet.lock();
+            handle->set(binding.name, m_buffer);
+            handle->update();
+        }
+    }
+
+    void markDirty(size_t index, size_t count) {
+        if (count == 0) {
+            return;
+        }
+        vk::DeviceSize offset = index * sizeof(T);
+        vk::DeviceSize size = count * sizeof(T);
+
+        // Sequential writes extend the last range
+        if (!m_dirtyRanges.empty()) {
+            BufferRange& last = m_dirtyRanges.back();
+            if (last.offset <= offset && offset <= last.offset + last.size) {
+                last.size = std::max(last.size, offset + size - last.offset);
+                return;
+            }
+        }
+        m_dirtyRanges.push_back({offset, size});
+    }
+
+    const Context* m_context = nullptr;
+
+    vk::BufferUsageFlags m_usage;
+    size_t m_capacity = 0;
+    std::string m_debugName;
+
+    std::vector<T> m_shadow;
+    std::vector<BufferRange> m_dirtyRanges;
+
+    BufferHandle m_buffer;
+    BufferHandle m_addressBuffer;
+    bool m_addressDirty = false;
+
+    struct BoundSet {
+        std::weak_ptr<DescriptorSet> descSet;
+        std::string name;
+        vk::QueueFlags queueFlags;
+    };
+
+    std::vector<BoundSet> m_descSets;
+};
+}  // namespace rv
@@ -1,6 +1,7 @@
 #pragma once
 #include <vulkan/vulkan.hpp>
 #include "Context.hpp"
+#include "MemoryAllocator.hpp"
 
 namespace rv {
 class Buffer;
@@ -34,16 +35,37 @@ struct ImageCreateInfo {
 
     std::optional<SamplerCreateInfo> samplerInfo;
 
+    // Register the view and sampler in BindlessHeap (see Image::getSampledImageIndex())
+    bool bindless = false;
+
     // Debug
     std::string debugName{};
 };
 
+// Last known state of one mip level of one array layer.
+// `stage` and `access` describe the last use and become the source scope
+// of the next barrier.
+struct ImageSubresourceState {
+    vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+    vk::PipelineStageFlags2 stage = vk::PipelineStageFlagBits2::eAllCommands;
+    vk::AccessFlags2 access;
+};
+
 class Image {
     friend class CommandBuffer;
+    friend class UploadManager;
+    friend class Defragmenter;
+    friend class RenderGraph;
 
 public:
     Image(const Context& context, const ImageCreateInfo& createInfo);
 
+    // Bind to memory owned by the caller (e.g. aliased transient images)
+    Image(const Context& context,
+          const ImageCreateInfo& createInfo,
+          vk::DeviceMemory memory,
+          vk::DeviceSize memoryOffset);
+
     Image(vk::Image image,
           vk::ImageView view,
           vk::Extent3D extent,
@@ -54,7 +76,9 @@ public:
           m_viewType{vk::ImageViewType::e2D},
           m_extent{extent},
           m_format{format},
-          m_aspect{aspect} {}
+          m_aspect{aspect} {
+        initSubresourceStates(vk::ImageLayout::eUndefined);
+    }
 
     Image(const Context* context,
           vk::Image _image,
@@ -73,15 +97,38 @@ public:
     auto getImage() const -> vk::Image { return m_image; }
     auto getView() const -> vk::ImageView { return m_view; }
     auto getSampler() const -> vk::Sampler { return m_sampler; }
-    auto getInfo() const -> vk::DescriptorImageInfo { return {m_sampler, m_view, m_layout}; }
+    auto getInfo() const -> vk::DescriptorImageInfo { return {m_sampler, m_view, getLayout()}; }
     auto getMipLevels() const -> uint32_t { return m_mipLevels; }
     auto getAspectMask() const -> vk::ImageAspectFlags { return m_aspect; }
-    auto getLayout() const -> vk::ImageLayout { return m_layout; }
+    // Layout of mip 0 of layer 0.
+    // NOTE: Mips may differ during mipmap generation. See hasUniformLayout().
+    auto getLayout() const -> vk::ImageLayout { return m_subresourceStates.front().layout; }
+    auto getLayout(uint32_t mipLevel, uint32_t arrayLayer = 0) const -> vk::ImageLayout {
+        return getSubresourceState(mipLevel, arrayLayer).layout;
+    }
+    auto getSubresourceState(uint32_t mipLevel, uint32_t arrayLayer = 0) const
+        -> const ImageSubresourceState& {
+        return m_subresourceStates[arrayLayer * m_mipLevels + mipLevel];
+    }
+    auto hasUniformLayout() const -> bool;
     auto getExtent() const -> vk::Extent3D { return m_extent; }
     auto getFormat() const -> vk::Format { return m_format; }
     auto getLayerCount() const -> uint32_t { return m_layerCount; }
     auto getViewType() const -> vk::ImageViewType { return m_viewType; }
 
+    // Indices in BindlessHeap. BindlessHeap::InvalidIndex if not registered.
+    // Only images created with `bindless = true` are registered. Sampled and
+    // storage indices are assigned to those with a view and the matching usage,
+    // and the sampler index to those with a sampler.
+    // NOTE: Also InvalidIndex if the device has no BindlessHeap or the heap is full
+    auto getSampledImageIndex() const -> uint32_t { return m_sampledImageIndex; }
+    auto getStorageImageIndex() const -> uint32_t { return m_storageImageIndex; }
+    auto getSamplerIndex() const -> uint32_t { return m_samplerIndex; }
+
+    // Requirements of an image created with `createInfo`, without creating it
+    static auto getMemoryRequirements(const Context& context, const ImageCreateInfo& createInfo)
+        -> vk::MemoryRequirements;
+
     // Ensure that data is pre-filled
     // ImageLayout is implicitly shifted to ShaderReadOnlyOptimal
     void generateMipmaps(const CommandBuffer& commandBuffer);
@@ -102,6 +149,16 @@ public:
         -> ImageHandle;
 
 private:
+    auto getSubresourceState(uint32_t mipLevel, uint32_t arrayLayer) -> ImageSubresourceState& {
+        return m_subresourceStates[arrayLayer * m_mipLevels + mipLevel];
+    }
+
+    void initSubresourceStates(vk::ImageLayout layout);
+
+    // Overwrite the layout of every subresource without a barrier.
+    // The last use is unknown, so the next barrier waits for all commands.
+    void setLayout(vk::ImageLayout layout);
+
     void createImageView(vk::ImageViewType viewType, vk::ImageAspectFlags aspect) {
         m_viewType = viewType;
         m_aspect = aspect;
@@ -120,6 +177,7 @@ private:
         viewInfo.setSubresourceRange(subresourceRange);
 
         m_view = m_context->getDevice().createImageView(viewInfo);
+        writeBindlessImage();
     }
 
     void createSampler(vk::Filter filter,
@@ -141,20 +199,34 @@ private:
         samplerInfo.setCompareEnable(VK_TRUE);
         samplerInfo.setCompareOp(vk::CompareOp::eLess);
         m_sampler = m_context->getDevice().createSampler(samplerInfo);
+        writeBindlessSampler();
     }
 
+    // Allocate indices on first use and (re)write the heap descriptors
+    void writeBindlessImage();
+    void writeBindlessSampler();
+
     const Context* m_context = nullptr;
     std::string m_debugName;
 
     vk::Image m_image;
+    MemoryAllocation m_allocation;
+
+    // Kept to recreate the image when it is moved
+    vk::ImageUsageFlags m_usage;
+    vk::ImageType m_imageType = vk::ImageType::e2D;
+
+    // Memory allocated outside of MemoryAllocator (e.g. KTX)
     vk::DeviceMemory m_memory;
     vk::ImageView m_view;
     vk::Sampler m_sampler;
     vk::ImageViewType m_viewType;
 
     bool m_hasOwnership = false;
+    bool m_bindless = false;
 
-    vk::ImageLayout m_layout = vk::ImageLayout::eUndefined;
+    // [arrayLayer * m_mipLevels + mipLevel]
+    std::vector<ImageSubresourceState> m_subresourceStates;
     vk::Extent3D m_extent;
     vk::Format m_format = {};
 
@@ -162,5 +234,9 @@ private:
     uint32_t m_layerCount = 1;
 
     vk::ImageAspectFlags m_aspect;
+
+    uint32_t m_sampledImageIndex = std::numeric_limits<uint32_t>::max();
+    uint32_t m_storageImageIndex = std::numeric_limits<uint32_t>::max();
+    uint32_t m_samplerIndex = std::numeric_limits<uint32_t>::max();
 };
 }  // namespace rv
@@ -0,0 +1,192 @@
+#pragma once
+#include <mutex>
+#include <set>
+
+#include "Context.hpp"
+
+namespace rv {
+struct MemoryBlock;
+
+// Memory range handed out by MemoryAllocator.
+// Resources bind at `offset` inside `memory`.
+struct MemoryAllocation {
+    vk::DeviceMemory memory;
+    vk::DeviceSize offset = 0;
+    vk::DeviceSize size = 0;
+    void* mapped = nullptr;
+    uint32_t memoryTypeIndex = 0;
+
+    // nullptr for dedicated allocations
+    MemoryBlock* block = nullptr;
+    uint32_t order = 0;
+
+    // Index to MemoryAllocator::m_categories
+    uint32_t categoryIndex = 0;
+};
+
+// Large vk::DeviceMemory sub-allocated with a buddy allocator.
+// Node sizes are powers of two and nodes are aligned to their size,
+// so every alignment requirement up to the node size is satisfied.
+struct MemoryBlock {
+    vk::DeviceMemory memory;
+    vk::DeviceSize size = 0;
+    vk::DeviceSize usedSize = 0;
+    void* mapped = nullptr;
+    uint32_t memoryTypeIndex = 0;
+    uint32_t poolIndex = 0;
+    uint32_t allocationCount = 0;
+
+    // Free node offsets for each order (node size = minNodeSize << order)
+    std::vector<std::set<vk::DeviceSize>> freeLists;
+};
+
+struct MemoryAllocatorStats {
+    // Total calls of vkAllocateMemory / vkFreeMemory
+    uint32_t allocateMemoryCount = 0;
+    uint32_t freeMemoryCount = 0;
+
+    // Live objects
+    uint32_t blockCount = 0;
+    uint32_t dedicatedCount = 0;
+    uint32_t allocationCount = 0;
+
+    // Bytes held from the driver / bytes handed out to resources
+    vk::DeviceSize reservedSize = 0;
+    vk::DeviceSize usedSize = 0;
+};
+
+// What happens when an allocation exceeds the soft budget of a heap
+enum class MemoryBudgetPolicy {
+    Warn,
+    Fail,  // throws std::runtime_error
+};
+
+struct MemoryHeapStats {
+    vk::MemoryHeapFlags flags;
+    vk::DeviceSize heapSize = 0;
+
+    vk::DeviceSize reservedSize = 0;
+    vk::DeviceSize usedSize = 0;
+
+    // Reported by VK_EXT_memory_budget (includes other processes).
+    // Without the extension, budget = heapSize and usage = reservedSize.
+    // Refreshed when device memory is allocated or freed.
+    vk::DeviceSize budget = 0;
+    vk::DeviceSize usage = 0;
+
+    // 0 means unlimited
+    vk::DeviceSize softBudget = 0;
+};
+
+struct MemoryTypeStats {
+    vk::MemoryPropertyFlags flags;
+    uint32_t heapIndex = 0;
+
+    vk::DeviceSize reservedSize = 0;
+    vk::DeviceSize usedSize = 0;
+    uint32_t allocationCount = 0;
+};
+
+struct MemoryCategoryStats {
+    vk::DeviceSize usedSize = 0;
+    uint32_t allocationCount = 0;
+};
+
+struct MemoryStats {
+    MemoryAllocatorStats total;
+    std::vector<MemoryHeapStats> heaps;
+    std::vector<MemoryTypeStats> types;
+
+    // Keyed by MemoryAllocator::getCategory()
+    std::map<std::string, MemoryCategoryStats> categories;
+};
+
+class MemoryAllocator {
+public:
+    static constexpr vk::DeviceSize MinNodeSize = 256;
+    static constexpr vk::DeviceSize DefaultBlockSize = 64ull * 1024 * 1024;
+
+    MemoryAllocator(const Context& context, vk::DeviceSize blockSize = DefaultBlockSize);
+    ~MemoryAllocator();
+
+    MemoryAllocator(const MemoryAllocator&) = delete;
+    MemoryAllocator& operator=(const MemoryAllocator&) = delete;
+
+    // linear: buffers and linear-tiling images
+    // Linear and optimal resources are kept in separate blocks
+    // when bufferImageGranularity is larger than MinNodeSize.
+    // Heaps over budget are used only if no other heap has a matching type.
+    auto allocate(const vk::MemoryRequirements& requirements,
+                  MemoryTypeRequest request,
+                  bool linear,
+                  std::string_view category = "Other") -> MemoryAllocation;
+
+    void free(const MemoryAllocation& allocation);
+
+    // Blocks worth emptying: the least used block of each pool that has
+    // several blocks, if it is at most half full
+    auto getDefragmentationSources() const -> std::vector<const MemoryBlock*>;
+
+    // Allocate a node of the same size and pool as `allocation` outside of `excludedBlocks`.
+    // Never creates a block. Returns std::nullopt if the other blocks have no room.
+    auto allocateForMove(const MemoryAllocation& allocation,
+                         const std::vector<const MemoryBlock*>& excludedBlocks)
+        -> std::optional<MemoryAllocation>;
+
+    auto getStats() const -> MemoryAllocatorStats;
+
+    auto getMemoryStats() const -> MemoryStats;
+
+    void setSoftBudget(uint32_t heapIndex, vk::DeviceSize budget, MemoryBudgetPolicy policy);
+
+    // "sphere::m_vertexBuffer" -> "m_vertexBuffer"
+    // Names without "::" (e.g. file paths) fall back to `fallback`.
+    static auto getCategory(std::string_view debugName, std::string_view fallback)
+        -> std::string_view;
+
+private:
+    struct HeapBudget {
+        vk::DeviceSize softBudget = 0;
+        MemoryBudgetPolicy policy = MemoryBudgetPolicy::Warn;
+        bool warned = false;
+    };
+
+    auto getPoolIndex(uint32_t memoryTypeIndex, bool linear) const -> uint32_t;
+    auto getBlockSize(uint32_t memoryTypeIndex) const -> vk::DeviceSize;
+    auto getCategoryIndex(std::string_view category) -> uint32_t;
+
+    void checkBudget(uint32_t memoryTypeIndex, vk::DeviceSize size);
+    auto getOverBudgetHeapBits(vk::DeviceSize size) const -> uint32_t;
+    void updateDriverBudget();
+    void addUsedSize(const MemoryAllocation& allocation, vk::DeviceSize size);
+    void subUsedSize(const MemoryAllocation& allocation, vk::DeviceSize size);
+
+    auto allocateDeviceMemory(vk::DeviceSize size, uint32_t memoryTypeIndex, void** mapped)
+        -> vk::DeviceMemory;
+    void freeDeviceMemory(vk::DeviceMemory memory, vk::DeviceSize size, uint32_t memoryTypeIndex);
+
+    auto createBlock(uint32_t memoryTypeIndex, uint32_t poolIndex) -> MemoryBlock*;
+    static auto allocateNode(MemoryBlock& block, uint32_t order, vk::DeviceSize& offset) -> bool;
+    static void freeNode(MemoryBlock& block, uint32_t order, vk::DeviceSize offset);
+
+    const Context* m_context = nullptr;
+
+    vk::DeviceSize m_blockSize = 0;
+    vk::DeviceSize m_bufferImageGranularity = 1;
+    vk::PhysicalDeviceMemoryProperties m_memoryProperties;
+    bool m_memoryBudgetEnabled = false;
+
+    mutable std::mutex m_mutex;
+
+    // Indexed by getPoolIndex()
+    std::vector<std::vector<std::unique_ptr<MemoryBlock>>> m_pools;
+
+    MemoryAllocatorStats m_stats;
+    std::vector<MemoryHeapStats> m_heapStats;
+    std::vector<MemoryTypeStats> m_typeStats;
+    std::vector<HeapBudget> m_heapBudgets;
+
+    std::vector<std::string> m_categories;
+    std::vector<MemoryCategoryStats> m_categoryStats;
+};
+}  // namespace rv
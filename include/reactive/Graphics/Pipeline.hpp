@@ -1,4 +1,5 @@
 #pragma once
+#include <future>
 #include <variant>
 #include <vulkan/vulkan.hpp>
 #include "ArrayProxy.hpp"
@@ -12,6 +13,12 @@ struct GraphicsPipelineCreateInfo {
     // Layout
     vk::DescriptorSetLayout descSetLayout = {};
 
+    // BindlessHeap at set 0 and descSetLayout at set 1
+    bool bindless = false;
+
+    // Push descriptor set placed after descSetLayout
+    vk::DescriptorSetLayout pushDescSetLayout = {};
+
     uint32_t pushSize = 0;
 
     // Shader
@@ -41,12 +48,16 @@ struct GraphicsPipelineCreateInfo {
 
 struct ComputePipelineCreateInfo {
     vk::DescriptorSetLayout descSetLayout = {};
+    bool bindless = false;
+    vk::DescriptorSetLayout pushDescSetLayout = {};
     uint32_t pushSize = 0;
     ShaderHandle computeShader;
 };
 
 struct MeshShaderPipelineCreateInfo {
     vk::DescriptorSetLayout descSetLayout = {};
+    bool bindless = false;
+    vk::DescriptorSetLayout pushDescSetLayout = {};
     uint32_t pushSize = 0;
     ShaderHandle taskShader;
     ShaderHandle meshShader;
@@ -90,6 +101,8 @@ struct RayTracingPipelineCreateInfo {
     ArrayProxy<CallableGroup> callableGroups;
 
     vk::DescriptorSetLayout descSetLayout = {};
+    bool bindless = false;
+    vk::DescriptorSetLayout pushDescSetLayout = {};
     uint32_t pushSize = 0;
 
     uint32_t maxRayRecursionDepth = 4;
@@ -102,15 +115,59 @@ public:
     auto getPipelineBindPoint() const -> vk::PipelineBindPoint { return m_bindPoint; }
     auto getPipelineLayout() const -> vk::PipelineLayout { return *m_pipelineLayout; }
 
+    // Set index of descSetLayout
+    auto getDescSetIndex() const -> uint32_t { return m_descSetIndex; }
+
+    // Set index of pushDescSetLayout
+    auto getPushDescSetIndex() const -> uint32_t { return m_pushDescSetIndex; }
+    auto isBindless() const -> bool { return m_bindless; }
+    auto usesDescriptorBuffer() const -> bool { return m_descriptorBuffer; }
+
 protected:
     friend class CommandBuffer;
 
+    // Uses m_pushSize and m_shaderStageFlags
+    void createPipelineLayout(vk::DescriptorSetLayout descSetLayout,
+                              vk::DescriptorSetLayout pushDescSetLayout,
+                              bool bindless);
+
+    // eDescriptorBufferEXT if the descriptor buffer backend is active
+    auto getCreateFlags() const -> vk::PipelineCreateFlags;
+
     const Context* m_context = nullptr;
     vk::UniquePipelineLayout m_pipelineLayout;
     vk::UniquePipeline m_pipeline;
     vk::ShaderStageFlags m_shaderStageFlags;
     vk::PipelineBindPoint m_bindPoint = {};
     uint32_t m_pushSize = 0;
+    bool m_bindless = false;
+    bool m_descriptorBuffer = false;
+    uint32_t m_descSetIndex = 0;
+    uint32_t m_pushDescSetIndex = 0;
+};
+
+// Pipeline built on the ThreadPool by Context::createPipelinesAsync.
+// Draw with a fallback or skip the pass until ready() returns true.
+template <typename T>
+class PipelineFuture {
+public:
+    PipelineFuture() = default;
+    PipelineFuture(std::shared_future<std::shared_ptr<T>> future) : m_future{std::move(future)} {}
+
+    auto valid() const -> bool { return m_future.valid(); }
+
+    auto ready() const -> bool {
+        return valid() && m_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    // Blocks until the pipeline is built. Rethrows the creation error.
+    auto get() const -> std::shared_ptr<T> { return m_future.get(); }
+
+    // nullptr until ready
+    auto tryGet() const -> std::shared_ptr<T> { return ready() ? get() : nullptr; }
+
+private:
+    std::shared_future<std::shared_ptr<T>> m_future;
 };
 
 class GraphicsPipeline : public Pipeline {
@@ -136,6 +193,10 @@ public:
 private:
     friend class CommandBuffer;
 
+    // Splits the creation across the calling thread and the ThreadPool
+    // with VK_KHR_deferred_host_operations
+    void createPipelineDeferred(const vk::RayTracingPipelineCreateInfoKHR& pipelineInfo);
+
     void createSBT();
 
     std::vector<vk::ShaderModule> m_shaderModules;
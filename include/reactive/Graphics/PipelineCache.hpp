@@ -0,0 +1,40 @@
+#pragma once
+#include <filesystem>
+
+#include "Context.hpp"
+
+namespace rv {
+// vk::PipelineCache shared by every pipeline of the Context.
+// The on-disk file starts with a header describing the device and driver that
+// produced it. A file from another GPU, driver or a truncated write is ignored
+// and the cache starts empty.
+class PipelineCache {
+public:
+    PipelineCache(const Context& context);
+
+    // Replace the cache with the contents of `path`.
+    // Returns false if the file is missing or invalid.
+    // NOTE: Call before pipelines are created so that they hit the cache.
+    auto load(const std::filesystem::path& path) -> bool;
+
+    // Written to a temporary file and renamed, so a crash never leaves a partial file
+    void save(const std::filesystem::path& path) const;
+
+    auto getCache() const -> vk::PipelineCache { return *m_cache; }
+
+    // Whether load() succeeded
+    auto isWarm() const -> bool { return m_warm; }
+
+private:
+    struct FileHeader;
+
+    auto makeHeader(size_t dataSize, uint64_t dataHash) const -> FileHeader;
+
+    const Context* m_context = nullptr;
+    vk::PhysicalDeviceProperties m_props;
+
+    // NOTE: Internally synchronized by the driver
+    vk::UniquePipelineCache m_cache;
+    bool m_warm = false;
+};
+}  // namespace rv
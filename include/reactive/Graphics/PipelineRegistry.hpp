@@ -0,0 +1,76 @@
+#pragma once
+#include <future>
+#include <mutex>
+
+#include "Context.hpp"
+
+namespace rv {
+// Pipelines shared by identical create infos.
+// The key covers the SPIR-V hashes of the shaders, the layouts, formats and the
+// raster and blend states. On a match, the SPIR-V is compared in full.
+// Entries don't keep pipelines alive; an expired entry is rebuilt on the next
+// request. Expired entries are pruned as the registry grows, or explicitly
+// with prune().
+// Complements PipelineCache, which only speeds up compilation of new pipelines.
+class PipelineRegistry {
+public:
+    PipelineRegistry(const Context& context);
+
+    auto getOrCreate(const GraphicsPipelineCreateInfo& createInfo) -> GraphicsPipelineHandle;
+
+    auto getOrCreate(const MeshShaderPipelineCreateInfo& createInfo) -> MeshShaderPipelineHandle;
+
+    auto getOrCreate(const ComputePipelineCreateInfo& createInfo) -> ComputePipelineHandle;
+
+    auto getOrCreate(const RayTracingPipelineCreateInfo& createInfo) -> RayTracingPipelineHandle;
+
+    auto getHitCount() const -> uint64_t;
+    auto getMissCount() const -> uint64_t;
+
+    // Pipelines that are still alive
+    auto getPipelineCount() const -> uint32_t;
+
+    // Remove entries whose pipelines were destroyed
+    void prune();
+
+    // Remove every entry. Pipelines in use stay alive but are no longer shared.
+    // NOTE: Entries being built by other threads are kept
+    void clear();
+
+private:
+    // Create info flattened to words. Shaders are stored as their SPIR-V hash.
+    using Key = std::vector<uint64_t>;
+
+    struct KeyHash {
+        auto operator()(const Key& key) const -> size_t;
+    };
+
+    struct Entry {
+        std::weak_ptr<Pipeline> pipeline;
+
+        // SPIR-V of the shaders in key order, compared when the hashes match
+        std::vector<std::vector<uint8_t>> shaderCodes;
+
+        // Valid while a thread is building the pipeline
+        std::shared_future<PipelineHandle> pending;
+    };
+
+    static constexpr size_t MinPruneThreshold = 64;
+
+    template <typename T, typename CreateInfo>
+    auto findOrCreate(const Key& key,
+                      const std::vector<ShaderHandle>& shaders,
+                      const CreateInfo& createInfo) -> std::shared_ptr<T>;
+
+    void pruneLocked();
+
+    const Context* m_context = nullptr;
+
+    mutable std::mutex m_mutex;
+    std::unordered_map<Key, Entry, KeyHash> m_entries;
+    // Entry count above which the next miss prunes
+    size_t m_pruneThreshold = MinPruneThreshold;
+    uint64_t m_hitCount = 0;
+    uint64_t m_missCount = 0;
+};
+}  // namespace rv
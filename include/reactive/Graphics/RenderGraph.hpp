@@ -0,0 +1,254 @@
+#pragma once
+#include "Context.hpp"
+#include "Image.hpp"
+
+namespace rv {
+// How a pass uses a resource.
+// `layout` is ignored for buffers.
+struct ResourceAccess {
+    vk::PipelineStageFlags2 stage;
+    vk::AccessFlags2 access;
+    vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+};
+
+// clang-format off
+namespace Access {
+static constexpr ResourceAccess TransferRead = {
+    vk::PipelineStageFlagBits2::eTransfer,
+    vk::AccessFlagBits2::eTransferRead,
+    vk::ImageLayout::eTransferSrcOptimal};
+static constexpr ResourceAccess TransferWrite = {
+    vk::PipelineStageFlagBits2::eTransfer,
+    vk::AccessFlagBits2::eTransferWrite,
+    vk::ImageLayout::eTransferDstOptimal};
+static constexpr ResourceAccess ColorAttachmentWrite = {
+    vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+    vk::AccessFlagBits2::eColorAttachmentRead | vk::AccessFlagBits2::eColorAttachmentWrite,
+    vk::ImageLayout::eAttachmentOptimal};
+static constexpr ResourceAccess DepthAttachmentWrite = {
+    vk::PipelineStageFlagBits2::eEarlyFragmentTests | vk::PipelineStageFlagBits2::eLateFragmentTests,
+    vk::AccessFlagBits2::eDepthStencilAttachmentRead | vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+    vk::ImageLayout::eAttachmentOptimal};
+static constexpr ResourceAccess FragmentSampledRead = {
+    vk::PipelineStageFlagBits2::eFragmentShader,
+    vk::AccessFlagBits2::eShaderSampledRead,
+    vk::ImageLayout::eShaderReadOnlyOptimal};
+static constexpr ResourceAccess ComputeSampledRead = {
+    vk::PipelineStageFlagBits2::eComputeShader,
+    vk::AccessFlagBits2::eShaderSampledRead,
+    vk::ImageLayout::eShaderReadOnlyOptimal};
+static constexpr ResourceAccess ComputeStorageRead = {
+    vk::PipelineStageFlagBits2::eComputeShader,
+    vk::AccessFlagBits2::eShaderStorageRead,
+    vk::ImageLayout::eGeneral};
+static constexpr ResourceAccess ComputeStorageWrite = {
+    vk::PipelineStageFlagBits2::eComputeShader,
+    vk::AccessFlagBits2::eShaderStorageRead | vk::AccessFlagBits2::eShaderStorageWrite,
+    vk::ImageLayout::eGeneral};
+static constexpr ResourceAccess RayTracingStorageWrite = {
+    vk::PipelineStageFlagBits2::eRayTracingShaderKHR,
+    vk::AccessFlagBits2::eShaderStorageRead | vk::AccessFlagBits2::eShaderStorageWrite,
+    vk::ImageLayout::eGeneral};
+static constexpr ResourceAccess VertexBufferRead = {
+    vk::PipelineStageFlagBits2::eVertexAttributeInput,
+    vk::AccessFlagBits2::eVertexAttributeRead};
+static constexpr ResourceAccess IndexBufferRead = {
+    vk::PipelineStageFlagBits2::eIndexInput,
+    vk::AccessFlagBits2::eIndexRead};
+static constexpr ResourceAccess IndirectRead = {
+    vk::PipelineStageFlagBits2::eDrawIndirect,
+    vk::AccessFlagBits2::eIndirectCommandRead};
+}  // namespace Access
+// clang-format on
+
+struct RenderGraphStats {
+    uint32_t passCount = 0;
+    uint32_t culledPassCount = 0;
+
+    // Number of vkCmdPipelineBarrier2 calls
+    uint32_t barrierBatchCount = 0;
+    uint32_t imageBarrierCount = 0;
+    uint32_t bufferBarrierCount = 0;
+
+    // Memory of transient images with and without aliasing
+    vk::DeviceSize transientMemorySize = 0;
+    vk::DeviceSize transientUnaliasedSize = 0;
+};
+
+// Image that lives only while the graph executes.
+// The image is created by compile() and may share memory with other
+// transient images whose lifetimes don't overlap.
+struct TransientImage {
+    uint32_t index = std::numeric_limits<uint32_t>::max();
+};
+
+class RenderGraph;
+
+class RenderGraphPassBuilder {
+    friend class RenderGraph;
+
+public:
+    void read(ImageHandle image, const ResourceAccess& access);
+    void read(BufferHandle buffer, const ResourceAccess& access);
+    void write(ImageHandle image, const ResourceAccess& access);
+    void write(BufferHandle buffer, const ResourceAccess& access);
+    void read(TransientImage image, const ResourceAccess& access);
+    void write(TransientImage image, const ResourceAccess& access);
+
+    // Never culled (e.g. readback, timestamps)
+    void setSideEffect() { m_sideEffect = true; }
+
+private:
+    RenderGraphPassBuilder(RenderGraph& graph, uint32_t passIndex)
+        : m_graph{&graph}, m_passIndex{passIndex} {}
+
+    RenderGraph* m_graph;
+    uint32_t m_passIndex;
+    bool m_sideEffect = false;
+};
+
+// Frame graph on top of CommandBuffer.
+// Passes declare how they use images and buffers. compile() culls passes
+// that don't contribute to the outputs, reorders independent passes so
+// that their barriers are batched, and derives synchronization2 barriers
+// and layout transitions from the declarations.
+// Transient images get memory at compile() and alias each other when
+// the levels in which they are used don't overlap.
+// Usage:
+//   graph.addPass("blur", [&](RenderGraphPassBuilder& builder) {
+//       builder.read(colorImage, Access::ComputeSampledRead);
+//       builder.write(blurImage, Access::ComputeStorageWrite);
+//   }, [&](CommandBufferHandle commandBuffer) { ... });
+//   graph.setOutput(blurImage);
+//   graph.compile();
+//   graph.execute(commandBuffer);
+class RenderGraph {
+    friend class RenderGraphPassBuilder;
+
+public:
+    using SetupFunc = std::function<void(RenderGraphPassBuilder&)>;
+    using ExecuteFunc = std::function<void(CommandBufferHandle)>;
+
+    RenderGraph(const Context& context);
+
+    void addPass(std::string name, const SetupFunc& setup, ExecuteFunc execute);
+
+    // Resources that are used after the graph (e.g. swapchain image).
+    // Passes that don't contribute to any output are culled.
+    void setOutput(ImageHandle image);
+    void setOutput(BufferHandle buffer);
+
+    // NOTE: Contents are undefined at the first use, so the first pass must write it
+    auto createTransientImage(const ImageCreateInfo& createInfo) -> TransientImage;
+
+    // Valid after compile()
+    auto getImage(TransientImage image) const -> ImageHandle;
+
+    // Remove all passes, outputs and transient declarations.
+    // Transient memory and images are kept and reused by the next compile().
+    void reset();
+
+    void compile();
+
+    // Records barriers and passes.
+    // Image states are updated at each barrier, before the pass that uses them.
+    void execute(CommandBufferHandle commandBuffer);
+
+    auto getStats() const -> RenderGraphStats { return m_stats; }
+
+    // Compiled order, for debugging
+    auto getPassOrder() const -> std::vector<std::string>;
+
+private:
+    struct Resource {
+        ImageHandle image;
+        BufferHandle buffer;
+        bool output = false;
+
+        std::optional<ImageCreateInfo> transientInfo;
+
+        // Previous transient resource in the same memory
+        int32_t aliasPrevious = -1;
+    };
+
+    // Memory shared by transient images
+    struct TransientSlot {
+        std::shared_ptr<MemoryAllocation> memory;
+        vk::MemoryRequirements requirements;
+    };
+
+    struct TransientImageCache {
+        ImageCreateInfo createInfo;
+        uint32_t slot;
+        ImageHandle image;
+        bool used = false;
+    };
+
+    struct PassAccess {
+        uint32_t resource;
+        ResourceAccess access;
+        bool write;
+    };
+
+    struct Pass {
+        std::string name;
+        ExecuteFunc execute;
+        std::vector<PassAccess> accesses;
+        bool sideEffect = false;
+    };
+
+    // Synchronization state of one resource while recording
+    struct ResourceState {
+        vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+
+        // Last write that is not yet visible to every later reader
+        vk::PipelineStageFlags2 writeStage;
+        vk::AccessFlags2 writeAccess;
+
+        // Stages and accesses that have seen the last write
+        vk::PipelineStageFlags2 visibleStage;
+        vk::AccessFlags2 visibleAccess;
+
+        // Reads since the last write (for write-after-read)
+        vk::PipelineStageFlags2 readStage;
+    };
+
+    auto getResourceIndex(const void* key, ImageHandle image, BufferHandle buffer) -> uint32_t;
+    void addAccess(uint32_t passIndex, uint32_t resource, const ResourceAccess& access, bool write);
+
+    void cullPasses();
+    void sortPasses();
+    void allocateTransients();
+    void buildBarriers();
+
+    auto getLevelCount() const -> uint32_t {
+        return m_levelOffsets.empty() ? 0 : static_cast<uint32_t>(m_levelOffsets.size()) - 1;
+    }
+
+    static auto isWriteAccess(vk::AccessFlags2 access) -> bool;
+
+    const Context* m_context = nullptr;
+
+    std::vector<Pass> m_passes;
+    std::vector<Resource> m_resources;
+    std::unordered_map<const void*, uint32_t> m_resourceIndices;
+
+    // Results of compile()
+    std::vector<uint32_t> m_order;
+
+    // Passes of level L are m_order[m_levelOffsets[L], m_levelOffsets[L + 1])
+    std::vector<uint32_t> m_levelOffsets;
+
+    // Barrier batches per level
+    std::vector<std::vector<vk::ImageMemoryBarrier2>> m_imageBarriers;
+    std::vector<std::vector<uint32_t>> m_imageBarrierResources;
+    std::vector<std::vector<vk::BufferMemoryBarrier2>> m_bufferBarriers;
+    bool m_compiled = false;
+
+    // Kept across reset()
+    std::vector<TransientSlot> m_transientSlots;
+    std::vector<TransientImageCache> m_transientImages;
+
+    RenderGraphStats m_stats;
+};
+}  // namespace rv
@@ -8,6 +8,14 @@ struct ShaderCreateInfo {
     vk::ShaderStageFlagBits stage;
 };
 
+// Descriptor binding reflected from SPIR-V.
+// `binding.stageFlags` is the stage of the shader.
+struct ShaderBinding {
+    std::string name;
+    uint32_t set = 0;
+    vk::DescriptorSetLayoutBinding binding;
+};
+
 class Shader {
 public:
     Shader(const Context& context, const ShaderCreateInfo& createInfo);
@@ -17,11 +25,21 @@ public:
     auto getModule() const { return *m_shaderModule; }
     auto getStage() const { return m_stage; }
 
+    // hashBytes of the SPIR-V. Identifies the shader by content.
+    auto getCodeHash() const -> uint64_t { return m_codeHash; }
+
+    // NOTE: Reflected once when the shader is created
+    auto getBindings() const -> const std::vector<ShaderBinding>& { return m_bindings; }
+
 private:
+    void reflectBindings();
+
     vk::UniqueShaderModule m_shaderModule;
     vk::UniqueShaderEXT m_shader;
     const void* m_pCode;
     const size_t m_codeSize;
+    uint64_t m_codeHash = 0;
     vk::ShaderStageFlagBits m_stage;
+    std::vector<ShaderBinding> m_bindings;
 };
 }  // namespace rv
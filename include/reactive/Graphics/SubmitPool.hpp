@@ -0,0 +1,56 @@
+#pragma once
+#include <mutex>
+
+#include "Context.hpp"
+
+namespace rv {
+struct SubmitState;
+
+// Completion handle returned by Context::oneTimeSubmitAsync
+class SubmitFuture {
+    friend class SubmitPool;
+
+public:
+    SubmitFuture() = default;
+
+    auto valid() const -> bool { return m_state != nullptr; }
+    auto finished() const -> bool;
+    void wait() const;
+
+private:
+    std::shared_ptr<SubmitState> m_state;
+};
+
+// Recycles fences and command buffers of one-time submissions.
+// Finished submissions are collected lazily on the next acquire or submit.
+class SubmitPool {
+public:
+    SubmitPool(const Context& context);
+    ~SubmitPool();
+
+    // Returned command buffer belongs to the command pool of the calling thread
+    auto acquireCommandBuffer(vk::QueueFlags flag) -> CommandBufferHandle;
+
+    auto submit(CommandBufferHandle commandBuffer) -> SubmitFuture;
+
+    void collect();
+
+private:
+    struct InflightSubmit {
+        std::shared_ptr<SubmitState> state;
+        CommandBufferHandle commandBuffer;
+        std::thread::id tid;
+    };
+
+    using CommandBufferKey = std::pair<vk::QueueFlags, std::thread::id>;
+
+    void collectLocked();
+
+    const Context* m_context = nullptr;
+
+    std::mutex m_mutex;
+    std::vector<FenceHandle> m_freeFences;
+    std::map<CommandBufferKey, std::vector<CommandBufferHandle>> m_freeCommandBuffers;
+    std::vector<InflightSubmit> m_inflightSubmits;
+};
+}  // namespace rv
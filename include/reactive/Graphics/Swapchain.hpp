@@ -34,7 +34,11 @@ public:
         return *m_renderCompleteSemaphores[m_inflightIndex];
     }
 
-    FenceHandle getCurrentFence() const { return m_fences[m_inflightIndex]; }
+    // Timeline point of the submission that renders the current frame.
+    // waitNextFrame() waits for it before the frame slot is reused.
+    void setCurrentFrameSubmit(const SemaphoreSubmit& frameSubmit) {
+        m_frameSubmits[m_inflightIndex] = frameSubmit;
+    }
 
     uint32_t getMinImageCount() const { return m_minImageCount; }
 
@@ -65,6 +69,6 @@ private:
     std::vector<vk::UniqueSemaphore> m_imageAcquiredSemaphores;
     std::vector<vk::UniqueSemaphore> m_renderCompleteSemaphores;
     std::vector<CommandBufferHandle> m_commandBuffers{};
-    std::vector<FenceHandle> m_fences{};
+    std::vector<SemaphoreSubmit> m_frameSubmits{};
 };
 }  // namespace rv
@@ -0,0 +1,45 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rv {
+// Fixed set of worker threads running tasks in FIFO order.
+// Exceptions thrown by a task are stored in its future.
+class ThreadPool {
+public:
+    // 0 uses hardware_concurrency - 1
+    ThreadPool(uint32_t threadCount = 0);
+
+    // Finishes the queued tasks and joins the workers
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    auto operator=(const ThreadPool&) -> ThreadPool& = delete;
+
+    template <typename F>
+    auto submit(F&& func) -> std::future<std::invoke_result_t<F>> {
+        using R = std::invoke_result_t<F>;
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(func));
+        std::future<R> future = task->get_future();
+        push([task]() { (*task)(); });
+        return future;
+    }
+
+    auto getThreadCount() const -> uint32_t { return static_cast<uint32_t>(m_threads.size()); }
+
+private:
+    void push(std::function<void()> task);
+    void workerLoop();
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<std::function<void()>> m_tasks;
+    std::vector<std::thread> m_threads;
+    bool m_stopping = false;
+};
+}  // namespace rv
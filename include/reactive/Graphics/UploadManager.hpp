@@ -0,0 +1,98 @@
+#pragma once
+#include <mutex>
+
+#include "Context.hpp"
+
+namespace rv {
+// Timeline value signaled when an upload batch is visible to the general queue
+struct UploadTicket {
+    uint64_t value = 0;
+};
+
+// Batches staging copies onto the transfer queue.
+// If the transfer queue belongs to another queue family, ownership is
+// released on the transfer queue and acquired on the general queue.
+// Uploads are meant to initialize resources: the previous contents of the
+// destination are discarded and it must not be in use by the GPU.
+class UploadManager {
+public:
+    static constexpr vk::DeviceSize FlushThreshold = 64ull * 1024 * 1024;
+
+    UploadManager(const Context& context);
+    ~UploadManager();
+
+    auto uploadBuffer(BufferHandle dstBuffer,
+                      const void* data,
+                      vk::DeviceSize size,
+                      vk::DeviceSize dstOffset = 0) -> UploadTicket;
+
+    // Copy to mip 0 and layer 0. If the image has mipmaps,
+    // they are generated on the general queue.
+    auto uploadImage(ImageHandle dstImage,
+                     const void* data,
+                     vk::DeviceSize size,
+                     vk::ImageLayout newLayout = vk::ImageLayout::eShaderReadOnlyOptimal)
+        -> UploadTicket;
+
+    // Submit pending uploads
+    auto flush() -> UploadTicket;
+
+    auto isComplete(UploadTicket ticket) const -> bool;
+    void wait(UploadTicket ticket);
+
+    auto hasPendingUploads() const -> bool;
+
+    // Ticket of the latest flushed batch
+    auto getLastTicket() const -> UploadTicket;
+
+    auto getSemaphore() const -> vk::Semaphore { return *m_semaphore; }
+
+private:
+    struct BufferUpload {
+        BufferHandle dstBuffer;
+        BufferHandle stagingBuffer;
+        vk::DeviceSize dstOffset;
+        vk::DeviceSize size;
+    };
+
+    struct ImageUpload {
+        ImageHandle dstImage;
+        BufferHandle stagingBuffer;
+        vk::ImageLayout newLayout;
+    };
+
+    struct Batch {
+        uint64_t value = 0;
+        std::vector<BufferUpload> bufferUploads;
+        std::vector<ImageUpload> imageUploads;
+        std::vector<CommandBufferHandle> commandBuffers;
+    };
+
+    auto createStagingBuffer(const void* data, vk::DeviceSize size) const -> BufferHandle;
+
+    // NOTE: Functions with the Locked suffix expect m_mutex to be held
+    auto addPendingLocked(vk::DeviceSize size) -> UploadTicket;
+    auto flushLocked() -> UploadTicket;
+    void collectLocked();
+    auto getCompletedValueLocked() const -> uint64_t;
+
+    void submit(vk::QueueFlags flag,
+                const CommandBufferHandle& commandBuffer,
+                uint64_t waitValue,
+                uint64_t signalValue) const;
+
+    const Context* m_context = nullptr;
+
+    mutable std::mutex m_mutex;
+
+    vk::UniqueSemaphore m_semaphore;
+    uint64_t m_submittedValue = 0;
+    mutable uint64_t m_completedValue = 0;
+
+    Batch m_pendingBatch;
+    vk::DeviceSize m_pendingSize = 0;
+
+    // Flushed batches whose staging buffers are still in use
+    std::vector<Batch> m_inflightBatches;
+};
+}  // namespace rv
@@ -0,0 +1,60 @@
+#pragma once
+#include <mutex>
+
+#include "Context.hpp"
+
+namespace rv {
+struct UploadRingAllocation {
+    vk::Buffer buffer;
+    vk::DeviceSize offset = 0;
+    void* mapped = nullptr;
+};
+
+// Host visible staging memory shared by per-frame uploads.
+// The ring is split into one linear segment per in-flight frame.
+// A segment, its overflow buffers and the resources retired during that frame are
+// reclaimed by beginFrame() once the frame has completed on the GPU.
+// NOTE: Nothing is reclaimed without beginFrame(). Swapchain drives it through
+// Context::beginFrame(). Headless apps call Context::collectGarbage() after their
+// submissions have completed (e.g. after waitIdle()).
+class UploadRing {
+public:
+    static constexpr vk::DeviceSize DefaultFrameSize = 16ull * 1024 * 1024;
+
+    UploadRing(const Context& context, vk::DeviceSize frameSize = DefaultFrameSize);
+    ~UploadRing();
+
+    // NOTE: Must not be called while the GPU still reads the ring
+    void setFrameCount(uint32_t frameCount);
+
+    // Called after the previous submission of `frameIndex` was waited
+    void beginFrame(uint32_t frameIndex);
+
+    auto allocate(vk::DeviceSize size, vk::DeviceSize alignment = 16) -> UploadRingAllocation;
+
+    // Keep a resource alive until the current frame slot is reused
+    void retire(std::shared_ptr<void> resource);
+
+    auto getFrameCount() const -> uint32_t { return static_cast<uint32_t>(m_frames.size()); }
+    auto getFrameIndex() const -> uint32_t { return m_frameIndex; }
+    auto getFrameSize() const -> vk::DeviceSize { return m_frameSize; }
+
+private:
+    struct Frame {
+        vk::DeviceSize head = 0;
+
+        // Staging buffers for uploads that didn't fit in the segment
+        // and resources retired during this frame
+        std::vector<std::shared_ptr<void>> retired;
+    };
+
+    const Context* m_context = nullptr;
+
+    std::mutex m_mutex;
+
+    vk::DeviceSize m_frameSize = 0;
+    BufferHandle m_buffer;
+    std::vector<Frame> m_frames;
+    uint32_t m_frameIndex = 0;
+};
+}  // namespace rv
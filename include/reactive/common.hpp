@@ -1,4 +1,6 @@
 #pragma once
+#include <functional>
+
 #include <spdlog/spdlog.h>
 
 namespace rv {
@@ -13,4 +15,20 @@ namespace rv {
         std::terminate();                                                                    \
     }
 #endif
+
+// FNV-1a. Pass the previous result as `hash` to continue over several ranges.
+inline auto hashBytes(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325ull)
+    -> uint64_t {
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Mix `value` into `seed` (boost::hash_combine). For hash functors of cache keys.
+inline void hashCombine(size_t& seed, uint64_t value) {
+    seed ^= std::hash<uint64_t>()(value) + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+}
 }  // namespace rv
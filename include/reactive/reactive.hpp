@@ -8,8 +8,21 @@
 #include "App.hpp"
 
 #include "Compiler/Compiler.hpp"
+#include "Graphics/BindlessHeap.hpp"
+#include "Graphics/Defragmenter.hpp"
+#include "Graphics/DescriptorAllocator.hpp"
+#include "Graphics/DescriptorBuffer.hpp"
+#include "Graphics/DescriptorSetLayoutCache.hpp"
 #include "Graphics/Fence.hpp"
+#include "Graphics/GpuVector.hpp"
+#include "Graphics/MemoryAllocator.hpp"
+#include "Graphics/PipelineCache.hpp"
+#include "Graphics/PipelineRegistry.hpp"
+#include "Graphics/RenderGraph.hpp"
 #include "Graphics/Shader.hpp"
+#include "Graphics/SubmitPool.hpp"
+#include "Graphics/ThreadPool.hpp"
+#include "Graphics/UploadManager.hpp"
 #include "Scene/AABB.hpp"
 #include "Scene/Camera.hpp"
 #include "Timer/CPUTimer.hpp"
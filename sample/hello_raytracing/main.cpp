@@ -17,6 +17,7 @@ public:
               .windowResizable = false,
               .layers = {Layer::Validation},
               .extensions = {Extension::RayTracing},
+              .pipelineCacheFile = "hello_raytracing.pipelinecache",
           }) {}
 
     void onStart() override {
@@ -5,6 +5,7 @@
 #include <stb_image.h>
 #include <stb_image_write.h>
 
+#include "reactive/Graphics/PipelineCache.hpp"
 #include "reactive/Window.hpp"
 
 #include <imgui.h>
@@ -19,11 +20,20 @@ App::App(const AppCreateInfo& createInfo) {
     Window::init(createInfo.width, createInfo.height, createInfo.title, createInfo.windowResizable);
     Window::setAppPointer(this);
     initVulkan(createInfo.layers, createInfo.extensions, createInfo.vsync);
+
+    // NOTE: Loaded before ImGui creates its pipeline
+    if (createInfo.pipelineCacheFile) {
+        m_pipelineCacheFile = createInfo.pipelineCacheFile;
+        m_context.getPipelineCache().load(m_pipelineCacheFile);
+    }
+
     initImGui(createInfo.style, createInfo.imguiIniFile);
 }
 
 void App::run() {
     onStart();
+    spdlog::info("Startup: {:.2f} ms ({} pipeline cache)", m_startupTimer.elapsedInMilli(),
+                 m_context.getPipelineCache().isWarm() ? "warm" : "cold");
     CPUTimer timer;
 
     while (!Window::shouldClose() && m_running) {
@@ -77,16 +87,22 @@ void App::run() {
         commandBuffer->end();
 
         // Submit
-        vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-        m_context.submit(commandBuffer, waitStage, m_swapchain->getCurrentImageAcquiredSemaphore(),
-                       m_swapchain->getCurrentRenderCompleteSemaphore(),
-                       m_swapchain->getCurrentFence());
+        SemaphoreSubmit frameSubmit = m_context.submit(
+            commandBuffer,
+            SemaphoreSubmit{m_swapchain->getCurrentImageAcquiredSemaphore(), 0,
+                            vk::PipelineStageFlagBits2::eColorAttachmentOutput},
+            SemaphoreSubmit{m_swapchain->getCurrentRenderCompleteSemaphore()});
+        m_swapchain->setCurrentFrameSubmit(frameSubmit);
 
         // Present image
         m_swapchain->presentImage();
     }
     m_context.getDevice().waitIdle();
 
+    if (!m_pipelineCacheFile.empty()) {
+        m_context.getPipelineCache().save(m_pipelineCacheFile);
+    }
+
     Window::shutdown();
 
     // Shutdown ImGui
@@ -151,6 +167,24 @@ void App::initVulkan(ArrayProxy<Layer> requiredLayers,
     if (requiredExtensions.contains(Extension::ExtendedDynamicState)) {
         deviceExtensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME);
     }
+    if (requiredExtensions.contains(Extension::PushDescriptor)) {
+        deviceExtensions.push_back(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
+    }
+
+    // Optional extensions
+    if (m_context.isDeviceExtensionSupported(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)) {
+        deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
+    bool enableDescriptorBuffer = false;
+    if (requiredExtensions.contains(Extension::DescriptorBuffer)) {
+        enableDescriptorBuffer =
+            m_context.isDeviceExtensionSupported(VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME);
+        if (enableDescriptorBuffer) {
+            deviceExtensions.push_back(VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME);
+        } else {
+            spdlog::warn("VK_EXT_descriptor_buffer is not supported. Using descriptor pools.");
+        }
+    }
 
     vk::PhysicalDeviceFeatures deviceFeatures;
     deviceFeatures.setShaderInt64(true);
@@ -160,8 +194,33 @@ void App::initVulkan(ArrayProxy<Layer> requiredLayers,
     deviceFeatures.setFillModeNonSolid(true);
     deviceFeatures.setWideLines(true);
 
+    // For BindlessHeap
+    // NOTE: Optional. Only supported features are enabled, and Context creates
+    // BindlessHeap only if all of them are.
+    auto supportedFeatures = m_context.getPhysicalDevice()
+                                 .getFeatures2<vk::PhysicalDeviceFeatures2,
+                                               vk::PhysicalDeviceDescriptorIndexingFeatures>();
+    const auto& supportedDescFeatures =
+        supportedFeatures.get<vk::PhysicalDeviceDescriptorIndexingFeatures>();
+
     vk::PhysicalDeviceDescriptorIndexingFeatures descFeatures;
     descFeatures.setRuntimeDescriptorArray(true);
+    descFeatures.setDescriptorBindingPartiallyBound(
+        supportedDescFeatures.descriptorBindingPartiallyBound);
+    descFeatures.setDescriptorBindingSampledImageUpdateAfterBind(
+        supportedDescFeatures.descriptorBindingSampledImageUpdateAfterBind);
+    descFeatures.setDescriptorBindingStorageImageUpdateAfterBind(
+        supportedDescFeatures.descriptorBindingStorageImageUpdateAfterBind);
+    descFeatures.setDescriptorBindingStorageBufferUpdateAfterBind(
+        supportedDescFeatures.descriptorBindingStorageBufferUpdateAfterBind);
+    descFeatures.setDescriptorBindingUpdateUnusedWhilePending(
+        supportedDescFeatures.descriptorBindingUpdateUnusedWhilePending);
+    descFeatures.setShaderSampledImageArrayNonUniformIndexing(
+        supportedDescFeatures.shaderSampledImageArrayNonUniformIndexing);
+    descFeatures.setShaderStorageImageArrayNonUniformIndexing(
+        supportedDescFeatures.shaderStorageImageArrayNonUniformIndexing);
+    descFeatures.setShaderStorageBufferArrayNonUniformIndexing(
+        supportedDescFeatures.shaderStorageBufferArrayNonUniformIndexing);
 
     vk::PhysicalDevice8BitStorageFeatures storage8BitFeatures;
     storage8BitFeatures.setStorageBuffer8BitAccess(true);
@@ -179,6 +238,8 @@ void App::initVulkan(ArrayProxy<Layer> requiredLayers,
 
     vk::PhysicalDeviceHostQueryResetFeatures hostQueryResetFeatures{true};
 
+    vk::PhysicalDeviceTimelineSemaphoreFeatures timelineSemaphoreFeatures{true};
+
     StructureChain featuresChain;
     featuresChain.add(descFeatures);
     featuresChain.add(storage8BitFeatures);
@@ -188,6 +249,7 @@ void App::initVulkan(ArrayProxy<Layer> requiredLayers,
     featuresChain.add(synchronization2Features);
     featuresChain.add(dynamicRenderingFeatures);
     featuresChain.add(hostQueryResetFeatures);
+    featuresChain.add(timelineSemaphoreFeatures);
 
     vk::PhysicalDeviceRayTracingPipelineFeaturesKHR rayTracingPipelineFeatures{true};
     vk::PhysicalDeviceAccelerationStructureFeaturesKHR accelerationStructureFeatures{true};
@@ -219,6 +281,12 @@ void App::initVulkan(ArrayProxy<Layer> requiredLayers,
         featuresChain.add(extendedDynamicState3Features);
     }
 
+    vk::PhysicalDeviceDescriptorBufferFeaturesEXT descriptorBufferFeatures;
+    descriptorBufferFeatures.setDescriptorBuffer(true);
+    if (enableDescriptorBuffer) {
+        featuresChain.add(descriptorBufferFeatures);
+    }
+
     m_context.initDevice(deviceExtensions, deviceFeatures, featuresChain.pFirst,
                        requiredExtensions.contains(Extension::RayTracing));
 
@@ -332,7 +400,7 @@ void App::initImGui(UIStyle style, const char* imguiIniFile) {
     initInfo.Device = m_context.getDevice();
     initInfo.QueueFamily = m_context.getQueueFamily();
     initInfo.Queue = m_context.getQueue();
-    initInfo.PipelineCache = nullptr;
+    initInfo.PipelineCache = m_context.getPipelineCache().getCache();
     initInfo.DescriptorPool = m_context.getDescriptorPool();
     initInfo.Subpass = 0;
     initInfo.MinImageCount = m_swapchain->getMinImageCount();
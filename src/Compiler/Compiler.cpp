@@ -1,6 +1,15 @@
 ﻿#include "reactive/Compiler/Compiler.hpp"
+#include <atomic>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+
+#include "reactive/Graphics/ThreadPool.hpp"
+#include "reactive/Timer/CPUTimer.hpp"
+#include "reactive/common.hpp"
 
 #define ASSERT_ON_SLANG_FAIL(x)        \
     {                                  \
@@ -25,7 +34,152 @@ static void diagnoseIfNeeded(slang::IBlob* diagnosticsBlob) {
     }
 }
 
-SlangCompiler::SlangCompiler() {
+namespace {
+constexpr uint32_t CacheMagic = 0x43535652;  // "RVSC"
+constexpr uint32_t CacheVersion = 1;
+
+constexpr const char* TargetProfile = "spirv_1_5";
+
+// Session settings that change the output. Update together with createSession.
+constexpr const char* CompilerOptionsKey =
+    "EmitSpirvDirectly;spvImageQuery;spvSparseResidency;ColumnMajor";
+
+// Blob owning a copy of bytes. Returned for cache hits and for results handed
+// to other threads, since blobs of Slang are tied to their session.
+class ByteBlob : public ISlangBlob {
+public:
+    ByteBlob(std::vector<uint8_t> data) : m_data{std::move(data)} {}
+
+    SLANG_NO_THROW SlangResult SLANG_MCALL queryInterface(SlangUUID const& uuid,
+                                                          void** outObject) override {
+        if (isSameUUID(uuid, ISlangBlob::getTypeGuid()) ||
+            isSameUUID(uuid, ISlangUnknown::getTypeGuid())) {
+            addRef();
+            *outObject = static_cast<ISlangBlob*>(this);
+            return SLANG_OK;
+        }
+        *outObject = nullptr;
+        return SLANG_E_NO_INTERFACE;
+    }
+
+    SLANG_NO_THROW uint32_t SLANG_MCALL addRef() override { return ++m_refCount; }
+
+    SLANG_NO_THROW uint32_t SLANG_MCALL release() override {
+        uint32_t refCount = --m_refCount;
+        if (refCount == 0) {
+            delete this;
+        }
+        return refCount;
+    }
+
+    SLANG_NO_THROW void const* SLANG_MCALL getBufferPointer() override { return m_data.data(); }
+
+    SLANG_NO_THROW size_t SLANG_MCALL getBufferSize() override { return m_data.size(); }
+
+private:
+    static auto isSameUUID(const SlangUUID& a, const SlangUUID& b) -> bool {
+        return std::memcmp(&a, &b, sizeof(SlangUUID)) == 0;
+    }
+
+    std::atomic<uint32_t> m_refCount = 0;
+    std::vector<uint8_t> m_data;
+};
+
+auto readBytes(const std::filesystem::path& path) -> std::optional<std::vector<uint8_t>> {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return std::nullopt;
+    }
+    return std::vector<uint8_t>{std::istreambuf_iterator<char>{file},
+                                std::istreambuf_iterator<char>{}};
+}
+
+auto hashFile(const std::filesystem::path& path) -> std::optional<uint64_t> {
+    std::optional<std::vector<uint8_t>> data = readBytes(path);
+    if (!data) {
+        return std::nullopt;
+    }
+    return hashBytes(data->data(), data->size());
+}
+
+// Key of SlangCompiler::m_fileHashes. Slang may name the same file differently.
+auto normalizePath(const std::filesystem::path& path) -> std::string {
+    std::error_code error;
+    std::filesystem::path normalized = std::filesystem::weakly_canonical(path, error);
+    return error ? path.lexically_normal().string() : normalized.string();
+}
+
+// File system of the Slang session.
+// Records the hash of every file Slang reads, so cache entries store the hashes of
+// the bytes that were compiled rather than of the files at the time of saving.
+class HashingFileSystem : public ISlangFileSystem {
+public:
+    HashingFileSystem(std::unordered_map<std::string, uint64_t>& fileHashes)
+        : m_fileHashes{&fileHashes} {}
+
+    SLANG_NO_THROW SlangResult SLANG_MCALL queryInterface(SlangUUID const& uuid,
+                                                          void** outObject) override {
+        *outObject = castAs(uuid);
+        if (!*outObject) {
+            return SLANG_E_NO_INTERFACE;
+        }
+        addRef();
+        return SLANG_OK;
+    }
+
+    SLANG_NO_THROW uint32_t SLANG_MCALL addRef() override { return ++m_refCount; }
+
+    SLANG_NO_THROW uint32_t SLANG_MCALL release() override {
+        uint32_t refCount = --m_refCount;
+        if (refCount == 0) {
+            delete this;
+        }
+        return refCount;
+    }
+
+    SLANG_NO_THROW void* SLANG_MCALL castAs(const SlangUUID& guid) override {
+        if (isSameUUID(guid, ISlangFileSystem::getTypeGuid()) ||
+            isSameUUID(guid, ISlangCastable::getTypeGuid()) ||
+            isSameUUID(guid, ISlangUnknown::getTypeGuid())) {
+            return static_cast<ISlangFileSystem*>(this);
+        }
+        return nullptr;
+    }
+
+    SLANG_NO_THROW SlangResult SLANG_MCALL loadFile(char const* path,
+                                                    ISlangBlob** outBlob) override {
+        std::optional<std::vector<uint8_t>> data = readBytes(path);
+        if (!data) {
+            return SLANG_E_NOT_FOUND;
+        }
+        (*m_fileHashes)[normalizePath(path)] = hashBytes(data->data(), data->size());
+        *outBlob = new ByteBlob(std::move(*data));
+        (*outBlob)->addRef();
+        return SLANG_OK;
+    }
+
+private:
+    static auto isSameUUID(const SlangUUID& a, const SlangUUID& b) -> bool {
+        return std::memcmp(&a, &b, sizeof(SlangUUID)) == 0;
+    }
+
+    std::atomic<uint32_t> m_refCount = 0;
+    std::unordered_map<std::string, uint64_t>* m_fileHashes;
+};
+
+template <typename T>
+void writeValue(std::ofstream& file, const T& value) {
+    file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+auto readValue(std::ifstream& file, T& value) -> bool {
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+}  // namespace
+
+SlangCompiler::SlangCompiler(std::filesystem::path cacheDirectory)
+    : m_cacheDirectory{std::move(cacheDirectory)} {
     ASSERT_ON_SLANG_FAIL(slang::createGlobalSession(m_globalSession.writeRef()));
 }
 
@@ -33,46 +187,42 @@ std::vector<Slang::ComPtr<slang::IBlob>> SlangCompiler::compileShaders(const std
                                                                        const std::vector<std::string>& entryPointNames) {
     assert(m_globalSession);
 
+    CPUTimer timer;
+    std::string source;
+    std::filesystem::path cachePath;
+    // NOTE: Read in binary so that the hash matches the one HashingFileSystem records
+    std::optional<std::vector<uint8_t>> sourceBytes;
+    if (!m_cacheDirectory.empty() && (sourceBytes = readBytes(shaderPath))) {
+        source.assign(sourceBytes->begin(), sourceBytes->end());
+        cachePath = getCachePath(shaderPath, source, entryPointNames);
+        Blobs codes = loadCache(cachePath, entryPointNames.size());
+        if (!codes.empty()) {
+            spdlog::info("Loaded from cache: {} ({:.2f} ms)", shaderPath.string(),
+                         timer.elapsedInMilli());
+            return codes;
+        }
+    }
+
     spdlog::info("Compiling: {}", shaderPath.string());
 
     // 1. Slangセッションの準備
     // ----------------------------------------------------
-    slang::TargetDesc targetDesc = {};
-    targetDesc.format = SLANG_SPIRV;
-    targetDesc.profile = m_globalSession->findProfile("spirv_1_5");
-    targetDesc.flags = 0;
-
-    SlangCapabilityID spvImageQueryId = m_globalSession->findCapability("spvImageQuery");
-    SlangCapabilityID spvSparseResidencyId =
-        m_globalSession->findCapability("spvSparseResidency");
-
-    std::vector<slang::CompilerOptionEntry> options;
-    options.push_back(
-        {slang::CompilerOptionName::EmitSpirvDirectly,
-         {slang::CompilerOptionValueKind::Int, 1, 0, nullptr, nullptr}});
-    options.push_back(
-        {slang::CompilerOptionName::Capability,
-         {slang::CompilerOptionValueKind::String, spvImageQueryId, 0, nullptr, nullptr}});
-    options.push_back(
-        {slang::CompilerOptionName::Capability,
-         {slang::CompilerOptionValueKind::String, spvSparseResidencyId, 0, nullptr, nullptr}});
-
-    slang::SessionDesc sessionDesc = {};
-    sessionDesc.targets = &targetDesc;
-    sessionDesc.targetCount = 1;
-    sessionDesc.compilerOptionEntries = options.data();
-    sessionDesc.compilerOptionEntryCount = (uint32_t)options.size();
-    sessionDesc.defaultMatrixLayoutMode = SLANG_MATRIX_LAYOUT_COLUMN_MAJOR;
-
-    Slang::ComPtr<slang::ISession> session;
-    ASSERT_ON_SLANG_FAIL(m_globalSession->createSession(sessionDesc, session.writeRef()));
+    // NOTE: Reused across calls, so modules imported by several shaders are loaded once.
+    // loadModule returns modules that are already loaded, so the session is recreated
+    // once any file it read has changed.
+    if (m_session && isSessionStale()) {
+        m_session = nullptr;
+    }
+    if (!m_session) {
+        createSession();
+    }
 
     // 2. モジュールをロード (Slangソースをコンパイル)
     // ----------------------------------------------------
     Slang::ComPtr<slang::IBlob> diagnosticBlob;
     slang::IModule* slangModule = nullptr;
     {
-        slangModule = session->loadModule(shaderPath.string().c_str(), diagnosticBlob.writeRef());
+        slangModule = m_session->loadModule(shaderPath.string().c_str(), diagnosticBlob.writeRef());
         diagnoseIfNeeded(diagnosticBlob);
         if (!slangModule) {
             // 失敗した場合は空の結果を返して終了
@@ -104,7 +254,7 @@ std::vector<Slang::ComPtr<slang::IBlob>> SlangCompiler::compileShaders(const std
     // ----------------------------------------------------
     Slang::ComPtr<slang::IComponentType> linkedProgram;
     {
-        SlangResult result = session->createCompositeComponentType(
+        SlangResult result = m_session->createCompositeComponentType(
             componentTypes.data(), componentTypes.size(), linkedProgram.writeRef(),
             diagnosticBlob.writeRef());
         diagnoseIfNeeded(diagnosticBlob);
@@ -124,8 +274,242 @@ std::vector<Slang::ComPtr<slang::IBlob>> SlangCompiler::compileShaders(const std
         ASSERT_ON_SLANG_FAIL(result);
     }
 
-    spdlog::info("  Done!");
+    if (!cachePath.empty()) {
+        // NOTE: The file may have been edited after it was read for the cache key
+        auto it = m_fileHashes.find(normalizePath(slangModule->getFilePath()));
+        if (it != m_fileHashes.end() && it->second == hashBytes(source.data(), source.size())) {
+            saveCache(cachePath, slangModule, codes);
+        } else {
+            spdlog::info("SlangCompiler: {} changed while compiling. Not cached.",
+                         shaderPath.string());
+        }
+    }
+
+    spdlog::info("  Done! ({:.2f} ms)", timer.elapsedInMilli());
     return codes;
 }
 
+void SlangCompiler::createSession() {
+    m_fileHashes.clear();
+    m_fileSystem = new HashingFileSystem(m_fileHashes);
+
+    slang::TargetDesc targetDesc = {};
+    targetDesc.format = SLANG_SPIRV;
+    targetDesc.profile = m_globalSession->findProfile(TargetProfile);
+    targetDesc.flags = 0;
+
+    SlangCapabilityID spvImageQueryId = m_globalSession->findCapability("spvImageQuery");
+    SlangCapabilityID spvSparseResidencyId =
+        m_globalSession->findCapability("spvSparseResidency");
+
+    std::vector<slang::CompilerOptionEntry> options;
+    options.push_back(
+        {slang::CompilerOptionName::EmitSpirvDirectly,
+         {slang::CompilerOptionValueKind::Int, 1, 0, nullptr, nullptr}});
+    options.push_back(
+        {slang::CompilerOptionName::Capability,
+         {slang::CompilerOptionValueKind::String, spvImageQueryId, 0, nullptr, nullptr}});
+    options.push_back(
+        {slang::CompilerOptionName::Capability,
+         {slang::CompilerOptionValueKind::String, spvSparseResidencyId, 0, nullptr, nullptr}});
+
+    slang::SessionDesc sessionDesc = {};
+    sessionDesc.targets = &targetDesc;
+    sessionDesc.targetCount = 1;
+    sessionDesc.compilerOptionEntries = options.data();
+    sessionDesc.compilerOptionEntryCount = (uint32_t)options.size();
+    sessionDesc.defaultMatrixLayoutMode = SLANG_MATRIX_LAYOUT_COLUMN_MAJOR;
+    sessionDesc.fileSystem = m_fileSystem;
+
+    ASSERT_ON_SLANG_FAIL(m_globalSession->createSession(sessionDesc, m_session.writeRef()));
+}
+
+auto SlangCompiler::isSessionStale() const -> bool {
+    for (const auto& [path, hash] : m_fileHashes) {
+        if (hashFile(path) != hash) {
+            spdlog::info("SlangCompiler: {} changed. Reloading modules.", path);
+            return true;
+        }
+    }
+    return false;
+}
+
+auto SlangCompiler::getCachePath(const std::filesystem::path& shaderPath,
+                                 const std::string& source,
+                                 const std::vector<std::string>& entryPointNames) const
+    -> std::filesystem::path {
+    // NOTE: The Slang version is part of the key, so upgrading Slang invalidates the cache.
+    std::string_view buildTag = m_globalSession->getBuildTagString();
+
+    // NOTE: Imports are resolved relative to the shader, so identical sources in
+    // different directories may compile differently
+    std::string path = normalizePath(shaderPath);
+    uint64_t hash = hashBytes(path.data(), path.size() + 1);
+    hash = hashBytes(source.data(), source.size(), hash);
+    for (const auto& name : entryPointNames) {
+        hash = hashBytes(name.data(), name.size() + 1, hash);
+    }
+    hash = hashBytes(TargetProfile, std::strlen(TargetProfile), hash);
+    hash = hashBytes(CompilerOptionsKey, std::strlen(CompilerOptionsKey), hash);
+    hash = hashBytes(buildTag.data(), buildTag.size(), hash);
+    return m_cacheDirectory / fmt::format("{:016x}.spvcache", hash);
+}
+
+auto SlangCompiler::loadCache(const std::filesystem::path& cachePath, size_t entryPointCount) const
+    -> Blobs {
+    std::ifstream file(cachePath, std::ios::binary);
+    if (!file) {
+        return {};
+    }
+
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    uint32_t dependencyCount = 0;
+    uint32_t codeCount = 0;
+    if (!readValue(file, magic) || !readValue(file, version) || !readValue(file, dependencyCount) ||
+        !readValue(file, codeCount) || magic != CacheMagic || version != CacheVersion ||
+        codeCount != entryPointCount) {
+        return {};
+    }
+
+    // Stale if any imported file changed since the entry was written
+    for (uint32_t i = 0; i < dependencyCount; i++) {
+        uint32_t pathSize = 0;
+        uint64_t hash = 0;
+        if (!readValue(file, pathSize)) {
+            return {};
+        }
+        std::string path(pathSize, '\0');
+        if (!file.read(path.data(), pathSize) || !readValue(file, hash)) {
+            return {};
+        }
+        if (hashFile(path) != hash) {
+            return {};
+        }
+    }
+
+    Blobs codes(codeCount);
+    for (auto& code : codes) {
+        uint64_t size = 0;
+        if (!readValue(file, size)) {
+            return {};
+        }
+        std::vector<uint8_t> data(size);
+        if (!file.read(reinterpret_cast<char*>(data.data()), size)) {
+            return {};
+        }
+        code = new ByteBlob(std::move(data));
+    }
+    return codes;
+}
+
+void SlangCompiler::saveCache(const std::filesystem::path& cachePath,
+                              slang::IModule* slangModule,
+                              const Blobs& codes) const {
+    std::error_code error;
+    std::filesystem::create_directories(m_cacheDirectory, error);
+
+    // Written to a temporary file and renamed, so a crash never leaves a partial entry
+    // NOTE: Per thread, since SlangCompilerPool may write the same entry concurrently
+    std::filesystem::path tempPath = cachePath;
+    tempPath += fmt::format(".{}.tmp", std::hash<std::thread::id>()(std::this_thread::get_id()));
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        writeValue(file, CacheMagic);
+        writeValue(file, CacheVersion);
+
+        // NOTE: Includes the module's own file
+        uint32_t dependencyCount = static_cast<uint32_t>(slangModule->getDependencyFileCount());
+        writeValue(file, dependencyCount);
+        writeValue(file, static_cast<uint32_t>(codes.size()));
+        for (uint32_t i = 0; i < dependencyCount; i++) {
+            // Hash of the bytes Slang compiled, recorded by HashingFileSystem
+            std::string path = normalizePath(slangModule->getDependencyFilePath(i));
+            auto it = m_fileHashes.find(path);
+            if (it == m_fileHashes.end()) {
+                spdlog::warn("SlangCompiler: {} was not read by the session. Not cached.", path);
+                file.close();
+                std::filesystem::remove(tempPath, error);
+                return;
+            }
+            writeValue(file, static_cast<uint32_t>(path.size()));
+            file.write(path.data(), path.size());
+            writeValue(file, it->second);
+        }
+
+        for (const auto& code : codes) {
+            writeValue(file, static_cast<uint64_t>(code->getBufferSize()));
+            file.write(static_cast<const char*>(code->getBufferPointer()), code->getBufferSize());
+        }
+        if (!file) {
+            spdlog::warn("SlangCompiler: failed to write {}", tempPath.string());
+            return;
+        }
+    }
+
+    std::filesystem::rename(tempPath, cachePath, error);
+    if (error) {
+        spdlog::warn("SlangCompiler: failed to replace {}: {}", cachePath.string(),
+                     error.message());
+        std::filesystem::remove(tempPath, error);
+    }
+}
+
+SlangCompilerPool::SlangCompilerPool(uint32_t threadCount, std::filesystem::path cacheDirectory)
+    : m_cacheDirectory{std::move(cacheDirectory)},
+      m_threadPool{std::make_unique<ThreadPool>(threadCount)} {}
+
+SlangCompilerPool::~SlangCompilerPool() = default;
+
+auto SlangCompilerPool::compileShaders(const std::vector<ShaderCompileRequest>& requests)
+    -> std::vector<std::shared_future<std::vector<Slang::ComPtr<slang::IBlob>>>> {
+    std::vector<std::shared_future<std::vector<Slang::ComPtr<slang::IBlob>>>> futures;
+    futures.reserve(requests.size());
+    for (const auto& request : requests) {
+        auto future = m_threadPool->submit([this, request]() {
+            SlangCompiler* compiler = acquireCompiler();
+            std::vector<Slang::ComPtr<slang::IBlob>> codes;
+            try {
+                codes = compiler->compileShaders(request.shaderPath, request.entryPointNames);
+            } catch (...) {
+                releaseCompiler(compiler);
+                throw;
+            }
+            releaseCompiler(compiler);
+
+            // Detach the results from the session of the worker
+            for (auto& code : codes) {
+                const auto* bytes = static_cast<const uint8_t*>(code->getBufferPointer());
+                code = new ByteBlob(std::vector<uint8_t>(bytes, bytes + code->getBufferSize()));
+            }
+            return codes;
+        });
+        futures.push_back(future.share());
+    }
+    return futures;
+}
+
+auto SlangCompilerPool::acquireCompiler() -> SlangCompiler* {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_freeCompilers.empty()) {
+            SlangCompiler* compiler = m_freeCompilers.back();
+            m_freeCompilers.pop_back();
+            return compiler;
+        }
+    }
+
+    // NOTE: Created by the worker on first use, so global sessions are created in parallel.
+    // At most one compiler per worker exists.
+    auto compiler = std::make_unique<SlangCompiler>(m_cacheDirectory);
+    SlangCompiler* pointer = compiler.get();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_compilers.push_back(std::move(compiler));
+    return pointer;
+}
+
+void SlangCompilerPool::releaseCompiler(SlangCompiler* compiler) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_freeCompilers.push_back(compiler);
+}
 }  // namespace rv
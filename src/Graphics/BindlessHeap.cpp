@@ -0,0 +1,152 @@
+#include "reactive/Graphics/BindlessHeap.hpp"
+
+#include "reactive/Graphics/UploadRing.hpp"
+#include "reactive/common.hpp"
+
+namespace rv {
+namespace {
+// Indexed by BindlessType
+constexpr std::array<vk::DescriptorType, 4> DescriptorTypes = {
+    vk::DescriptorType::eSampledImage,
+    vk::DescriptorType::eStorageImage,
+    vk::DescriptorType::eStorageBuffer,
+    vk::DescriptorType::eSampler,
+};
+}  // namespace
+
+// Returns the index to the heap once the GPU no longer uses it
+struct BindlessHeap::RetiredIndex {
+    BindlessHeap* heap = nullptr;
+    BindlessType type;
+    uint32_t index;
+
+    ~RetiredIndex() { heap->release(type, index); }
+};
+
+BindlessHeap::BindlessHeap(const Context& context) : m_context{&context} {
+    auto props = m_context->getPhysicalDeviceProperties2<vk::PhysicalDeviceDescriptorIndexingProperties>();
+    m_capacities = {
+        std::min({MaxSampledImages, props.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                  props.maxDescriptorSetUpdateAfterBindSampledImages}),
+        std::min({MaxStorageImages, props.maxPerStageDescriptorUpdateAfterBindStorageImages,
+                  props.maxDescriptorSetUpdateAfterBindStorageImages}),
+        std::min({MaxStorageBuffers, props.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+                  props.maxDescriptorSetUpdateAfterBindStorageBuffers}),
+        std::min({MaxSamplers, props.maxPerStageDescriptorUpdateAfterBindSamplers,
+                  props.maxDescriptorSetUpdateAfterBindSamplers}),
+    };
+
+    std::vector<vk::DescriptorSetLayoutBinding> bindings(TypeCount);
+    std::vector<vk::DescriptorBindingFlags> bindingFlags(TypeCount);
+    std::vector<vk::DescriptorPoolSize> poolSizes(TypeCount);
+    for (uint32_t i = 0; i < TypeCount; i++) {
+        bindings[i].setBinding(i);
+        bindings[i].setDescriptorType(DescriptorTypes[i]);
+        bindings[i].setDescriptorCount(m_capacities[i]);
+        bindings[i].setStageFlags(vk::ShaderStageFlagBits::eAll);
+        bindingFlags[i] = vk::DescriptorBindingFlagBits::ePartiallyBound |
+                          vk::DescriptorBindingFlagBits::eUpdateAfterBind |
+                          vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending;
+        poolSizes[i] = {DescriptorTypes[i], m_capacities[i]};
+    }
+
+    vk::DescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{bindingFlags};
+    vk::DescriptorSetLayoutCreateInfo layoutInfo;
+    layoutInfo.setFlags(vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool);
+    layoutInfo.setBindings(bindings);
+    layoutInfo.setPNext(&bindingFlagsInfo);
+    m_layout = m_context->getDevice().createDescriptorSetLayoutUnique(layoutInfo);
+
+    vk::DescriptorPoolCreateInfo poolInfo;
+    poolInfo.setFlags(vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind);
+    poolInfo.setPoolSizes(poolSizes);
+    poolInfo.setMaxSets(1);
+    m_pool = m_context->getDevice().createDescriptorPoolUnique(poolInfo);
+
+    vk::DescriptorSetAllocateInfo allocInfo{*m_pool, *m_layout};
+    m_descSet = m_context->getDevice().allocateDescriptorSets(allocInfo).front();
+
+    spdlog::info("BindlessHeap: sampled images {}, storage images {}, storage buffers {}, samplers {}",
+                 m_capacities[0], m_capacities[1], m_capacities[2], m_capacities[3]);
+}
+
+auto BindlessHeap::isSupported(const void* deviceCreateInfoPNext) -> bool {
+    auto isEnabled = [](const auto& features) {
+        return features.runtimeDescriptorArray && features.descriptorBindingPartiallyBound &&
+               features.descriptorBindingSampledImageUpdateAfterBind &&
+               features.descriptorBindingStorageImageUpdateAfterBind &&
+               features.descriptorBindingStorageBufferUpdateAfterBind &&
+               features.descriptorBindingUpdateUnusedWhilePending &&
+               features.shaderSampledImageArrayNonUniformIndexing &&
+               features.shaderStorageImageArrayNonUniformIndexing &&
+               features.shaderStorageBufferArrayNonUniformIndexing;
+    };
+
+    auto* next = static_cast<const vk::BaseInStructure*>(deviceCreateInfoPNext);
+    for (; next; next = next->pNext) {
+        if (next->sType == vk::StructureType::ePhysicalDeviceDescriptorIndexingFeatures) {
+            return isEnabled(*reinterpret_cast<const vk::PhysicalDeviceDescriptorIndexingFeatures*>(next));
+        }
+        if (next->sType == vk::StructureType::ePhysicalDeviceVulkan12Features) {
+            return isEnabled(*reinterpret_cast<const vk::PhysicalDeviceVulkan12Features*>(next));
+        }
+    }
+    return false;
+}
+
+auto BindlessHeap::allocate(BindlessType type) -> uint32_t {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint32_t typeIndex = static_cast<uint32_t>(type);
+    auto& freeIndices = m_freeIndices[typeIndex];
+    if (!freeIndices.empty()) {
+        uint32_t index = freeIndices.back();
+        freeIndices.pop_back();
+        return index;
+    }
+    if (m_counts[typeIndex] >= m_capacities[typeIndex]) {
+        spdlog::warn("BindlessHeap is full: binding {}. The resource is not registered.",
+                     typeIndex);
+        return InvalidIndex;
+    }
+    return m_counts[typeIndex]++;
+}
+
+void BindlessHeap::free(BindlessType type, uint32_t index) {
+    if (index == InvalidIndex) {
+        return;
+    }
+    auto retired = std::make_shared<RetiredIndex>();
+    retired->heap = this;
+    retired->type = type;
+    retired->index = index;
+    m_context->getUploadRing().retire(retired);
+}
+
+void BindlessHeap::release(BindlessType type, uint32_t index) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_freeIndices[static_cast<uint32_t>(type)].push_back(index);
+}
+
+void BindlessHeap::writeImage(BindlessType type,
+                              uint32_t index,
+                              const vk::DescriptorImageInfo& info) {
+    RV_ASSERT(type != BindlessType::StorageBuffer, "Use writeBuffer() for storage buffers.");
+    vk::WriteDescriptorSet write;
+    write.setDstSet(m_descSet);
+    write.setDstBinding(static_cast<uint32_t>(type));
+    write.setDstArrayElement(index);
+    write.setDescriptorType(DescriptorTypes[static_cast<uint32_t>(type)]);
+    write.setImageInfo(info);
+    m_context->getDevice().updateDescriptorSets(write, nullptr);
+}
+
+void BindlessHeap::writeBuffer(uint32_t index, const vk::DescriptorBufferInfo& info) {
+    vk::WriteDescriptorSet write;
+    write.setDstSet(m_descSet);
+    write.setDstBinding(static_cast<uint32_t>(BindlessType::StorageBuffer));
+    write.setDstArrayElement(index);
+    write.setDescriptorType(vk::DescriptorType::eStorageBuffer);
+    write.setBufferInfo(info);
+    m_context->getDevice().updateDescriptorSets(write, nullptr);
+}
+}  // namespace rv
@@ -1,11 +1,16 @@
 #include "reactive/Graphics/Buffer.hpp"
 
+#include "reactive/Graphics/BindlessHeap.hpp"
 #include "reactive/Graphics/CommandBuffer.hpp"
 #include "reactive/common.hpp"
 
 namespace rv {
 Buffer::Buffer(const Context& context, const BufferCreateInfo& createInfo)
-    : m_context{&context}, m_size{createInfo.size} {
+    : m_context{&context},
+      m_size{createInfo.size},
+      m_usage{createInfo.usage},
+      m_bindless{createInfo.bindless},
+      m_debugName{createInfo.debugName} {
     // Create buffer
     vk::BufferCreateInfo bufferInfo;
     bufferInfo.setSize(m_size);
@@ -14,24 +19,35 @@ Buffer::Buffer(const Context& context, const BufferCreateInfo& createInfo)
 
     // Allocate memory
     vk::MemoryRequirements requirements = m_context->getDevice().getBufferMemoryRequirements(*m_buffer);
-    uint32_t memoryTypeIndex = m_context->findMemoryTypeIndex(requirements, createInfo.memory);
+    MemoryTypeRequest request = std::visit(
+        [](auto memory) { return Context::getMemoryTypeRequest(memory); }, createInfo.memory);
+    m_allocation = m_context->getMemoryAllocator().allocate(
+        requirements, request, true, MemoryAllocator::getCategory(createInfo.debugName, "Buffer"));
+    m_mapped = m_allocation.mapped;
 
-    vk::MemoryAllocateFlagsInfo flagsInfo{vk::MemoryAllocateFlagBits::eDeviceAddress};
-    vk::MemoryAllocateInfo memoryInfo;
-    memoryInfo.setAllocationSize(requirements.size);
-    memoryInfo.setMemoryTypeIndex(memoryTypeIndex);
-    memoryInfo.setPNext(&flagsInfo);
-    m_memory = m_context->getDevice().allocateMemoryUnique(memoryInfo);
-
-    m_isHostVisible = static_cast<bool>(createInfo.memory & vk::MemoryPropertyFlagBits::eHostVisible);
+    // NOTE: The selected type may be host visible even if it was not requested
+    m_isHostVisible = m_mapped != nullptr;
+    vk::MemoryPropertyFlags memoryProps =
+        m_context->getMemoryProperties().memoryTypes[m_allocation.memoryTypeIndex].propertyFlags;
+    m_isHostCoherent =
+        static_cast<bool>(memoryProps & vk::MemoryPropertyFlagBits::eHostCoherent);
 
     // Bind memory
-    m_context->getDevice().bindBufferMemory(*m_buffer, *m_memory, 0);
+    m_context->getDevice().bindBufferMemory(*m_buffer, m_allocation.memory, m_allocation.offset);
 
     if (!createInfo.debugName.empty()) {
         m_context->setDebugName(*m_buffer, createInfo.debugName.c_str());
-        m_context->setDebugName(*m_memory, createInfo.debugName.c_str());
     }
+
+    writeBindlessBuffer();
+}
+
+Buffer::~Buffer() {
+    if (m_context->hasBindlessHeap()) {
+        m_context->getBindlessHeap().free(BindlessType::StorageBuffer, m_storageBufferIndex);
+    }
+    m_buffer.reset();
+    m_context->getMemoryAllocator().free(m_allocation);
 }
 
 auto Buffer::getAddress() const -> vk::DeviceAddress {
@@ -41,32 +57,105 @@ auto Buffer::getAddress() const -> vk::DeviceAddress {
 
 auto Buffer::map() -> void* {
     RV_ASSERT(m_isHostVisible, "");
-    if (!m_mapped) {
-        m_mapped = m_context->getDevice().mapMemory(*m_memory, 0, VK_WHOLE_SIZE);
-    }
     return m_mapped;
 }
 
 void Buffer::unmap() {
     RV_ASSERT(m_isHostVisible, "This m_buffer is not host visible.");
-    m_context->getDevice().unmapMemory(*m_memory);
-    m_mapped = nullptr;
+    // NOTE: The memory block stays mapped until it is freed.
 }
 
 void Buffer::copy(const void* data) {
+    copy(data, 0, m_size);
+}
+
+void Buffer::copy(const void* data, vk::DeviceSize offset, vk::DeviceSize size) {
     RV_ASSERT(m_isHostVisible, "This m_buffer is not host visible.");
-    map();
-    std::memcpy(m_mapped, data, m_size);
+    RV_ASSERT(offset + size <= m_size, "Copy range exceeds the buffer: offset={}, size={}",
+              offset, size);
+    std::memcpy(static_cast<uint8_t*>(m_mapped) + offset, data, size);
+    markDirty(offset, size);
+}
+
+void Buffer::markDirty(vk::DeviceSize offset, vk::DeviceSize size) {
+    if (!m_isHostCoherent) {
+        m_dirtyRanges.push_back({offset, size});
+    }
+}
+
+void Buffer::flush() {
+    if (m_dirtyRanges.empty()) {
+        return;
+    }
+
+    std::vector<vk::MappedMemoryRange> memoryRanges;
+    for (const auto& range : mergeRanges(std::move(m_dirtyRanges))) {
+        memoryRanges.push_back(getMappedMemoryRange(range.offset, range.size));
+    }
+    m_dirtyRanges.clear();
+
+    // NOTE: Aligned ranges may overlap, which is allowed
+    m_context->getDevice().flushMappedMemoryRanges(memoryRanges);
+}
+
+void Buffer::invalidate(vk::DeviceSize offset, vk::DeviceSize size) {
+    if (m_isHostCoherent) {
+        return;
+    }
+    if (size == VK_WHOLE_SIZE) {
+        size = m_size - offset;
+    }
+    m_context->getDevice().invalidateMappedMemoryRanges(getMappedMemoryRange(offset, size));
 }
 
-void Buffer::prepareStagingBuffer() {
-    RV_ASSERT(!m_isHostVisible, "This m_buffer is not m_device m_buffer.");
-    if (!m_stagingBuffer) {
-        m_stagingBuffer = m_context->createBuffer({
-            .usage = BufferUsage::Staging,
-            .memory = MemoryUsage::Host,
-            .size = m_size,
-        });
+auto Buffer::mergeRanges(std::vector<BufferRange> ranges) -> std::vector<BufferRange> {
+    std::ranges::sort(ranges, {}, &BufferRange::offset);
+
+    std::vector<BufferRange> merged;
+    for (const auto& range : ranges) {
+        if (!merged.empty() && range.offset <= merged.back().offset + merged.back().size) {
+            vk::DeviceSize end = std::max(merged.back().offset + merged.back().size,
+                                          range.offset + range.size);
+            merged.back().size = end - merged.back().offset;
+        } else if (range.size > 0) {
+            merged.push_back(range);
+        }
+    }
+    return merged;
+}
+
+auto Buffer::getMappedMemoryRange(vk::DeviceSize offset, vk::DeviceSize size) const
+    -> vk::MappedMemoryRange {
+    // Ranges must be aligned to nonCoherentAtomSize within the vk::DeviceMemory
+    vk::DeviceSize atomSize = m_context->getPhysicalDeviceLimits().nonCoherentAtomSize;
+    vk::DeviceSize memorySize =
+        m_allocation.block ? m_allocation.block->size : m_allocation.size;
+    vk::DeviceSize begin = (m_allocation.offset + offset) / atomSize * atomSize;
+    vk::DeviceSize end =
+        (m_allocation.offset + offset + size + atomSize - 1) / atomSize * atomSize;
+
+    vk::MappedMemoryRange memoryRange;
+    memoryRange.setMemory(m_allocation.memory);
+    memoryRange.setOffset(begin);
+    memoryRange.setSize(end < memorySize ? end - begin : VK_WHOLE_SIZE);
+    return memoryRange;
+}
+
+void Buffer::writeBindlessBuffer() {
+    if (!m_bindless || !m_context->hasBindlessHeap() ||
+        !(m_usage & vk::BufferUsageFlagBits::eStorageBuffer)) {
+        return;
+    }
+    BindlessHeap& heap = m_context->getBindlessHeap();
+    if (m_storageBufferIndex == BindlessHeap::InvalidIndex) {
+        m_storageBufferIndex = heap.allocate(BindlessType::StorageBuffer);
+    }
+    if (m_storageBufferIndex == BindlessHeap::InvalidIndex) {
+        return;
     }
+    vk::DescriptorBufferInfo info = getInfo();
+    info.range = std::min<vk::DeviceSize>(
+        info.range, m_context->getPhysicalDeviceLimits().maxStorageBufferRange);
+    heap.writeBuffer(m_storageBufferIndex, info);
 }
 }  // namespace rv
@@ -1,13 +1,132 @@
 #include "reactive/Graphics/CommandBuffer.hpp"
 
+#include "reactive/Graphics/BindlessHeap.hpp"
 #include "reactive/Graphics/Buffer.hpp"
 #include "reactive/Graphics/Context.hpp"
+#include "reactive/Graphics/DescriptorBuffer.hpp"
 #include "reactive/Graphics/Image.hpp"
 #include "reactive/Graphics/Pipeline.hpp"
+#include "reactive/Graphics/UploadRing.hpp"
 #include "reactive/Timer/GPUTimer.hpp"
 #include "reactive/common.hpp"
 
 namespace rv {
+namespace {
+constexpr vk::AccessFlags2 WriteAccessFlags =
+    vk::AccessFlagBits2::eShaderWrite | vk::AccessFlagBits2::eShaderStorageWrite |
+    vk::AccessFlagBits2::eColorAttachmentWrite | vk::AccessFlagBits2::eDepthStencilAttachmentWrite |
+    vk::AccessFlagBits2::eTransferWrite | vk::AccessFlagBits2::eHostWrite |
+    vk::AccessFlagBits2::eMemoryWrite;
+
+// Expected use of an image in `layout`
+// NOTE: Shader stages are not known from the layout, so they wait for all commands
+auto getLayoutStageAccess(vk::ImageLayout layout)
+    -> std::pair<vk::PipelineStageFlags2, vk::AccessFlags2> {
+    using Stage = vk::PipelineStageFlagBits2;
+    using Access = vk::AccessFlagBits2;
+    switch (layout) {
+        case vk::ImageLayout::eTransferDstOptimal:
+            return {Stage::eTransfer, Access::eTransferWrite};
+        case vk::ImageLayout::eTransferSrcOptimal:
+            return {Stage::eTransfer, Access::eTransferRead};
+        case vk::ImageLayout::eColorAttachmentOptimal:
+            return {Stage::eColorAttachmentOutput,
+                    Access::eColorAttachmentRead | Access::eColorAttachmentWrite};
+        case vk::ImageLayout::eDepthStencilAttachmentOptimal:
+            return {Stage::eEarlyFragmentTests | Stage::eLateFragmentTests,
+                    Access::eDepthStencilAttachmentRead | Access::eDepthStencilAttachmentWrite};
+        case vk::ImageLayout::eAttachmentOptimal:
+            return {Stage::eColorAttachmentOutput | Stage::eEarlyFragmentTests |
+                        Stage::eLateFragmentTests,
+                    Access::eColorAttachmentRead | Access::eColorAttachmentWrite |
+                        Access::eDepthStencilAttachmentRead |
+                        Access::eDepthStencilAttachmentWrite};
+        case vk::ImageLayout::eShaderReadOnlyOptimal:
+        case vk::ImageLayout::eReadOnlyOptimal:
+            return {Stage::eAllCommands, Access::eShaderRead};
+        case vk::ImageLayout::ePresentSrcKHR:
+            return {Stage::eAllCommands, Access::eMemoryRead};
+        default:
+            return {Stage::eAllCommands, Access::eMemoryRead | Access::eMemoryWrite};
+    }
+}
+
+// NOTE: Bits of synchronization2 flags match the legacy ones
+auto toStage2(vk::PipelineStageFlags stage) -> vk::PipelineStageFlags2 {
+    return vk::PipelineStageFlags2{static_cast<VkPipelineStageFlags>(stage)};
+}
+
+auto toAccess2(vk::AccessFlags access) -> vk::AccessFlags2 {
+    return vk::AccessFlags2{static_cast<VkAccessFlags>(access)};
+}
+
+// Conservative: meta stages overlap every stage
+auto stagesOverlap(vk::PipelineStageFlags2 a, vk::PipelineStageFlags2 b) -> bool {
+    constexpr vk::PipelineStageFlags2 MetaStages =
+        vk::PipelineStageFlagBits2::eAllCommands | vk::PipelineStageFlagBits2::eAllGraphics |
+        vk::PipelineStageFlagBits2::eTopOfPipe | vk::PipelineStageFlagBits2::eBottomOfPipe;
+    if (!a || !b) {
+        return false;
+    }
+    return ((a | b) & MetaStages) || (a & b);
+}
+
+auto rangeEnd(uint32_t base, uint32_t count) -> uint64_t {
+    return count == VK_REMAINING_MIP_LEVELS ? std::numeric_limits<uint64_t>::max()
+                                            : uint64_t{base} + count;
+}
+
+auto rangesOverlap(const vk::ImageSubresourceRange& a, const vk::ImageSubresourceRange& b)
+    -> bool {
+    return (a.aspectMask & b.aspectMask) &&
+           a.baseMipLevel < rangeEnd(b.baseMipLevel, b.levelCount) &&
+           b.baseMipLevel < rangeEnd(a.baseMipLevel, a.levelCount) &&
+           a.baseArrayLayer < rangeEnd(b.baseArrayLayer, b.layerCount) &&
+           b.baseArrayLayer < rangeEnd(a.baseArrayLayer, a.layerCount);
+}
+
+auto rangesOverlap(const vk::BufferMemoryBarrier2& a, const vk::BufferMemoryBarrier2& b) -> bool {
+    auto end = [](const vk::BufferMemoryBarrier2& barrier) {
+        return barrier.size == VK_WHOLE_SIZE ? std::numeric_limits<vk::DeviceSize>::max()
+                                             : barrier.offset + barrier.size;
+    };
+    return a.offset < end(b) && b.offset < end(a);
+}
+
+auto toImageBarrier2(const vk::ImageMemoryBarrier& barrier,
+                     vk::PipelineStageFlags srcStageMask,
+                     vk::PipelineStageFlags dstStageMask) -> vk::ImageMemoryBarrier2 {
+    vk::ImageMemoryBarrier2 barrier2;
+    barrier2.setSrcStageMask(toStage2(srcStageMask));
+    barrier2.setSrcAccessMask(toAccess2(barrier.srcAccessMask));
+    barrier2.setDstStageMask(toStage2(dstStageMask));
+    barrier2.setDstAccessMask(toAccess2(barrier.dstAccessMask));
+    barrier2.setOldLayout(barrier.oldLayout);
+    barrier2.setNewLayout(barrier.newLayout);
+    barrier2.setSrcQueueFamilyIndex(barrier.srcQueueFamilyIndex);
+    barrier2.setDstQueueFamilyIndex(barrier.dstQueueFamilyIndex);
+    barrier2.setImage(barrier.image);
+    barrier2.setSubresourceRange(barrier.subresourceRange);
+    return barrier2;
+}
+
+auto toBufferBarrier2(const vk::BufferMemoryBarrier& barrier,
+                      vk::PipelineStageFlags srcStageMask,
+                      vk::PipelineStageFlags dstStageMask) -> vk::BufferMemoryBarrier2 {
+    vk::BufferMemoryBarrier2 barrier2;
+    barrier2.setSrcStageMask(toStage2(srcStageMask));
+    barrier2.setSrcAccessMask(toAccess2(barrier.srcAccessMask));
+    barrier2.setDstStageMask(toStage2(dstStageMask));
+    barrier2.setDstAccessMask(toAccess2(barrier.dstAccessMask));
+    barrier2.setSrcQueueFamilyIndex(barrier.srcQueueFamilyIndex);
+    barrier2.setDstQueueFamilyIndex(barrier.dstQueueFamilyIndex);
+    barrier2.setBuffer(barrier.buffer);
+    barrier2.setOffset(barrier.offset);
+    barrier2.setSize(barrier.size);
+    return barrier2;
+}
+}  // namespace
+
 auto CommandBuffer::getQueueFlags() const -> vk::QueueFlags {
     return m_queueFlags;
 }
@@ -16,16 +135,56 @@ void CommandBuffer::begin(vk::CommandBufferUsageFlags flags) const {
     vk::CommandBufferBeginInfo beginInfo;
     beginInfo.setFlags(flags);
     m_commandBuffer->begin(beginInfo);
+    m_barrierStats = {};
+    m_boundDescriptorBuffer = 0;
 }
 
 void CommandBuffer::end() const {
+    flushBarriers();
     m_commandBuffer->end();
 }
 
-void CommandBuffer::bindDescriptorSet(PipelineHandle pipeline, DescriptorSetHandle descSet) const {
+void CommandBuffer::bindDescriptorSet(PipelineHandle pipeline,
+                                      DescriptorSetHandle descSet,
+                                      ArrayProxy<uint32_t> dynamicOffsets) const {
+    RV_ASSERT(!descSet->isPush(), "Push descriptor sets are recorded by pushDescriptorSet().");
+    RV_ASSERT(dynamicOffsets.size() == descSet->getDynamicOffsetCount(),
+              "Expected {} dynamic offsets, but got {}.", descSet->getDynamicOffsetCount(),
+              dynamicOffsets.size());
+    if (descSet->usesDescriptorBuffer()) {
+        RV_ASSERT(pipeline->usesDescriptorBuffer(), "Pipeline was created without the descriptor buffer backend.");
+        vk::DescriptorBufferBindingInfoEXT bindingInfo =
+            m_context->getDescriptorBuffer().getBindingInfo();
+        if (m_boundDescriptorBuffer != bindingInfo.address) {
+            m_commandBuffer->bindDescriptorBuffersEXT(bindingInfo);
+            m_boundDescriptorBuffer = bindingInfo.address;
+        }
+        uint32_t bufferIndex = 0;
+        vk::DeviceSize offset = descSet->getDescriptorBufferOffset();
+        m_commandBuffer->setDescriptorBufferOffsetsEXT(pipeline->getPipelineBindPoint(),
+                                                       pipeline->getPipelineLayout(),
+                                                       pipeline->getDescSetIndex(), bufferIndex,
+                                                       offset);
+        return;
+    }
     m_commandBuffer->bindDescriptorSets(pipeline->getPipelineBindPoint(),
-                                      pipeline->getPipelineLayout(), 0, descSet->getDescriptorSet(),
-                                      nullptr);
+                                      pipeline->getPipelineLayout(), pipeline->getDescSetIndex(),
+                                      descSet->getDescriptorSet(), dynamicOffsets);
+}
+
+void CommandBuffer::pushDescriptorSet(PipelineHandle pipeline, DescriptorSetHandle descSet) const {
+    RV_ASSERT(descSet->isPush(), "DescriptorSet must be created with push = true.");
+    m_commandBuffer->pushDescriptorSetKHR(pipeline->getPipelineBindPoint(),
+                                          pipeline->getPipelineLayout(),
+                                          pipeline->getPushDescSetIndex(),
+                                          descSet->getPushWrites());
+}
+
+void CommandBuffer::bindBindlessHeap(PipelineHandle pipeline) const {
+    RV_ASSERT(pipeline->isBindless(), "Pipeline must be created with bindless = true.");
+    m_commandBuffer->bindDescriptorSets(pipeline->getPipelineBindPoint(),
+                                        pipeline->getPipelineLayout(), BindlessHeap::SetIndex,
+                                        m_context->getBindlessHeap().getDescriptorSet(), nullptr);
 }
 
 void CommandBuffer::bindPipeline(PipelineHandle pipeline) const {
@@ -49,20 +208,24 @@ void CommandBuffer::traceRays(RayTracingPipelineHandle pipeline,
                               uint32_t countX,
                               uint32_t countY,
                               uint32_t countZ) const {
+    flushBarriers();
     m_commandBuffer->traceRaysKHR(pipeline->m_raygenRegion, pipeline->m_missRegion, pipeline->m_hitRegion,
                                 {}, countX, countY, countZ);
 }
 
 void CommandBuffer::dispatch(uint32_t countX, uint32_t countY, uint32_t countZ) const {
+    flushBarriers();
     m_commandBuffer->dispatch(countX, countY, countZ);
 }
 
 void CommandBuffer::dispatchIndirect(BufferHandle buffer, vk::DeviceSize offset) const {
+    flushBarriers();
     m_commandBuffer->dispatchIndirect(buffer->getBuffer(), offset);
 }
 
 void CommandBuffer::clearColorImage(ImageHandle image, std::array<float, 4> color) const {
     transitionLayout(image, vk::ImageLayout::eTransferDstOptimal);
+    flushBarriers();
     m_commandBuffer->clearColorImage(
         image->getImage(), vk::ImageLayout::eTransferDstOptimal, vk::ClearColorValue{color},
         vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1});
@@ -70,6 +233,7 @@ void CommandBuffer::clearColorImage(ImageHandle image, std::array<float, 4> colo
 
 void CommandBuffer::clearDepthStencilImage(ImageHandle image, float depth, uint32_t stencil) const {
     transitionLayout(image, vk::ImageLayout::eTransferDstOptimal);
+    flushBarriers();
     m_commandBuffer->clearDepthStencilImage(
         image->getImage(), vk::ImageLayout::eTransferDstOptimal,
         vk::ClearDepthStencilValue{depth, stencil},
@@ -80,6 +244,9 @@ void CommandBuffer::beginRendering(ImageHandle colorImage,
                                    ImageHandle depthImage,
                                    std::array<int32_t, 2> offset,
                                    std::array<uint32_t, 2> extent) const {
+    // NOTE: Barriers can't be recorded inside rendering
+    flushBarriers();
+
     vk::RenderingInfo renderingInfo;
     renderingInfo.setRenderArea({{offset[0], offset[1]}, {extent[0], extent[1]}});
     renderingInfo.setLayerCount(1);
@@ -108,6 +275,9 @@ void CommandBuffer::beginRendering(ArrayProxy<ImageHandle> colorImages,
                                    ImageHandle depthImage,
                                    std::array<int32_t, 2> offset,
                                    std::array<uint32_t, 2> extent) const {
+    // NOTE: Barriers can't be recorded inside rendering
+    flushBarriers();
+
     vk::RenderingInfo renderingInfo;
     renderingInfo.setRenderArea({{offset[0], offset[1]}, {extent[0], extent[1]}});
     renderingInfo.setLayerCount(1);
@@ -142,6 +312,7 @@ void CommandBuffer::draw(uint32_t vertexCount,
                          uint32_t instanceCount,
                          uint32_t firstVertex,
                          uint32_t firstInstance) const {
+    flushBarriers();
     m_commandBuffer->draw(vertexCount, instanceCount, firstVertex, firstInstance);
 }
 
@@ -150,12 +321,14 @@ void CommandBuffer::drawIndexed(uint32_t indexCount,
                                 uint32_t firstIndex,
                                 int32_t vertexOffset,
                                 uint32_t firstInstance) const {
+    flushBarriers();
     m_commandBuffer->drawIndexed(indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
 }
 
 void CommandBuffer::drawMeshTasks(uint32_t groupCountX,
                                   uint32_t groupCountY,
                                   uint32_t groupCountZ) const {
+    flushBarriers();
     m_commandBuffer->drawMeshTasksEXT(groupCountX, groupCountY, groupCountZ);
 }
 
@@ -163,6 +336,7 @@ void CommandBuffer::drawIndirect(BufferHandle buffer,
                                  vk::DeviceSize offset,
                                  uint32_t drawCount,
                                  uint32_t stride) const {
+    flushBarriers();
     m_commandBuffer->drawIndirect(buffer->getBuffer(), offset, drawCount, stride);
 }
 
@@ -170,6 +344,7 @@ void CommandBuffer::drawIndexedIndirect(BufferHandle buffer,
                                         vk::DeviceSize offset,
                                         uint32_t drawCount,
                                         uint32_t stride) const {
+    flushBarriers();
     m_commandBuffer->drawIndexedIndirect(buffer->getBuffer(), offset, drawCount, stride);
 }
 
@@ -177,6 +352,7 @@ void CommandBuffer::drawMeshTasksIndirect(BufferHandle buffer,
                                           vk::DeviceSize offset,
                                           uint32_t drawCount,
                                           uint32_t stride) const {
+    flushBarriers();
     m_commandBuffer->drawMeshTasksIndirectEXT(buffer->getBuffer(), offset, drawCount, stride);
 }
 
@@ -185,8 +361,9 @@ void CommandBuffer::bufferBarrier(
     vk::PipelineStageFlags srcStageMask,
     vk::PipelineStageFlags dstStageMask,
     vk::DependencyFlags dependencyFlags) const {
-    m_commandBuffer->pipelineBarrier(srcStageMask, dstStageMask, dependencyFlags, nullptr,
-                                   bufferMemoryBarriers, nullptr);
+    for (const auto& barrier : bufferMemoryBarriers) {
+        addBufferBarrier(toBufferBarrier2(barrier, srcStageMask, dstStageMask), dependencyFlags);
+    }
 }
 
 void CommandBuffer::bufferBarrier(ArrayProxy<BufferHandle> buffers,
@@ -195,19 +372,17 @@ void CommandBuffer::bufferBarrier(ArrayProxy<BufferHandle> buffers,
                                   vk::AccessFlags srcAccessMask,
                                   vk::AccessFlags dstAccessMask,
                                   vk::DependencyFlags dependencyFlags) const {
-    std::vector<vk::BufferMemoryBarrier> barriers(buffers.size());
-    for (uint32_t i = 0; i < buffers.size(); i++) {
-        barriers[i].srcAccessMask = srcAccessMask;
-        barriers[i].dstAccessMask = dstAccessMask;
-        barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barriers[i].buffer = buffers[i]->getBuffer();
-        barriers[i].offset = 0;
-        barriers[i].size = VK_WHOLE_SIZE;
+    for (const auto& buffer : buffers) {
+        vk::BufferMemoryBarrier2 barrier;
+        barrier.setSrcStageMask(toStage2(srcStageMask));
+        barrier.setSrcAccessMask(toAccess2(srcAccessMask));
+        barrier.setDstStageMask(toStage2(dstStageMask));
+        barrier.setDstAccessMask(toAccess2(dstAccessMask));
+        barrier.setBuffer(buffer->getBuffer());
+        barrier.setOffset(0);
+        barrier.setSize(VK_WHOLE_SIZE);
+        addBufferBarrier(barrier, dependencyFlags);
     }
-
-    m_commandBuffer->pipelineBarrier(srcStageMask, dstStageMask, dependencyFlags, nullptr, barriers,
-                                   nullptr);
 }
 
 void CommandBuffer::imageBarrier(
@@ -215,8 +390,9 @@ void CommandBuffer::imageBarrier(
     vk::PipelineStageFlags srcStageMask,
     vk::PipelineStageFlags dstStageMask,
     vk::DependencyFlags dependencyFlags) const {
-    m_commandBuffer->pipelineBarrier(srcStageMask, dstStageMask, dependencyFlags, nullptr, nullptr,
-                                   imageMemoryBarriers);
+    for (const auto& barrier : imageMemoryBarriers) {
+        addImageBarrier(toImageBarrier2(barrier, srcStageMask, dstStageMask), dependencyFlags);
+    }
 }
 
 void CommandBuffer::imageBarrier(ArrayProxy<ImageHandle> images,
@@ -227,22 +403,17 @@ void CommandBuffer::imageBarrier(ArrayProxy<ImageHandle> images,
                                  vk::DependencyFlags dependencyFlags) const {
     // NOTE: Since layout transition is not required,
     // oldLayout and newLayout are not specified.
-    std::vector<vk::ImageMemoryBarrier> barriers(images.size());
-    for (uint32_t i = 0; i < images.size(); i++) {
-        barriers[i].srcAccessMask = srcAccessMask;
-        barriers[i].dstAccessMask = dstAccessMask;
-        barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barriers[i].image = images[i]->getImage();
-        barriers[i].subresourceRange.aspectMask = images[i]->getAspectMask();
-        barriers[i].subresourceRange.baseMipLevel = 0;
-        barriers[i].subresourceRange.baseArrayLayer = 0;
-        barriers[i].subresourceRange.layerCount = images[i]->getLayerCount();
-        barriers[i].subresourceRange.levelCount = images[i]->getMipLevels();
+    for (const auto& image : images) {
+        vk::ImageMemoryBarrier2 barrier;
+        barrier.setSrcStageMask(toStage2(srcStageMask));
+        barrier.setSrcAccessMask(toAccess2(srcAccessMask));
+        barrier.setDstStageMask(toStage2(dstStageMask));
+        barrier.setDstAccessMask(toAccess2(dstAccessMask));
+        barrier.setImage(image->getImage());
+        barrier.setSubresourceRange(
+            {image->getAspectMask(), 0, image->getMipLevels(), 0, image->getLayerCount()});
+        addImageBarrier(barrier, dependencyFlags);
     }
-
-    m_commandBuffer->pipelineBarrier(srcStageMask, dstStageMask, dependencyFlags, nullptr, nullptr,
-                                   barriers);
 }
 
 void CommandBuffer::memoryBarrier(vk::PipelineStageFlags srcStageMask,
@@ -250,78 +421,234 @@ void CommandBuffer::memoryBarrier(vk::PipelineStageFlags srcStageMask,
                                   vk::AccessFlags srcAccessMask,
                                   vk::AccessFlags dstAccessMask,
                                   vk::DependencyFlags dependencyFlags) {
-    vk::MemoryBarrier memoryBarrier{};
-    memoryBarrier.setSrcAccessMask(srcAccessMask);
-    memoryBarrier.setDstAccessMask(dstAccessMask);
-    m_commandBuffer->pipelineBarrier(srcStageMask, dstStageMask, dependencyFlags, memoryBarrier,
-                                   nullptr, nullptr);
+    vk::MemoryBarrier2 barrier;
+    barrier.setSrcStageMask(toStage2(srcStageMask));
+    barrier.setSrcAccessMask(toAccess2(srcAccessMask));
+    barrier.setDstStageMask(toStage2(dstStageMask));
+    barrier.setDstAccessMask(toAccess2(dstAccessMask));
+    addMemoryBarrier(barrier, dependencyFlags);
 }
 
-void CommandBuffer::transitionLayout(ImageHandle image, vk::ImageLayout newLayout) const {
-    vk::PipelineStageFlags srcStageMask = vk::PipelineStageFlagBits::eAllCommands;
-    vk::PipelineStageFlags dstStageMask = vk::PipelineStageFlagBits::eAllCommands;
+void CommandBuffer::flushBarriers() const {
+    if (!hasPendingBarriers()) {
+        return;
+    }
 
-    // NOTE: oldLayoutをUndefinedとすると画像の内容は破棄される可能性がある
-    vk::ImageMemoryBarrier barrier{};
-    barrier.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
-    barrier.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
-    barrier.setImage(image->m_image);
-    barrier.setOldLayout(image->m_layout);
-    barrier.setNewLayout(newLayout);
-    barrier.subresourceRange.aspectMask = image->getAspectMask();
-    barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = image->getLayerCount();
-    barrier.subresourceRange.levelCount = image->getMipLevels();
-
-    switch (image->m_layout) {
-        case vk::ImageLayout::eTransferDstOptimal:
-            barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
-            break;
-        case vk::ImageLayout::eTransferSrcOptimal:
-            barrier.srcAccessMask = vk::AccessFlagBits::eTransferRead;
-            break;
-        case vk::ImageLayout::eColorAttachmentOptimal:
-            barrier.srcAccessMask = vk::AccessFlagBits::eColorAttachmentRead;
-            break;
-        case vk::ImageLayout::eDepthStencilAttachmentOptimal:
-            barrier.srcAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentRead;
-            break;
-        case vk::ImageLayout::eShaderReadOnlyOptimal:
-            barrier.srcAccessMask = vk::AccessFlagBits::eShaderRead;
-            break;
-        case vk::ImageLayout::ePresentSrcKHR:
-            barrier.srcAccessMask = vk::AccessFlagBits::eMemoryRead;
-            break;
-        default:
-            break;
+    vk::DependencyInfo dependencyInfo;
+    dependencyInfo.setDependencyFlags(m_pendingDependencyFlags);
+    dependencyInfo.setImageMemoryBarriers(m_pendingImageBarriers);
+    dependencyInfo.setBufferMemoryBarriers(m_pendingBufferBarriers);
+    if (m_pendingMemoryBarrier) {
+        dependencyInfo.setMemoryBarriers(*m_pendingMemoryBarrier);
     }
+    m_commandBuffer->pipelineBarrier2(dependencyInfo);
 
-    switch (newLayout) {
-        case vk::ImageLayout::eTransferDstOptimal:
-            barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
-            break;
-        case vk::ImageLayout::eTransferSrcOptimal:
-            barrier.dstAccessMask = vk::AccessFlagBits::eTransferRead;
-            break;
-        case vk::ImageLayout::eColorAttachmentOptimal:
-            barrier.dstAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
-            break;
-        case vk::ImageLayout::eDepthStencilAttachmentOptimal:
-            barrier.dstAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentWrite;
-            break;
-        case vk::ImageLayout::eShaderReadOnlyOptimal:
-            barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
-            break;
-        case vk::ImageLayout::ePresentSrcKHR:
-            barrier.dstAccessMask = vk::AccessFlagBits::eMemoryRead;
-            break;
-        default:
+    m_barrierStats.emittedCount += static_cast<uint32_t>(
+        m_pendingImageBarriers.size() + m_pendingBufferBarriers.size() +
+        (m_pendingMemoryBarrier ? 1 : 0));
+    m_barrierStats.batchCount++;
+
+    m_pendingImageBarriers.clear();
+    m_pendingBufferBarriers.clear();
+    m_pendingMemoryBarrier.reset();
+}
+
+auto CommandBuffer::hasPendingBarriers() const -> bool {
+    return !m_pendingImageBarriers.empty() || !m_pendingBufferBarriers.empty() ||
+           m_pendingMemoryBarrier.has_value();
+}
+
+auto CommandBuffer::isPendingDstStage(vk::PipelineStageFlags2 stage) const -> bool {
+    for (const auto& pending : m_pendingImageBarriers) {
+        if (stagesOverlap(pending.dstStageMask, stage)) {
+            return true;
+        }
+    }
+    for (const auto& pending : m_pendingBufferBarriers) {
+        if (stagesOverlap(pending.dstStageMask, stage)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CommandBuffer::prepareBarrier(vk::DependencyFlags dependencyFlags) const {
+    if (hasPendingBarriers() && m_pendingDependencyFlags != dependencyFlags) {
+        flushBarriers();
+    }
+    m_pendingDependencyFlags = dependencyFlags;
+    m_barrierStats.requestedCount++;
+}
+
+void CommandBuffer::addImageBarrier(const vk::ImageMemoryBarrier2& barrier,
+                                    vk::DependencyFlags dependencyFlags) const {
+    prepareBarrier(dependencyFlags);
+
+    // A global barrier may be the first half of a dependency chain
+    if (m_pendingMemoryBarrier &&
+        stagesOverlap(m_pendingMemoryBarrier->dstStageMask, barrier.srcStageMask)) {
+        flushBarriers();
+    }
+
+    auto isSameImage = [&](const vk::ImageMemoryBarrier2& pending) {
+        return pending.image == barrier.image &&
+               pending.srcQueueFamilyIndex == barrier.srcQueueFamilyIndex &&
+               pending.dstQueueFamilyIndex == barrier.dstQueueFamilyIndex;
+    };
+    const vk::ImageSubresourceRange& newRange = barrier.subresourceRange;
+
+    // Same subresources: no command runs between the two barriers, so
+    // identical transitions are merged and chained ones (A->B, B->C)
+    // collapse into one (A->C) with the union of both scopes.
+    for (auto& pending : m_pendingImageBarriers) {
+        if (isSameImage(pending) && pending.subresourceRange == newRange &&
+            (pending.newLayout == barrier.oldLayout ||
+             (pending.oldLayout == barrier.oldLayout && pending.newLayout == barrier.newLayout))) {
+            pending.srcStageMask |= barrier.srcStageMask;
+            pending.srcAccessMask |= barrier.srcAccessMask;
+            pending.dstStageMask |= barrier.dstStageMask;
+            pending.dstAccessMask |= barrier.dstAccessMask;
+            pending.newLayout = barrier.newLayout;
+            return;
+        }
+    }
+
+    // Barriers in one call are not ordered, so a dependent barrier must wait
+    for (const auto& pending : m_pendingImageBarriers) {
+        if (pending.image == barrier.image && rangesOverlap(pending.subresourceRange, newRange)) {
+            flushBarriers();
+            m_pendingImageBarriers.push_back(barrier);
+            return;
+        }
+    }
+
+    // Adjacent mips with the same transition
+    for (auto& pending : m_pendingImageBarriers) {
+        const vk::ImageSubresourceRange& range = pending.subresourceRange;
+        if (isSameImage(pending) && range.aspectMask == newRange.aspectMask &&
+            range.baseArrayLayer == newRange.baseArrayLayer &&
+            range.layerCount == newRange.layerCount &&
+            range.levelCount != VK_REMAINING_MIP_LEVELS &&
+            range.baseMipLevel + range.levelCount == newRange.baseMipLevel &&
+            pending.oldLayout == barrier.oldLayout && pending.newLayout == barrier.newLayout &&
+            pending.srcStageMask == barrier.srcStageMask &&
+            pending.srcAccessMask == barrier.srcAccessMask &&
+            pending.dstStageMask == barrier.dstStageMask &&
+            pending.dstAccessMask == barrier.dstAccessMask) {
+            pending.subresourceRange.levelCount = newRange.levelCount == VK_REMAINING_MIP_LEVELS
+                                                      ? VK_REMAINING_MIP_LEVELS
+                                                      : range.levelCount + newRange.levelCount;
+            return;
+        }
+    }
+    m_pendingImageBarriers.push_back(barrier);
+}
+
+void CommandBuffer::addBufferBarrier(const vk::BufferMemoryBarrier2& barrier,
+                                     vk::DependencyFlags dependencyFlags) const {
+    prepareBarrier(dependencyFlags);
+
+    if (m_pendingMemoryBarrier &&
+        stagesOverlap(m_pendingMemoryBarrier->dstStageMask, barrier.srcStageMask)) {
+        flushBarriers();
+    }
+
+    for (auto& pending : m_pendingBufferBarriers) {
+        if (pending.buffer != barrier.buffer ||
+            pending.srcQueueFamilyIndex != barrier.srcQueueFamilyIndex ||
+            pending.dstQueueFamilyIndex != barrier.dstQueueFamilyIndex) {
+            continue;
+        }
+        if (pending.offset == barrier.offset && pending.size == barrier.size) {
+            pending.srcStageMask |= barrier.srcStageMask;
+            pending.srcAccessMask |= barrier.srcAccessMask;
+            pending.dstStageMask |= barrier.dstStageMask;
+            pending.dstAccessMask |= barrier.dstAccessMask;
+            return;
+        }
+        if (rangesOverlap(pending, barrier)) {
+            flushBarriers();
             break;
+        }
+    }
+    m_pendingBufferBarriers.push_back(barrier);
+}
+
+void CommandBuffer::addMemoryBarrier(const vk::MemoryBarrier2& barrier,
+                                     vk::DependencyFlags dependencyFlags) const {
+    prepareBarrier(dependencyFlags);
+
+    // A global barrier may be the second half of a dependency chain
+    if (isPendingDstStage(barrier.srcStageMask)) {
+        flushBarriers();
     }
 
-    m_commandBuffer->pipelineBarrier(srcStageMask, dstStageMask, {}, {}, {}, barrier);
-    image->m_layout = newLayout;
+    if (!m_pendingMemoryBarrier) {
+        m_pendingMemoryBarrier = barrier;
+        return;
+    }
+    m_pendingMemoryBarrier->srcStageMask |= barrier.srcStageMask;
+    m_pendingMemoryBarrier->srcAccessMask |= barrier.srcAccessMask;
+    m_pendingMemoryBarrier->dstStageMask |= barrier.dstStageMask;
+    m_pendingMemoryBarrier->dstAccessMask |= barrier.dstAccessMask;
+}
+
+void CommandBuffer::transitionLayout(ImageHandle image, vk::ImageLayout newLayout) const {
+    transitionLayout(*image, newLayout, 0, image->getMipLevels(), 0, image->getLayerCount());
+}
+
+void CommandBuffer::transitionLayout(ImageHandle image,
+                                     vk::ImageLayout newLayout,
+                                     uint32_t baseMipLevel,
+                                     uint32_t levelCount,
+                                     uint32_t baseArrayLayer,
+                                     uint32_t layerCount) const {
+    transitionLayout(*image, newLayout, baseMipLevel, levelCount, baseArrayLayer, layerCount);
+}
+
+void CommandBuffer::transitionLayout(Image& image,
+                                     vk::ImageLayout newLayout,
+                                     uint32_t baseMipLevel,
+                                     uint32_t levelCount,
+                                     uint32_t baseArrayLayer,
+                                     uint32_t layerCount) const {
+    RV_ASSERT(baseMipLevel + levelCount <= image.getMipLevels() &&
+                  baseArrayLayer + layerCount <= image.getLayerCount(),
+              "Subresource range is out of the image: mip={}+{}, layer={}+{}", baseMipLevel,
+              levelCount, baseArrayLayer, layerCount);
+
+    auto [dstStage, dstAccess] = getLayoutStageAccess(newLayout);
+    vk::ImageAspectFlags aspect = image.getAspectMask();
+    if (!aspect) {
+        aspect = vk::ImageAspectFlagBits::eColor;
+    }
+
+    // NOTE: oldLayoutをUndefinedとすると画像の内容は破棄される可能性がある
+    // NOTE: Contiguous mips with the same state are merged by addImageBarrier()
+    for (uint32_t layer = baseArrayLayer; layer < baseArrayLayer + layerCount; layer++) {
+        for (uint32_t mip = baseMipLevel; mip < baseMipLevel + levelCount; mip++) {
+            ImageSubresourceState& state = image.getSubresourceState(mip, layer);
+
+            // Read-after-read in the same layout
+            if (state.layout == newLayout && !(state.access & WriteAccessFlags)) {
+                state.stage |= dstStage;
+                state.access |= dstAccess & ~WriteAccessFlags;
+                continue;
+            }
+
+            vk::ImageMemoryBarrier2 barrier;
+            barrier.setSrcStageMask(state.stage);
+            barrier.setSrcAccessMask(state.access);
+            barrier.setDstStageMask(dstStage);
+            barrier.setDstAccessMask(dstAccess);
+            barrier.setOldLayout(state.layout);
+            barrier.setNewLayout(newLayout);
+            barrier.setImage(image.m_image);
+            barrier.setSubresourceRange({aspect, mip, 1, layer, 1});
+            addImageBarrier(barrier, {});
+            state = {newLayout, dstStage, dstAccess};
+        }
+    }
 }
 
 void CommandBuffer::copyImage(ImageHandle srcImage,
@@ -337,6 +664,7 @@ void CommandBuffer::copyImage(ImageHandle srcImage,
 
     transitionLayout(srcImage, vk::ImageLayout::eTransferSrcOptimal);
     transitionLayout(dstImage, vk::ImageLayout::eTransferDstOptimal);
+    flushBarriers();
 
     vk::ImageCopy copyRegion;
     copyRegion.setSrcSubresource({vk::ImageAspectFlagBits::eColor, 0, 0, 1});
@@ -351,6 +679,7 @@ void CommandBuffer::copyImage(ImageHandle srcImage,
 }
 
 void CommandBuffer::copyImageToBuffer(ImageHandle srcImage, BufferHandle dstBuffer) const {
+    flushBarriers();
     vk::BufferImageCopy region;
     region.setImageExtent(srcImage->getExtent());
     region.setImageSubresource({srcImage->getAspectMask(), 0, 0, 1});
@@ -361,6 +690,7 @@ void CommandBuffer::copyImageToBuffer(ImageHandle srcImage, BufferHandle dstBuff
 void CommandBuffer::copyBufferToImage(BufferHandle srcBuffer,
                                       ImageHandle dstImage,
                                       ArrayProxy<vk::BufferImageCopy> copyRegions) const {
+    flushBarriers();
     if (!copyRegions.empty()) {
         m_commandBuffer->copyBufferToImage(srcBuffer->getBuffer(), dstImage->getImage(),
                                          dstImage->getLayout(), copyRegions);
@@ -377,23 +707,99 @@ void CommandBuffer::blitImage(ImageHandle srcImage,
                               ImageHandle dstImage,
                               vk::ImageBlit blit,
                               vk::Filter filter) const {
-    m_commandBuffer->blitImage(srcImage->m_image, srcImage->m_layout, dstImage->m_image, dstImage->m_layout,
-                             blit, filter);
+    flushBarriers();
+    vk::ImageLayout srcLayout =
+        srcImage->getLayout(blit.srcSubresource.mipLevel, blit.srcSubresource.baseArrayLayer);
+    vk::ImageLayout dstLayout =
+        dstImage->getLayout(blit.dstSubresource.mipLevel, blit.dstSubresource.baseArrayLayer);
+    m_commandBuffer->blitImage(srcImage->m_image, srcLayout, dstImage->m_image, dstLayout, blit,
+                               filter);
 }
 
 void CommandBuffer::fillBuffer(BufferHandle dstBuffer,
                                uint32_t data,
                                vk::DeviceSize dstOffset,
                                vk::DeviceSize size) const {
+    flushBarriers();
     m_commandBuffer->fillBuffer(dstBuffer->getBuffer(), dstOffset, size, data);
 }
 
+auto CommandBuffer::allocateStaging(vk::DeviceSize size) const -> UploadRingAllocation {
+    if (!m_ownsStaging) {
+        return m_context->getUploadRing().allocate(size);
+    }
+    BufferHandle stagingBuffer = m_context->createBuffer({
+        .usage = BufferUsage::Staging,
+        .memory = MemoryIntent::Upload,
+        .size = size,
+        .debugName = "CommandBuffer::stagingBuffer",
+    });
+    m_stagingBuffers.push_back(stagingBuffer);
+    return {
+        .buffer = stagingBuffer->getBuffer(),
+        .offset = 0,
+        .mapped = stagingBuffer->map(),
+    };
+}
+
 void CommandBuffer::copyBuffer(BufferHandle buffer, const void* data) const {
-    buffer->prepareStagingBuffer();
-    buffer->m_stagingBuffer->copy(data);
+    copyBuffer(buffer, data, 0, buffer->getSize());
+}
+
+void CommandBuffer::copyBuffer(BufferHandle buffer,
+                               const void* data,
+                               vk::DeviceSize offset,
+                               vk::DeviceSize size) const {
+    RV_ASSERT(offset + size <= buffer->getSize(),
+              "Copy range exceeds the buffer: offset={}, size={}", offset, size);
+    UploadRingAllocation staging = allocateStaging(size);
+    std::memcpy(staging.mapped, data, size);
+
+    vk::BufferCopy region{staging.offset, offset, size};
+    flushBarriers();
+    m_commandBuffer->copyBuffer(staging.buffer, buffer->getBuffer(), region);
+}
+
+void CommandBuffer::copyBuffer(BufferHandle buffer,
+                               const void* data,
+                               ArrayProxy<BufferRange> ranges) const {
+    std::vector<BufferRange> mergedRanges =
+        Buffer::mergeRanges(std::vector<BufferRange>(ranges.begin(), ranges.end()));
+    if (mergedRanges.empty()) {
+        return;
+    }
 
-    vk::BufferCopy region{0, 0, buffer->getSize()};
-    m_commandBuffer->copyBuffer(buffer->m_stagingBuffer->getBuffer(), buffer->getBuffer(), region);
+    vk::DeviceSize totalSize = 0;
+    for (const auto& range : mergedRanges) {
+        totalSize += range.size;
+    }
+
+    // Pack the ranges tightly into one staging allocation
+    UploadRingAllocation staging = allocateStaging(totalSize);
+    std::vector<vk::BufferCopy> regions;
+    vk::DeviceSize stagingOffset = 0;
+    for (const auto& range : mergedRanges) {
+        RV_ASSERT(range.offset + range.size <= buffer->getSize(),
+                  "Copy range exceeds the buffer: offset={}, size={}", range.offset, range.size);
+        std::memcpy(static_cast<uint8_t*>(staging.mapped) + stagingOffset,
+                    static_cast<const uint8_t*>(data) + range.offset, range.size);
+        regions.push_back({staging.offset + stagingOffset, range.offset, range.size});
+        stagingOffset += range.size;
+    }
+    flushBarriers();
+    m_commandBuffer->copyBuffer(staging.buffer, buffer->getBuffer(), regions);
+}
+
+void CommandBuffer::copyBuffer(BufferHandle srcBuffer,
+                               BufferHandle dstBuffer,
+                               ArrayProxy<vk::BufferCopy> copyRegions) const {
+    flushBarriers();
+    if (!copyRegions.empty()) {
+        m_commandBuffer->copyBuffer(srcBuffer->getBuffer(), dstBuffer->getBuffer(), copyRegions);
+        return;
+    }
+    vk::BufferCopy region{0, 0, std::min(srcBuffer->getSize(), dstBuffer->getSize())};
+    m_commandBuffer->copyBuffer(srcBuffer->getBuffer(), dstBuffer->getBuffer(), region);
 }
 
 void CommandBuffer::updateTopAccel(TopAccelHandle topAccel) const {
@@ -417,6 +823,7 @@ void CommandBuffer::updateTopAccel(TopAccelHandle topAccel) const {
     buildRangeInfo.setPrimitiveOffset(0);
     buildRangeInfo.setFirstVertex(0);
     buildRangeInfo.setTransformOffset(0);
+    flushBarriers();
     m_commandBuffer->buildAccelerationStructuresKHR(buildGeometryInfo, &buildRangeInfo);
 }
 
@@ -453,6 +860,7 @@ void CommandBuffer::updateBottomAccel(BottomAccelHandle bottomAccel,
     buildRangeInfo.setPrimitiveOffset(0);
     buildRangeInfo.setFirstVertex(0);
     buildRangeInfo.setTransformOffset(0);
+    flushBarriers();
     m_commandBuffer->buildAccelerationStructuresKHR(buildGeometryInfo, &buildRangeInfo);
 }
 
@@ -476,6 +884,7 @@ void CommandBuffer::buildTopAccel(TopAccelHandle topAccel) const {
     buildRangeInfo.setPrimitiveOffset(0);
     buildRangeInfo.setFirstVertex(0);
     buildRangeInfo.setTransformOffset(0);
+    flushBarriers();
     m_commandBuffer->buildAccelerationStructuresKHR(buildGeometryInfo, &buildRangeInfo);
 }
 
@@ -511,16 +920,19 @@ void CommandBuffer::buildBottomAccel(BottomAccelHandle bottomAccel,
     buildRangeInfo.setPrimitiveOffset(0);
     buildRangeInfo.setFirstVertex(0);
     buildRangeInfo.setTransformOffset(0);
+    flushBarriers();
     m_commandBuffer->buildAccelerationStructuresKHR(buildGeometryInfo, &buildRangeInfo);
 }
 
 void CommandBuffer::beginTimestamp(GPUTimerHandle gpuTimer) const {
+    flushBarriers();
     m_commandBuffer->resetQueryPool(*gpuTimer->m_queryPool, 0, 2);
     m_commandBuffer->writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, *gpuTimer->m_queryPool, 0);
     gpuTimer->start();
 }
 
 void CommandBuffer::endTimestamp(GPUTimerHandle gpuTimer) const {
+    flushBarriers();
     m_commandBuffer->writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, *gpuTimer->m_queryPool,
                                   1);
     gpuTimer->stop();
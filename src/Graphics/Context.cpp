@@ -1,19 +1,84 @@
 #include "reactive/Graphics/Context.hpp"
 
+#include <bit>
+#include <cstring>
 #include <ranges>
 
 #include "reactive/Graphics/Accel.hpp"
+#include "reactive/Graphics/BindlessHeap.hpp"
 #include "reactive/Graphics/CommandBuffer.hpp"
+#include "reactive/Graphics/DescriptorAllocator.hpp"
+#include "reactive/Graphics/DescriptorBuffer.hpp"
 #include "reactive/Graphics/DescriptorSet.hpp"
+#include "reactive/Graphics/DescriptorSetLayoutCache.hpp"
 #include "reactive/Graphics/Fence.hpp"
 #include "reactive/Graphics/Image.hpp"
+#include "reactive/Graphics/MemoryAllocator.hpp"
 #include "reactive/Graphics/Pipeline.hpp"
+#include "reactive/Graphics/PipelineCache.hpp"
+#include "reactive/Graphics/PipelineRegistry.hpp"
 #include "reactive/Graphics/Shader.hpp"
+#include "reactive/Graphics/SubmitPool.hpp"
+#include "reactive/Graphics/ThreadPool.hpp"
+#include "reactive/Graphics/UploadManager.hpp"
+#include "reactive/Graphics/UploadRing.hpp"
 #include "reactive/Timer/GPUTimer.hpp"
+#include "reactive/common.hpp"
 
 VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
 
 namespace rv {
+namespace {
+// Create info with the arrays of its ArrayProxy members copied, so that it can
+// be used on a worker after the caller returns
+template <typename CreateInfo>
+struct OwnedCreateInfo {
+    OwnedCreateInfo(const CreateInfo& info) : createInfo{info} {
+        if constexpr (requires { createInfo.colorFormats; }) {
+            own(createInfo.colorFormats, colorFormats);
+        }
+        if constexpr (requires { createInfo.vertexAttributes; }) {
+            own(createInfo.vertexAttributes, vertexAttributes);
+        }
+        if constexpr (requires { createInfo.missGroups; }) {
+            own(createInfo.missGroups, missGroups);
+            own(createInfo.hitGroups, hitGroups);
+            // NOTE: Not used by RayTracingPipeline and not copyable
+            createInfo.callableGroups = {};
+        }
+    }
+
+    template <typename T>
+    static void own(ArrayProxy<T>& proxy, std::vector<T>& storage) {
+        storage.assign(proxy.begin(), proxy.end());
+        proxy = storage;
+    }
+
+    CreateInfo createInfo;
+    std::vector<vk::Format> colorFormats;
+    std::vector<VertexAttributeDescription> vertexAttributes;
+    std::vector<MissGroup> missGroups;
+    std::vector<HitGroup> hitGroups;
+};
+
+template <typename T, typename CreateInfo>
+auto submitPipelines(const Context& context, ArrayProxy<CreateInfo> createInfos)
+    -> std::vector<PipelineFuture<T>> {
+    std::vector<PipelineFuture<T>> futures;
+    futures.reserve(createInfos.size());
+    for (const auto& createInfo : createInfos) {
+        auto owned = std::make_shared<OwnedCreateInfo<CreateInfo>>(createInfo);
+        auto future = context.getThreadPool().submit([&context, owned]() -> std::shared_ptr<T> {
+            return context.getPipelineRegistry().getOrCreate(owned->createInfo);
+        });
+        futures.emplace_back(future.share());
+    }
+    return futures;
+}
+}  // namespace
+
+Context::~Context() = default;
+
 void Context::initInstance(bool enableValidation,
                            const std::vector<const char*>& layers,
                            const std::vector<const char*>& instanceExtensions,
@@ -157,6 +222,8 @@ void Context::initDevice(const std::vector<const char*>& deviceExtensions,
     deviceInfo.setPEnabledFeatures(&deviceFeatures);
     deviceInfo.setPNext(deviceCreateInfoPNext);
     m_device = m_physicalDevice.createDeviceUnique(deviceInfo);
+    m_enabledDeviceExtensions.assign(deviceExtensions.begin(), deviceExtensions.end());
+    m_memoryProperties = m_physicalDevice.getMemoryProperties();
 
     spdlog::info("Enabled m_device extensions:");
     for (auto& extension : deviceExtensions) {
@@ -172,10 +239,15 @@ void Context::initDevice(const std::vector<const char*>& deviceExtensions,
             commandPoolCreateInfo.setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
             commandPoolCreateInfo.setQueueFamilyIndex(queueFamily);
             m_queues[flag][i].commandPool = m_device->createCommandPoolUnique(commandPoolCreateInfo);
+
+            vk::SemaphoreTypeCreateInfo semaphoreTypeInfo{vk::SemaphoreType::eTimeline, 0};
+            vk::SemaphoreCreateInfo semaphoreInfo;
+            semaphoreInfo.setPNext(&semaphoreTypeInfo);
+            m_queues[flag][i].timeline = m_device->createSemaphoreUnique(semaphoreInfo);
         }
     }
 
-    // Create descriptor pool
+    // Create descriptor pool for ImGui
     std::vector<vk::DescriptorPoolSize> poolSizes{
         {vk::DescriptorType::eSampler, 100},
         {vk::DescriptorType::eCombinedImageSampler, 100},
@@ -194,6 +266,47 @@ void Context::initDevice(const std::vector<const char*>& deviceExtensions,
     descriptorPoolCreateInfo.setMaxSets(100);
     descriptorPoolCreateInfo.setFlags(vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet);
     m_descriptorPool = m_device->createDescriptorPoolUnique(descriptorPoolCreateInfo);
+
+    // Create memory allocator
+    m_memoryAllocator = std::make_unique<MemoryAllocator>(*this);
+
+    // Create descriptor set layout cache
+    m_descriptorSetLayoutCache = std::make_unique<DescriptorSetLayoutCache>(*this);
+
+    // Create pipeline cache
+    // NOTE: App loads it from disk before any pipeline is created.
+    m_pipelineCache = std::make_unique<PipelineCache>(*this);
+
+    // Create pipeline registry
+    m_pipelineRegistry = std::make_unique<PipelineRegistry>(*this);
+
+    // Create descriptor allocator
+    // NOTE: Swapchain resizes its transient pools to the number of in-flight frames.
+    m_descriptorAllocator = std::make_unique<DescriptorAllocator>(*this);
+
+    // Create bindless heap
+    // NOTE: Optional. Resources created with `bindless = true` are registered only if it exists.
+    if (BindlessHeap::isSupported(deviceCreateInfoPNext)) {
+        m_bindlessHeap = std::make_unique<BindlessHeap>(*this);
+    }
+
+    // Create descriptor buffer
+    if (isDeviceExtensionEnabled(VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME)) {
+        m_descriptorBuffer = std::make_unique<DescriptorBuffer>(*this);
+    }
+
+    // Create upload ring
+    // NOTE: Swapchain resizes it to the number of in-flight frames.
+    m_uploadRing = std::make_unique<UploadRing>(*this);
+
+    // Create upload manager
+    m_uploadManager = std::make_unique<UploadManager>(*this);
+
+    // Create submit pool
+    m_submitPool = std::make_unique<SubmitPool>(*this);
+
+    // Create thread pool
+    m_threadPool = std::make_unique<ThreadPool>();
 }
 
 auto Context::getQueue(vk::QueueFlags flag) const -> vk::Queue {
@@ -224,56 +337,244 @@ void Context::submit(CommandBufferHandle commandBuffer,
                      vk::Semaphore waitSemaphore,
                      vk::Semaphore signalSemaphore,
                      FenceHandle fence) const {
-    vk::Queue queue = getThreadQueue(commandBuffer->getQueueFlags()).queue;
+    // NOTE: PipelineStageFlags2 has the same bits as PipelineStageFlags
+    vk::PipelineStageFlags2 waitStage2{static_cast<VkPipelineStageFlags>(waitStage)};
+    submit(commandBuffer, SemaphoreSubmit{waitSemaphore, 0, waitStage2},
+           SemaphoreSubmit{signalSemaphore}, fence);
+}
+
+void Context::submit(CommandBufferHandle commandBuffer, FenceHandle fence) const {
+    submit(commandBuffer, ArrayProxy<SemaphoreSubmit>{}, ArrayProxy<SemaphoreSubmit>{}, fence);
+}
+
+auto Context::submit(CommandBufferHandle commandBuffer,
+                     ArrayProxy<SemaphoreSubmit> waits,
+                     ArrayProxy<SemaphoreSubmit> signals,
+                     FenceHandle fence) const -> SemaphoreSubmit {
+    const ThreadQueue& threadQueue = getThreadQueue(commandBuffer->getQueueFlags());
+
+    std::vector<vk::SemaphoreSubmitInfo> waitInfos;
+    for (const auto& wait : waits) {
+        waitInfos.push_back({wait.semaphore, wait.value, wait.stageMask});
+    }
+
+    // Wait for uploads that the command buffer may read
+    UploadTicket uploadTicket = m_uploadManager->flush();
+    if (!m_uploadManager->isComplete(uploadTicket)) {
+        waitInfos.push_back({m_uploadManager->getSemaphore(), uploadTicket.value,
+                             vk::PipelineStageFlagBits2::eAllCommands});
+    }
+
+    std::vector<vk::SemaphoreSubmitInfo> signalInfos;
+    for (const auto& signal : signals) {
+        signalInfos.push_back({signal.semaphore, signal.value, signal.stageMask});
+    }
 
-    vk::SubmitInfo submitInfo;
-    submitInfo.setWaitDstStageMask(waitStage);
-    submitInfo.setCommandBuffers(*commandBuffer->m_commandBuffer);
-    submitInfo.setWaitSemaphores(waitSemaphore);
-    submitInfo.setSignalSemaphores(signalSemaphore);
+    // Advance the queue timeline
+    SemaphoreSubmit queuePoint{*threadQueue.timeline, ++threadQueue.timelineValue,
+                               vk::PipelineStageFlagBits2::eAllCommands};
+    signalInfos.push_back({queuePoint.semaphore, queuePoint.value, queuePoint.stageMask});
 
-    queue.submit(submitInfo, fence ? fence->getFence() : nullptr);
+    vk::CommandBufferSubmitInfo commandBufferInfo{*commandBuffer->m_commandBuffer};
+
+    vk::SubmitInfo2 submitInfo;
+    submitInfo.setWaitSemaphoreInfos(waitInfos);
+    submitInfo.setCommandBufferInfos(commandBufferInfo);
+    submitInfo.setSignalSemaphoreInfos(signalInfos);
+
+    threadQueue.queue.submit2(submitInfo, fence ? fence->getFence() : nullptr);
+    return queuePoint;
 }
 
-void Context::submit(CommandBufferHandle commandBuffer, FenceHandle fence) const {
-    vk::Queue queue = getThreadQueue(commandBuffer->getQueueFlags()).queue;
+auto Context::getQueueTimeline(vk::QueueFlags flag) const -> SemaphoreSubmit {
+    const ThreadQueue& threadQueue = getThreadQueue(flag);
+    return {*threadQueue.timeline, threadQueue.timelineValue};
+}
 
-    vk::SubmitInfo submitInfo;
-    submitInfo.setCommandBuffers(*commandBuffer->m_commandBuffer);
+void Context::waitSemaphore(const SemaphoreSubmit& point) const {
+    if (!point.semaphore || point.value == 0) {
+        return;
+    }
+    vk::SemaphoreWaitInfo waitInfo;
+    waitInfo.setSemaphores(point.semaphore);
+    waitInfo.setValues(point.value);
+    if (m_device->waitSemaphores(waitInfo, UINT64_MAX) != vk::Result::eSuccess) {
+        throw std::runtime_error("Failed to wait for semaphore");
+    }
+}
 
-    queue.submit(submitInfo, fence ? fence->getFence() : nullptr);
+auto Context::isSemaphoreSignaled(const SemaphoreSubmit& point) const -> bool {
+    if (!point.semaphore || point.value == 0) {
+        return true;
+    }
+    return m_device->getSemaphoreCounterValue(point.semaphore) >= point.value;
 }
 
 void Context::oneTimeSubmit(const std::function<void(CommandBufferHandle)>& command,
                             vk::QueueFlags flag) const {
-    CommandBufferHandle commandBuffer = allocateCommandBuffer(flag);
+    oneTimeSubmitAsync(command, flag).wait();
+}
+
+auto Context::oneTimeSubmitAsync(const std::function<void(CommandBufferHandle)>& command,
+                                 vk::QueueFlags flag) const -> SubmitFuture {
+    CommandBufferHandle commandBuffer = m_submitPool->acquireCommandBuffer(flag);
 
     commandBuffer->begin(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
     command(commandBuffer);
     commandBuffer->end();
 
-    submit(commandBuffer);
+    return m_submitPool->submit(commandBuffer);
+}
+
+void Context::beginFrame(uint32_t frameIndex) const {
+    m_uploadRing->beginFrame(frameIndex);
+    m_descriptorAllocator->beginFrame(frameIndex);
+    if (m_descriptorBuffer) {
+        m_descriptorBuffer->beginFrame(frameIndex);
+    }
+}
+
+void Context::collectGarbage() const {
+    m_submitPool->collect();
 
-    vk::Queue queue = getThreadQueue(commandBuffer->getQueueFlags()).queue;
-    queue.waitIdle();
+    // NOTE: The current slot is begun last so that later allocations keep using it
+    uint32_t frameCount = m_uploadRing->getFrameCount();
+    uint32_t currentIndex = m_uploadRing->getFrameIndex();
+    for (uint32_t i = 1; i <= frameCount; i++) {
+        beginFrame((currentIndex + i) % frameCount);
+    }
 }
 
 auto Context::findMemoryTypeIndex(vk::MemoryRequirements requirements,
                                   vk::MemoryPropertyFlags memoryProp) const -> uint32_t {
-    vk::PhysicalDeviceMemoryProperties memProperties = m_physicalDevice.getMemoryProperties();
-    for (uint32_t i = 0; i != memProperties.memoryTypeCount; ++i) {
-        if ((requirements.memoryTypeBits & (1 << i)) &&
-            (memProperties.memoryTypes[i].propertyFlags & memoryProp) == memoryProp) {
-            return i;
+    return findMemoryTypeIndex(requirements, getMemoryTypeRequest(memoryProp));
+}
+
+auto Context::findMemoryTypeIndex(vk::MemoryRequirements requirements,
+                                  const MemoryTypeRequest& request) const -> uint32_t {
+    auto countBits = [](vk::MemoryPropertyFlags flags) {
+        return std::popcount(static_cast<VkMemoryPropertyFlags>(flags));
+    };
+
+    // The first pass skips fallback heaps
+    for (int pass = 0; pass < 2; pass++) {
+        std::optional<uint32_t> bestIndex;
+        int bestScore = 0;
+        for (uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; i++) {
+            vk::MemoryPropertyFlags props = m_memoryProperties.memoryTypes[i].propertyFlags;
+            uint32_t heapIndex = m_memoryProperties.memoryTypes[i].heapIndex;
+            if (!(requirements.memoryTypeBits & (1u << i)) ||
+                (props & request.required) != request.required) {
+                continue;
+            }
+            if (pass == 0 && (request.fallbackHeapBits & (1u << heapIndex))) {
+                continue;
+            }
+
+            // Prefer exact matches: each unrequested flag costs a little
+            vk::MemoryPropertyFlags known = request.required | request.preferred | request.avoided;
+            int score = 4 * countBits(props & request.preferred)  //
+                        - 8 * countBits(props & request.avoided)  //
+                        - countBits(props & ~known);
+
+            // Don't fill small device-local heaps (e.g. 256 MB BAR) with large resources
+            vk::DeviceSize heapSize = m_memoryProperties.memoryHeaps[heapIndex].size;
+            if ((props & request.preferred & vk::MemoryPropertyFlagBits::eDeviceLocal) &&
+                requirements.size * 8 > heapSize) {
+                score -= 4;
+            }
+
+            if (!bestIndex || score > bestScore) {
+                bestIndex = i;
+                bestScore = score;
+            }
+        }
+        if (bestIndex) {
+            if (pass == 1) {
+                spdlog::debug("Memory type {} is selected from a fallback heap.", *bestIndex);
+            }
+            return *bestIndex;
+        }
+    }
+    throw std::runtime_error("Failed to find memory type index: " +
+                             vk::to_string(request.required));
+}
+
+auto Context::getMemoryTypeRequest(vk::MemoryPropertyFlags memoryProp) -> MemoryTypeRequest {
+    MemoryTypeRequest request;
+    request.required = memoryProp;
+    request.avoided = vk::MemoryPropertyFlagBits::eProtected |
+                      vk::MemoryPropertyFlagBits::eLazilyAllocated |
+                      vk::MemoryPropertyFlagBits::eHostCached;
+    request.avoided &= ~memoryProp;
+    return request;
+}
+
+auto Context::getMemoryTypeRequest(MemoryIntent intent) -> MemoryTypeRequest {
+    using Flag = vk::MemoryPropertyFlagBits;
+    MemoryTypeRequest request;
+    request.avoided = Flag::eProtected | Flag::eLazilyAllocated;
+    switch (intent) {
+        case MemoryIntent::GpuOnly: {
+            request.required = Flag::eDeviceLocal;
+            request.avoided |= Flag::eHostVisible;
+            break;
+        }
+        case MemoryIntent::Upload: {
+            // Keep device-local host-visible memory for Dynamic
+            request.required = Flag::eHostVisible | Flag::eHostCoherent;
+            request.avoided |= Flag::eHostCached | Flag::eDeviceLocal;
+            break;
+        }
+        case MemoryIntent::Readback: {
+            request.required = Flag::eHostVisible | Flag::eHostCoherent;
+            request.preferred = Flag::eHostCached;
+            break;
+        }
+        case MemoryIntent::Dynamic: {
+            // Resizable BAR if available
+            request.required = Flag::eHostVisible | Flag::eHostCoherent;
+            request.preferred = Flag::eDeviceLocal;
+            request.avoided |= Flag::eHostCached;
+            break;
         }
     }
-    throw std::runtime_error("Failed to find m_memory m_type index.");
+    return request;
+}
+
+auto Context::getMemoryStats() const -> MemoryStats {
+    return m_memoryAllocator->getMemoryStats();
+}
+
+void Context::setMemoryBudget(uint32_t heapIndex,
+                              vk::DeviceSize budget,
+                              MemoryBudgetPolicy policy) const {
+    m_memoryAllocator->setSoftBudget(heapIndex, budget, policy);
+}
+
+auto Context::getBindlessHeap() const -> BindlessHeap& {
+    RV_ASSERT(m_bindlessHeap, "BindlessHeap is not supported. Check hasBindlessHeap() first.");
+    return *m_bindlessHeap;
 }
 
 auto Context::getPhysicalDeviceLimits() const -> vk::PhysicalDeviceLimits {
     return m_physicalDevice.getProperties().limits;
 }
 
+auto Context::isDeviceExtensionSupported(const char* extensionName) const -> bool {
+    for (const auto& extension : m_physicalDevice.enumerateDeviceExtensionProperties()) {
+        if (std::strcmp(extension.extensionName, extensionName) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+auto Context::isDeviceExtensionEnabled(const char* extensionName) const -> bool {
+    return std::ranges::find(m_enabledDeviceExtensions, extensionName) !=
+           m_enabledDeviceExtensions.end();
+}
+
 auto Context::createShader(const ShaderCreateInfo& createInfo) const -> ShaderHandle {
     return std::make_shared<Shader>(*this, createInfo);
 }
@@ -285,22 +586,42 @@ auto Context::createDescriptorSet(const DescriptorSetCreateInfo& createInfo) con
 
 auto Context::createGraphicsPipeline(const GraphicsPipelineCreateInfo& createInfo) const
     -> GraphicsPipelineHandle {
-    return std::make_shared<GraphicsPipeline>(*this, createInfo);
+    return m_pipelineRegistry->getOrCreate(createInfo);
 }
 
 auto Context::createMeshShaderPipeline(const MeshShaderPipelineCreateInfo& createInfo) const
     -> MeshShaderPipelineHandle {
-    return std::make_shared<MeshShaderPipeline>(*this, createInfo);
+    return m_pipelineRegistry->getOrCreate(createInfo);
 }
 
 auto Context::createComputePipeline(const ComputePipelineCreateInfo& createInfo) const
     -> ComputePipelineHandle {
-    return std::make_shared<ComputePipeline>(*this, createInfo);
+    return m_pipelineRegistry->getOrCreate(createInfo);
 }
 
 auto Context::createRayTracingPipeline(const RayTracingPipelineCreateInfo& createInfo) const
     -> RayTracingPipelineHandle {
-    return std::make_shared<RayTracingPipeline>(*this, createInfo);
+    return m_pipelineRegistry->getOrCreate(createInfo);
+}
+
+auto Context::createPipelinesAsync(ArrayProxy<GraphicsPipelineCreateInfo> createInfos) const
+    -> std::vector<PipelineFuture<GraphicsPipeline>> {
+    return submitPipelines<GraphicsPipeline>(*this, createInfos);
+}
+
+auto Context::createPipelinesAsync(ArrayProxy<MeshShaderPipelineCreateInfo> createInfos) const
+    -> std::vector<PipelineFuture<MeshShaderPipeline>> {
+    return submitPipelines<MeshShaderPipeline>(*this, createInfos);
+}
+
+auto Context::createPipelinesAsync(ArrayProxy<ComputePipelineCreateInfo> createInfos) const
+    -> std::vector<PipelineFuture<ComputePipeline>> {
+    return submitPipelines<ComputePipeline>(*this, createInfos);
+}
+
+auto Context::createPipelinesAsync(ArrayProxy<RayTracingPipelineCreateInfo> createInfos) const
+    -> std::vector<PipelineFuture<RayTracingPipeline>> {
+    return submitPipelines<RayTracingPipeline>(*this, createInfos);
 }
 
 auto Context::createImage(const ImageCreateInfo& createInfo) const -> ImageHandle {
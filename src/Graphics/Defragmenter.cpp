@@ -0,0 +1,303 @@
+#include "reactive/Graphics/Defragmenter.hpp"
+
+#include "reactive/Graphics/BindlessHeap.hpp"
+#include "reactive/Graphics/Buffer.hpp"
+#include "reactive/Graphics/CommandBuffer.hpp"
+#include "reactive/Graphics/DescriptorSet.hpp"
+#include "reactive/Graphics/Image.hpp"
+#include "reactive/Graphics/UploadRing.hpp"
+
+namespace rv {
+namespace {
+// Old objects and memory of a moved resource.
+// Destroyed after the GPU has finished the copy.
+struct RetiredResource {
+    const Context* context = nullptr;
+    vk::Buffer buffer;
+    vk::Image image;
+    vk::ImageView view;
+    MemoryAllocation allocation;
+
+    ~RetiredResource() {
+        vk::Device device = context->getDevice();
+        if (view) {
+            device.destroyImageView(view);
+        }
+        if (image) {
+            device.destroyImage(image);
+        }
+        if (buffer) {
+            device.destroyBuffer(buffer);
+        }
+        context->getMemoryAllocator().free(allocation);
+    }
+};
+
+// Pending frames may still read the old slot through the heap, so a moved resource is
+// written to a fresh index. The old index is reused only after this frame retires.
+void renewBindlessIndex(const Context& context, BindlessType type, uint32_t& index) {
+    if (index == BindlessHeap::InvalidIndex) {
+        return;
+    }
+    BindlessHeap& heap = context.getBindlessHeap();
+    uint32_t newIndex = heap.allocate(type);
+    heap.free(type, index);
+    index = newIndex;
+}
+
+constexpr vk::BufferUsageFlags BufferTransferUsage =
+    vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst;
+constexpr vk::ImageUsageFlags ImageTransferUsage =
+    vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst;
+}  // namespace
+
+Defragmenter::Defragmenter(const Context& context) : m_context{&context} {}
+
+void Defragmenter::addBuffer(BufferHandle buffer) {
+    m_buffers.push_back(buffer);
+}
+
+void Defragmenter::addImage(ImageHandle image) {
+    m_images.push_back(image);
+}
+
+void Defragmenter::addDescriptorSet(DescriptorSetHandle descSet) {
+    m_descSets.push_back(descSet);
+}
+
+void Defragmenter::setMoveCallback(std::function<void(const DefragmentationMove&)> callback) {
+    m_moveCallback = std::move(callback);
+}
+
+auto Defragmenter::step(CommandBufferHandle commandBuffer, vk::DeviceSize maxSize)
+    -> vk::DeviceSize {
+    std::erase_if(m_buffers, [](const auto& buffer) { return buffer.expired(); });
+    std::erase_if(m_images, [](const auto& image) { return image.expired(); });
+
+    MemoryAllocator& allocator = m_context->getMemoryAllocator();
+    std::vector<const MemoryBlock*> sources = allocator.getDefragmentationSources();
+    if (sources.empty()) {
+        return 0;
+    }
+
+    auto isInSource = [&](const MemoryAllocation& allocation) {
+        return std::ranges::find(sources, allocation.block) != sources.end();
+    };
+
+    vk::DeviceSize movedSize = 0;
+    auto beginMove = [&]() {
+        // Make previous writes visible to the first copy
+        if (movedSize == 0) {
+            commandBuffer->memoryBarrier(vk::PipelineStageFlagBits::eAllCommands,
+                                         vk::PipelineStageFlagBits::eTransfer,
+                                         vk::AccessFlagBits::eMemoryWrite,
+                                         vk::AccessFlagBits::eTransferRead);
+        }
+    };
+
+    for (const auto& weakBuffer : m_buffers) {
+        if (movedSize >= maxSize) {
+            break;
+        }
+        BufferHandle buffer = weakBuffer.lock();
+        if (!isMovable(*buffer) || !isInSource(buffer->m_allocation)) {
+            continue;
+        }
+        std::optional<MemoryAllocation> allocation =
+            allocator.allocateForMove(buffer->m_allocation, sources);
+        if (!allocation) {
+            continue;
+        }
+        beginMove();
+        moveBuffer(commandBuffer, buffer, *allocation);
+        movedSize += allocation->size;
+    }
+
+    for (const auto& weakImage : m_images) {
+        if (movedSize >= maxSize) {
+            break;
+        }
+        ImageHandle image = weakImage.lock();
+        if (!isMovable(*image) || !isInSource(image->m_allocation)) {
+            continue;
+        }
+        std::optional<MemoryAllocation> allocation =
+            allocator.allocateForMove(image->m_allocation, sources);
+        if (!allocation) {
+            continue;
+        }
+        beginMove();
+        moveImage(commandBuffer, image, *allocation);
+        movedSize += allocation->size;
+    }
+
+    if (movedSize > 0) {
+        commandBuffer->memoryBarrier(
+            vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAllCommands,
+            vk::AccessFlagBits::eTransferWrite,
+            vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite);
+        spdlog::debug("Defragmenter: moved {} KB", movedSize / 1024);
+    }
+    m_stats.movedSize += movedSize;
+    return movedSize;
+}
+
+auto Defragmenter::isMovable(const Buffer& buffer) const -> bool {
+    // NOTE: Mapped buffers may be referenced by host pointers
+    return buffer.m_allocation.block && !buffer.m_mapped &&
+           (buffer.m_usage & BufferTransferUsage) == BufferTransferUsage;
+}
+
+auto Defragmenter::isMovable(const Image& image) const -> bool {
+    return image.m_hasOwnership && image.m_allocation.block && image.hasUniformLayout() &&
+           (image.m_usage & ImageTransferUsage) == ImageTransferUsage;
+}
+
+void Defragmenter::moveBuffer(CommandBufferHandle commandBuffer,
+                              BufferHandle buffer,
+                              const MemoryAllocation& allocation) {
+    vk::Device device = m_context->getDevice();
+    vk::BufferCreateInfo bufferInfo;
+    bufferInfo.setSize(buffer->m_size);
+    bufferInfo.setUsage(buffer->m_usage);
+    vk::UniqueBuffer newBuffer = device.createBufferUnique(bufferInfo);
+    device.bindBufferMemory(*newBuffer, allocation.memory, allocation.offset);
+    if (!buffer->m_debugName.empty()) {
+        m_context->setDebugName(*newBuffer, buffer->m_debugName.c_str());
+    }
+
+    vk::BufferCopy region{0, 0, buffer->m_size};
+    commandBuffer->flushBarriers();
+    commandBuffer->m_commandBuffer->copyBuffer(*buffer->m_buffer, *newBuffer, region);
+
+    bool hasAddress =
+        static_cast<bool>(buffer->m_usage & vk::BufferUsageFlagBits::eShaderDeviceAddress);
+    DefragmentationMove move{.buffer = buffer};
+    if (hasAddress) {
+        move.oldAddress = buffer->getAddress();
+    }
+
+    auto retired = std::make_shared<RetiredResource>();
+    retired->context = m_context;
+    retired->buffer = buffer->m_buffer.release();
+    retired->allocation = buffer->m_allocation;
+    m_context->getUploadRing().retire(retired);
+
+    buffer->m_buffer = std::move(newBuffer);
+    buffer->m_allocation = allocation;
+    renewBindlessIndex(*m_context, BindlessType::StorageBuffer, buffer->m_storageBufferIndex);
+    buffer->writeBindlessBuffer();
+    if (hasAddress) {
+        move.newAddress = buffer->getAddress();
+    }
+
+    updateDescriptorSets([&](DescriptorSet& descSet) {
+        return descSet.replaceBuffer(retired->buffer, buffer->getInfo());
+    });
+
+    m_stats.moveCount++;
+    if (m_moveCallback) {
+        m_moveCallback(move);
+    }
+}
+
+void Defragmenter::moveImage(CommandBufferHandle commandBuffer,
+                             ImageHandle image,
+                             const MemoryAllocation& allocation) {
+    vk::Device device = m_context->getDevice();
+    vk::ImageCreateInfo imageInfo;
+    imageInfo.setImageType(image->m_imageType);
+    imageInfo.setFormat(image->m_format);
+    imageInfo.setExtent(image->m_extent);
+    imageInfo.setMipLevels(image->m_mipLevels);
+    imageInfo.setSamples(vk::SampleCountFlagBits::e1);
+    imageInfo.setUsage(image->m_usage);
+    imageInfo.setArrayLayers(image->m_layerCount);
+    vk::Image newImage = device.createImage(imageInfo);
+    device.bindImageMemory(newImage, allocation.memory, allocation.offset);
+    if (!image->m_debugName.empty()) {
+        m_context->setDebugName(newImage, image->m_debugName.c_str());
+    }
+
+    // NOTE: Images without a view have no aspect
+    vk::ImageAspectFlags aspect =
+        image->m_aspect ? image->m_aspect : vk::ImageAspectFlags{vk::ImageAspectFlagBits::eColor};
+    vk::ImageSubresourceRange range{aspect, 0, image->m_mipLevels, 0, image->m_layerCount};
+    vk::ImageLayout layout = image->getLayout();
+
+    // Undefined contents don't need to be copied
+    if (layout != vk::ImageLayout::eUndefined) {
+        std::array<vk::ImageMemoryBarrier, 2> barriers;
+        barriers[0].setImage(image->m_image);
+        barriers[0].setOldLayout(layout);
+        barriers[0].setNewLayout(vk::ImageLayout::eTransferSrcOptimal);
+        barriers[0].setSrcAccessMask(vk::AccessFlagBits::eMemoryWrite);
+        barriers[0].setDstAccessMask(vk::AccessFlagBits::eTransferRead);
+        barriers[0].setSubresourceRange(range);
+        barriers[1].setImage(newImage);
+        barriers[1].setOldLayout(vk::ImageLayout::eUndefined);
+        barriers[1].setNewLayout(vk::ImageLayout::eTransferDstOptimal);
+        barriers[1].setDstAccessMask(vk::AccessFlagBits::eTransferWrite);
+        barriers[1].setSubresourceRange(range);
+        commandBuffer->imageBarrier(barriers, vk::PipelineStageFlagBits::eAllCommands,
+                                    vk::PipelineStageFlagBits::eTransfer);
+
+        std::vector<vk::ImageCopy> regions;
+        for (uint32_t mip = 0; mip < image->m_mipLevels; mip++) {
+            vk::ImageSubresourceLayers layers{aspect, mip, 0, image->m_layerCount};
+            vk::Extent3D extent{std::max(image->m_extent.width >> mip, 1u),
+                                std::max(image->m_extent.height >> mip, 1u),
+                                std::max(image->m_extent.depth >> mip, 1u)};
+            regions.push_back({layers, {0, 0, 0}, layers, {0, 0, 0}, extent});
+        }
+        commandBuffer->flushBarriers();
+        commandBuffer->m_commandBuffer->copyImage(
+            image->m_image, vk::ImageLayout::eTransferSrcOptimal, newImage,
+            vk::ImageLayout::eTransferDstOptimal, regions);
+
+        vk::ImageMemoryBarrier barrier;
+        barrier.setImage(newImage);
+        barrier.setOldLayout(vk::ImageLayout::eTransferDstOptimal);
+        barrier.setNewLayout(layout);
+        barrier.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite);
+        barrier.setDstAccessMask(vk::AccessFlagBits::eMemoryRead |
+                                 vk::AccessFlagBits::eMemoryWrite);
+        barrier.setSubresourceRange(range);
+        commandBuffer->imageBarrier(barrier, vk::PipelineStageFlagBits::eTransfer,
+                                    vk::PipelineStageFlagBits::eAllCommands);
+    }
+
+    auto retired = std::make_shared<RetiredResource>();
+    retired->context = m_context;
+    retired->image = image->m_image;
+    retired->view = image->m_view;
+    retired->allocation = image->m_allocation;
+    m_context->getUploadRing().retire(retired);
+
+    image->m_image = newImage;
+    image->m_allocation = allocation;
+    if (retired->view) {
+        renewBindlessIndex(*m_context, BindlessType::SampledImage, image->m_sampledImageIndex);
+        renewBindlessIndex(*m_context, BindlessType::StorageImage, image->m_storageImageIndex);
+        image->createImageView(image->m_viewType, image->m_aspect);
+        updateDescriptorSets([&](DescriptorSet& descSet) {
+            return descSet.replaceImage(retired->view, image->getInfo());
+        });
+    }
+
+    m_stats.moveCount++;
+    if (m_moveCallback) {
+        m_moveCallback({.image = image});
+    }
+}
+
+void Defragmenter::updateDescriptorSets(const std::function<bool(DescriptorSet&)>& replace) {
+    std::erase_if(m_descSets, [](const auto& descSet) { return descSet.expired(); });
+    for (const auto& weakDescSet : m_descSets) {
+        DescriptorSetHandle descSet = weakDescSet.lock();
+        if (replace(*descSet)) {
+            descSet->update();
+        }
+    }
+}
+}  // namespace rv
@@ -0,0 +1,207 @@
+#include "reactive/Graphics/DescriptorAllocator.hpp"
+
+#include "reactive/common.hpp"
+
+namespace rv {
+DescriptorAllocator::DescriptorAllocator(const Context& context) : m_context{&context} {
+    setFrameCount(1);
+}
+
+DescriptorAllocator::~DescriptorAllocator() {
+    vk::Device device = m_context->getDevice();
+    for (const auto& pool : m_pools) {
+        device.destroyDescriptorPool(pool.pool);
+    }
+    for (const auto& frame : m_frames) {
+        for (const auto& pool : frame.pools) {
+            device.destroyDescriptorPool(pool);
+        }
+    }
+}
+
+auto DescriptorAllocator::allocate(vk::DescriptorSetLayout layout,
+                                   ArrayProxy<vk::DescriptorSetLayoutBinding> bindings)
+    -> DescriptorAllocation {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    learn(bindings);
+
+    // NOTE: An empty pool can still fail for a different mix of descriptor types.
+    // No set of it will ever be freed, so it goes back to m_freePools below.
+    std::vector<uint32_t> emptyPools;
+    auto allocateFromCurrent = [&]() -> vk::DescriptorSet {
+        Pool& pool = m_pools[m_currentPool];
+        vk::DescriptorSet descSet = tryAllocate(pool.pool, layout);
+        if (descSet) {
+            pool.liveSetCount++;
+        } else if (pool.liveSetCount == 0) {
+            emptyPools.push_back(m_currentPool);
+        } else {
+            pool.full = true;
+        }
+        return descSet;
+    };
+
+    vk::DescriptorSet descSet;
+    if (m_currentPool < m_pools.size()) {
+        descSet = allocateFromCurrent();
+    }
+
+    // Reuse emptied pools before creating a new one
+    while (!descSet && !m_freePools.empty()) {
+        m_currentPool = m_freePools.back();
+        m_freePools.pop_back();
+        descSet = allocateFromCurrent();
+    }
+
+    if (!descSet) {
+        m_pools.push_back({createPool(bindings)});
+        m_currentPool = static_cast<uint32_t>(m_pools.size() - 1);
+        m_setsPerPool = std::min(m_setsPerPool * 2, MaxSetsPerPool);
+        spdlog::debug("DescriptorAllocator: created pool {}", m_currentPool);
+        descSet = allocateFromCurrent();
+    }
+
+    std::erase(emptyPools, m_currentPool);
+    m_freePools.insert(m_freePools.end(), emptyPools.begin(), emptyPools.end());
+    if (!descSet) {
+        throw std::runtime_error("Failed to allocate descriptor set.");
+    }
+    return {descSet, m_currentPool};
+}
+
+void DescriptorAllocator::free(const DescriptorAllocation& allocation) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    RV_ASSERT(allocation.pool < m_pools.size(), "Transient descriptor sets must not be freed.");
+
+    Pool& pool = m_pools[allocation.pool];
+    RV_ASSERT(pool.liveSetCount > 0, "Descriptor set is freed twice.");
+    pool.liveSetCount--;
+
+    // NOTE: Sets are not freed individually. The pool is reset once it is empty.
+    if (pool.liveSetCount == 0) {
+        m_context->getDevice().resetDescriptorPool(pool.pool);
+        pool.full = false;
+        if (allocation.pool != m_currentPool) {
+            m_freePools.push_back(allocation.pool);
+        }
+    }
+}
+
+auto DescriptorAllocator::allocateTransient(vk::DescriptorSetLayout layout,
+                                            ArrayProxy<vk::DescriptorSetLayoutBinding> bindings)
+    -> vk::DescriptorSet {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    learn(bindings);
+
+    Frame& frame = m_frames[m_frameIndex];
+    for (; frame.current < frame.pools.size(); frame.current++) {
+        if (vk::DescriptorSet descSet = tryAllocate(frame.pools[frame.current], layout)) {
+            frame.setCount++;
+            return descSet;
+        }
+    }
+
+    frame.pools.push_back(createPool(bindings));
+    m_setsPerPool = std::min(m_setsPerPool * 2, MaxSetsPerPool);
+    spdlog::debug("DescriptorAllocator: created transient pool {} for frame {}",
+                  frame.pools.size() - 1, m_frameIndex);
+
+    vk::DescriptorSet descSet = tryAllocate(frame.pools.back(), layout);
+    if (!descSet) {
+        throw std::runtime_error("Failed to allocate transient descriptor set.");
+    }
+    frame.setCount++;
+    return descSet;
+}
+
+void DescriptorAllocator::setFrameCount(uint32_t frameCount) {
+    RV_ASSERT(frameCount > 0, "frameCount must be greater than 0.");
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_frames.size() == frameCount) {
+        return;
+    }
+
+    vk::Device device = m_context->getDevice();
+    for (const auto& frame : m_frames) {
+        for (const auto& pool : frame.pools) {
+            device.destroyDescriptorPool(pool);
+        }
+    }
+    m_frames.clear();
+    m_frames.resize(frameCount);
+    m_frameIndex = 0;
+}
+
+void DescriptorAllocator::beginFrame(uint32_t frameIndex) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    RV_ASSERT(frameIndex < m_frames.size(), "frameIndex is out of range: {}", frameIndex);
+    m_frameIndex = frameIndex;
+
+    Frame& frame = m_frames[m_frameIndex];
+    for (const auto& pool : frame.pools) {
+        m_context->getDevice().resetDescriptorPool(pool);
+    }
+    frame.current = 0;
+    frame.setCount = 0;
+}
+
+auto DescriptorAllocator::getStats() const -> DescriptorAllocatorStats {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    DescriptorAllocatorStats stats;
+    stats.poolCount = static_cast<uint32_t>(m_pools.size());
+    for (const auto& pool : m_pools) {
+        stats.liveSetCount += pool.liveSetCount;
+    }
+    for (const auto& frame : m_frames) {
+        stats.transientPoolCount += static_cast<uint32_t>(frame.pools.size());
+        stats.transientSetCount += frame.setCount;
+    }
+    return stats;
+}
+
+void DescriptorAllocator::learn(ArrayProxy<vk::DescriptorSetLayoutBinding> bindings) {
+    for (const auto& binding : bindings) {
+        m_descriptorCounts[binding.descriptorType] += binding.descriptorCount;
+    }
+    m_setCount++;
+}
+
+auto DescriptorAllocator::createPool(ArrayProxy<vk::DescriptorSetLayoutBinding> bindings)
+    -> vk::DescriptorPool {
+    // At least the set that is being allocated must fit
+    std::map<vk::DescriptorType, uint32_t> requiredCounts;
+    for (const auto& binding : bindings) {
+        requiredCounts[binding.descriptorType] += binding.descriptorCount;
+    }
+
+    // Average descriptors per set * maxSets
+    std::vector<vk::DescriptorPoolSize> poolSizes;
+    for (const auto& [type, count] : m_descriptorCounts) {
+        uint64_t learnedCount = (count * m_setsPerPool + m_setCount - 1) / m_setCount;
+        uint32_t poolCount = static_cast<uint32_t>(
+            std::max<uint64_t>(learnedCount, requiredCounts.contains(type) ? requiredCounts[type] : 0));
+        if (poolCount > 0) {
+            poolSizes.push_back({type, poolCount});
+        }
+    }
+
+    vk::DescriptorPoolCreateInfo poolInfo;
+    poolInfo.setPoolSizes(poolSizes);
+    poolInfo.setMaxSets(m_setsPerPool);
+    return m_context->getDevice().createDescriptorPool(poolInfo);
+}
+
+auto DescriptorAllocator::tryAllocate(vk::DescriptorPool pool,
+                                      vk::DescriptorSetLayout layout) const -> vk::DescriptorSet {
+    vk::DescriptorSetAllocateInfo allocInfo{pool, layout};
+    vk::DescriptorSet descSet;
+    vk::Result result = m_context->getDevice().allocateDescriptorSets(&allocInfo, &descSet);
+    if (result == vk::Result::eErrorOutOfPoolMemory || result == vk::Result::eErrorFragmentedPool) {
+        return {};
+    }
+    if (result != vk::Result::eSuccess) {
+        throw std::runtime_error("Failed to allocate descriptor set: " + vk::to_string(result));
+    }
+    return descSet;
+}
+}  // namespace rv
@@ -0,0 +1,174 @@
+#include "reactive/Graphics/DescriptorBuffer.hpp"
+
+#include <cstring>
+
+#include "reactive/Graphics/Buffer.hpp"
+#include "reactive/Graphics/UploadRing.hpp"
+#include "reactive/common.hpp"
+
+namespace rv {
+namespace {
+auto alignUp(vk::DeviceSize value, vk::DeviceSize alignment) -> vk::DeviceSize {
+    return (value + alignment - 1) / alignment * alignment;
+}
+}  // namespace
+
+// Returns the range to the free list once the GPU no longer uses it
+struct DescriptorBuffer::RetiredRange {
+    DescriptorBuffer* descriptorBuffer = nullptr;
+    vk::DeviceSize offset;
+    vk::DeviceSize size;
+
+    ~RetiredRange() { descriptorBuffer->release(offset, size); }
+};
+
+DescriptorBuffer::DescriptorBuffer(const Context& context,
+                                   vk::DeviceSize persistentSize,
+                                   vk::DeviceSize frameSize)
+    : m_context{&context} {
+    m_props = m_context->getPhysicalDeviceProperties2<vk::PhysicalDeviceDescriptorBufferPropertiesEXT>();
+    m_persistentSize = alignUp(persistentSize, m_props.descriptorBufferOffsetAlignment);
+    m_frameSize = alignUp(frameSize, m_props.descriptorBufferOffsetAlignment);
+    m_freeRanges.emplace(0, m_persistentSize);
+
+    // NOTE: One buffer for both, since implementations may bind only one of each.
+    m_usage = vk::BufferUsageFlagBits::eResourceDescriptorBufferEXT |
+              vk::BufferUsageFlagBits::eSamplerDescriptorBufferEXT |
+              vk::BufferUsageFlagBits::eShaderDeviceAddress;
+    createBuffer(1);
+
+    spdlog::info("DescriptorBuffer: persistent {} bytes, {} bytes per frame", m_persistentSize,
+                 m_frameSize);
+}
+
+auto DescriptorBuffer::allocate(vk::DeviceSize size) -> DescriptorBufferAllocation {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size = alignUp(size, m_props.descriptorBufferOffsetAlignment);
+
+    // First fit
+    for (auto it = m_freeRanges.begin(); it != m_freeRanges.end(); ++it) {
+        auto [offset, rangeSize] = *it;
+        if (rangeSize < size) {
+            continue;
+        }
+        m_freeRanges.erase(it);
+        if (rangeSize > size) {
+            m_freeRanges.emplace(offset + size, rangeSize - size);
+        }
+        return {offset, size};
+    }
+    throw std::runtime_error("DescriptorBuffer is full: " + std::to_string(size) + " bytes requested.");
+}
+
+void DescriptorBuffer::free(const DescriptorBufferAllocation& allocation) {
+    if (allocation.size == 0) {
+        return;
+    }
+    auto retired = std::make_shared<RetiredRange>();
+    retired->descriptorBuffer = this;
+    retired->offset = allocation.offset;
+    retired->size = allocation.size;
+    m_context->getUploadRing().retire(retired);
+}
+
+void DescriptorBuffer::release(vk::DeviceSize offset, vk::DeviceSize size) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Merge with the neighbors
+    auto next = m_freeRanges.lower_bound(offset);
+    if (next != m_freeRanges.end() && offset + size == next->first) {
+        size += next->second;
+        next = m_freeRanges.erase(next);
+    }
+    if (next != m_freeRanges.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == offset) {
+            prev->second += size;
+            return;
+        }
+    }
+    m_freeRanges.emplace(offset, size);
+}
+
+auto DescriptorBuffer::allocateTransient(vk::DeviceSize size) -> DescriptorBufferAllocation {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size = alignUp(size, m_props.descriptorBufferOffsetAlignment);
+
+    vk::DeviceSize& head = m_frameHeads[m_frameIndex];
+    if (head + size > m_frameSize) {
+        throw std::runtime_error("DescriptorBuffer is full: frame segment of " +
+                                 std::to_string(m_frameSize) + " bytes.");
+    }
+    vk::DeviceSize offset = m_persistentSize + m_frameSize * m_frameIndex + head;
+    head += size;
+    return {offset, size};
+}
+
+void DescriptorBuffer::setFrameCount(uint32_t frameCount) {
+    RV_ASSERT(frameCount > 0, "frameCount must be greater than 0.");
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_frameHeads.size() == frameCount) {
+        return;
+    }
+    createBuffer(frameCount);
+}
+
+void DescriptorBuffer::beginFrame(uint32_t frameIndex) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    RV_ASSERT(frameIndex < m_frameHeads.size(), "frameIndex is out of range: {}", frameIndex);
+    m_frameIndex = frameIndex;
+    m_frameHeads[m_frameIndex] = 0;
+}
+
+auto DescriptorBuffer::getDescriptorSize(vk::DescriptorType type) const -> size_t {
+    // NOTE: robustBufferAccess is not enabled, so the non-robust sizes are used
+    switch (type) {
+        case vk::DescriptorType::eSampler:
+            return m_props.samplerDescriptorSize;
+        case vk::DescriptorType::eCombinedImageSampler:
+            return m_props.combinedImageSamplerDescriptorSize;
+        case vk::DescriptorType::eSampledImage:
+            return m_props.sampledImageDescriptorSize;
+        case vk::DescriptorType::eStorageImage:
+            return m_props.storageImageDescriptorSize;
+        case vk::DescriptorType::eUniformBuffer:
+            return m_props.uniformBufferDescriptorSize;
+        case vk::DescriptorType::eStorageBuffer:
+            return m_props.storageBufferDescriptorSize;
+        case vk::DescriptorType::eAccelerationStructureKHR:
+            return m_props.accelerationStructureDescriptorSize;
+        default:
+            throw std::runtime_error("Unsupported descriptor type: " + vk::to_string(type));
+    }
+}
+
+auto DescriptorBuffer::getBindingInfo() const -> vk::DescriptorBufferBindingInfoEXT {
+    return {m_buffer->getAddress(), m_usage};
+}
+
+void DescriptorBuffer::createBuffer(uint32_t frameCount) {
+    vk::DeviceSize size = m_persistentSize + m_frameSize * frameCount;
+    if (size > m_props.resourceDescriptorBufferAddressSpaceSize ||
+        size > m_props.samplerDescriptorBufferAddressSpaceSize) {
+        throw std::runtime_error("DescriptorBuffer exceeds the descriptor buffer address space.");
+    }
+
+    BufferHandle buffer = m_context->createBuffer({
+        .usage = m_usage,
+        .memory = MemoryIntent::Dynamic,
+        .size = size,
+        .debugName = "DescriptorBuffer",
+    });
+    auto* mapped = static_cast<uint8_t*>(buffer->map());
+
+    // Persistent sets keep their offsets
+    if (m_buffer) {
+        std::memcpy(mapped, m_mapped, m_persistentSize);
+    }
+
+    m_buffer = buffer;
+    m_mapped = mapped;
+    m_frameHeads.assign(frameCount, 0);
+    m_frameIndex = 0;
+}
+}  // namespace rv
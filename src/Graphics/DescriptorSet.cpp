@@ -1,175 +1,395 @@
 #include "reactive/Graphics/DescriptorSet.hpp"
 
-#include <ranges>
 #include <stdexcept>
 #include <vector>
 
 #include "reactive/common.hpp"
 #include "reactive/Graphics/Accel.hpp"
 #include "reactive/Graphics/Buffer.hpp"
+#include "reactive/Graphics/DescriptorSetLayoutCache.hpp"
 
 namespace rv {
 
 DescriptorSet::DescriptorSet(const Context& context, const DescriptorSetCreateInfo& createInfo)
-    : m_context{&context} {
+    : m_context{&context}, m_set{createInfo.set} {
     // シェーダーリソースを追加
     for (const auto& shader : createInfo.shaders) {
         addResources(shader);
     }
 
+    // 動的オフセットで使うバッファ
+    for (const auto& [name, range] : createInfo.dynamicBuffers) {
+        setDynamic(getSlot(name), range);
+    }
+
     // 各リソースのディスクリプタ情報を設定
     for (const auto& [name, buffers] : createInfo.buffers) {
-        RV_ASSERT(m_descriptors.contains(name), "Unknown buffer name({}). Resource name must match the name on the shader.", name);
+        RV_ASSERT(m_slots.contains(name), "Unknown buffer name({}). Resource name must match the name on the shader.", name);
+        uint32_t slot = getSlot(name);
         if (std::holds_alternative<uint32_t>(buffers)) {
-            m_descriptors[name].binding.setDescriptorCount(std::get<uint32_t>(buffers));
+            m_descriptors[slot].binding.setDescriptorCount(std::get<uint32_t>(buffers));
         } else {
-            set(name, std::get<ArrayProxy<BufferHandle>>(buffers));
+            set(slot, std::get<ArrayProxy<BufferHandle>>(buffers));
         }
     }
     for (const auto& [name, images] : createInfo.images) {
-        RV_ASSERT(m_descriptors.contains(name), "Unknown image name({}). Resource name must match the name on the shader.", name);
+        RV_ASSERT(m_slots.contains(name), "Unknown image name({}). Resource name must match the name on the shader.", name);
+        uint32_t slot = getSlot(name);
         if (std::holds_alternative<uint32_t>(images)) {
-            m_descriptors[name].binding.setDescriptorCount(std::get<uint32_t>(images));
+            m_descriptors[slot].binding.setDescriptorCount(std::get<uint32_t>(images));
         } else {
-            set(name, std::get<ArrayProxy<ImageHandle>>(images));
+            set(slot, std::get<ArrayProxy<ImageHandle>>(images));
         }
     }
     for (const auto& [name, accels] : createInfo.accels) {
-        RV_ASSERT(m_descriptors.contains(name), "Unknown accel name({}). Resource name must match the name on the shader.", name);
+        RV_ASSERT(m_slots.contains(name), "Unknown accel name({}). Resource name must match the name on the shader.", name);
+        uint32_t slot = getSlot(name);
         if (std::holds_alternative<uint32_t>(accels)) {
-            m_descriptors[name].binding.setDescriptorCount(std::get<uint32_t>(accels));
+            m_descriptors[slot].binding.setDescriptorCount(std::get<uint32_t>(accels));
         } else {
-            set(name, std::get<ArrayProxy<TopAccelHandle>>(accels));
+            set(slot, std::get<ArrayProxy<TopAccelHandle>>(accels));
         }
     }
 
     // ディスクリプタセットレイアウトを作成
     std::vector<vk::DescriptorSetLayoutBinding> bindings;
-    for (const auto& descriptor : m_descriptors | std::views::values) {
+    for (const auto& descriptor : m_descriptors) {
         bindings.push_back(descriptor.binding);
+        vk::DescriptorType type = descriptor.binding.descriptorType;
+        if (type == vk::DescriptorType::eUniformBufferDynamic ||
+            type == vk::DescriptorType::eStorageBufferDynamic) {
+            m_dynamicOffsetCount += descriptor.binding.descriptorCount;
+        }
+    }
+
+    m_transient = createInfo.transient;
+    m_push = createInfo.push;
+    if (m_push) {
+        if (!m_context->isDeviceExtensionEnabled(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME)) {
+            throw std::runtime_error("Push descriptor sets require Extension::PushDescriptor.");
+        }
+        if (m_context->hasDescriptorBuffer()) {
+            throw std::runtime_error("Push descriptor sets are not supported with the descriptor buffer backend.");
+        }
+        m_descSetLayout = m_context->getDescriptorSetLayoutCache().getOrCreate(
+            bindings, vk::DescriptorSetLayoutCreateFlagBits::ePushDescriptorKHR);
+        return;
+    }
+
+    m_descriptorBuffer = m_context->hasDescriptorBuffer();
+    if (m_descriptorBuffer) {
+        if (m_dynamicOffsetCount > 0) {
+            throw std::runtime_error("Dynamic buffers are not supported with the descriptor buffer backend.");
+        }
+        // ディスクリプタバッファ上に領域を確保
+        vk::Device device = m_context->getDevice();
+        m_descSetLayout = m_context->getDescriptorSetLayoutCache().getOrCreate(
+            bindings, vk::DescriptorSetLayoutCreateFlagBits::eDescriptorBufferEXT);
+        for (auto& descriptor : m_descriptors) {
+            descriptor.bufferOffset =
+                device.getDescriptorSetLayoutBindingOffsetEXT(m_descSetLayout, descriptor.binding.binding);
+        }
+
+        DescriptorBuffer& descriptorBuffer = m_context->getDescriptorBuffer();
+        vk::DeviceSize size = device.getDescriptorSetLayoutSizeEXT(m_descSetLayout);
+        if (m_transient) {
+            m_bufferAllocation = descriptorBuffer.allocateTransient(size);
+        } else {
+            m_bufferAllocation = descriptorBuffer.allocate(size);
+        }
+        return;
     }
 
-    vk::DescriptorSetLayoutCreateInfo layoutInfo({}, bindings);
-    m_descSetLayout = m_context->getDevice().createDescriptorSetLayoutUnique(layoutInfo);
+    m_descSetLayout = m_context->getDescriptorSetLayoutCache().getOrCreate(bindings);
 
     // ディスクリプタセットを確保
-    vk::DescriptorSetAllocateInfo allocInfo(m_context->getDescriptorPool(), *m_descSetLayout);
-    m_descSet = std::move(m_context->getDevice().allocateDescriptorSetsUnique(allocInfo).front());
+    DescriptorAllocator& allocator = m_context->getDescriptorAllocator();
+    if (m_transient) {
+        m_allocation.descSet = allocator.allocateTransient(m_descSetLayout, bindings);
+    } else {
+        m_allocation = allocator.allocate(m_descSetLayout, bindings);
+    }
+}
+
+DescriptorSet::~DescriptorSet() {
+    if (m_transient || m_push) {
+        return;
+    }
+    if (m_descriptorBuffer) {
+        m_context->getDescriptorBuffer().free(m_bufferAllocation);
+    } else {
+        m_context->getDescriptorAllocator().free(m_allocation);
+    }
 }
 
 void DescriptorSet::update() {
-    std::vector<vk::WriteDescriptorSet> descriptorWrites;
-
-    for (const auto& [binding, infos] : m_descriptors | std::views::values) {
-        if (std::holds_alternative<BufferInfos>(infos)) {
-            const auto& bufferInfos = std::get<BufferInfos>(infos);
-            vk::WriteDescriptorSet descriptorWrite;
-            descriptorWrite.setBufferInfo(bufferInfos);
-            descriptorWrite.setDescriptorCount(static_cast<uint32_t>(bufferInfos.size()));
-            descriptorWrite.setDescriptorType(binding.descriptorType);
-            descriptorWrite.setDstBinding(binding.binding);
-            descriptorWrite.setDstSet(*m_descSet);
-            descriptorWrites.push_back(descriptorWrite);
-        } else if (std::holds_alternative<ImageInfos>(infos)) {
-            const auto& imageInfos = std::get<ImageInfos>(infos);
-            vk::WriteDescriptorSet descriptorWrite;
-            descriptorWrite.setImageInfo(imageInfos);
-            descriptorWrite.setDescriptorCount(static_cast<uint32_t>(imageInfos.size()));
-            descriptorWrite.setDescriptorType(binding.descriptorType);
-            descriptorWrite.setDstBinding(binding.binding);
-            descriptorWrite.setDstSet(*m_descSet);
-            descriptorWrites.push_back(descriptorWrite);
-        } else if (std::holds_alternative<AccelInfos>(infos)) {
-            const auto& accelInfos = std::get<AccelInfos>(infos);
-            vk::WriteDescriptorSet descriptorWrite;
-            descriptorWrite.setDescriptorCount(static_cast<uint32_t>(accelInfos.size()));
-            descriptorWrite.setDescriptorType(binding.descriptorType);
-            descriptorWrite.setDstBinding(binding.binding);
-            descriptorWrite.setDstSet(*m_descSet);
-            descriptorWrite.setPNext(accelInfos.data());
-            descriptorWrites.push_back(descriptorWrite);
-        }
-    }
-
-    m_context->getDevice().updateDescriptorSets(descriptorWrites, nullptr);
+    // 変更されたバインディングのみ書き込む
+    m_writes.clear();
+    for (uint32_t slot : m_dirtySlots) {
+        Descriptor& descriptor = m_descriptors[slot];
+        descriptor.dirty = false;
+        if (m_push) {
+            // NOTE: Recorded by CommandBuffer::pushDescriptorSet()
+            continue;
+        }
+        if (m_descriptorBuffer) {
+            writeDescriptorBuffer(descriptor);
+            continue;
+        }
+
+        vk::WriteDescriptorSet descriptorWrite = makeWrite(descriptor);
+        descriptorWrite.setDstSet(m_allocation.descSet);
+        if (descriptorWrite.descriptorCount > 0) {
+            m_writes.push_back(descriptorWrite);
+        }
+    }
+    m_dirtySlots.clear();
+
+    if (!m_writes.empty()) {
+        m_context->getDevice().updateDescriptorSets(m_writes, nullptr);
+    }
+}
+
+auto DescriptorSet::getPushWrites() -> const std::vector<vk::WriteDescriptorSet>& {
+    RV_ASSERT(m_push, "getPushWrites() is only for push descriptor sets.");
+    m_writes.clear();
+    for (const auto& descriptor : m_descriptors) {
+        vk::WriteDescriptorSet descriptorWrite = makeWrite(descriptor);
+        if (descriptorWrite.descriptorCount > 0) {
+            m_writes.push_back(descriptorWrite);
+        }
+    }
+    return m_writes;
+}
+
+auto DescriptorSet::makeWrite(const Descriptor& descriptor) const -> vk::WriteDescriptorSet {
+    const auto& binding = descriptor.binding;
+    vk::WriteDescriptorSet descriptorWrite;
+    descriptorWrite.setDescriptorType(binding.descriptorType);
+    descriptorWrite.setDstBinding(binding.binding);
+    if (const auto* bufferInfos = std::get_if<BufferInfos>(&descriptor.infos)) {
+        descriptorWrite.setBufferInfo(*bufferInfos);
+        descriptorWrite.setDescriptorCount(static_cast<uint32_t>(bufferInfos->size()));
+    } else if (const auto* imageInfos = std::get_if<ImageInfos>(&descriptor.infos)) {
+        descriptorWrite.setImageInfo(*imageInfos);
+        descriptorWrite.setDescriptorCount(static_cast<uint32_t>(imageInfos->size()));
+    } else if (const auto* accelInfos = std::get_if<AccelInfos>(&descriptor.infos)) {
+        descriptorWrite.setDescriptorCount(static_cast<uint32_t>(accelInfos->size()));
+        descriptorWrite.setPNext(accelInfos->data());
+    }
+    return descriptorWrite;
+}
+
+auto DescriptorSet::getSlot(const std::string& name) const -> uint32_t {
+    auto it = m_slots.find(name);
+    if (it == m_slots.end()) {
+        throw std::runtime_error("Unknown resource name(" + name + "). Resource name must match the name on the shader.");
+    }
+    return it->second;
 }
 
 void DescriptorSet::set(const std::string& name, ArrayProxy<BufferHandle> buffers) {
+    set(getSlot(name), buffers);
+}
+
+void DescriptorSet::set(const std::string& name, ArrayProxy<ImageHandle> images) {
+    set(getSlot(name), images);
+}
+
+void DescriptorSet::set(const std::string& name, ArrayProxy<TopAccelHandle> accels) {
+    set(getSlot(name), accels);
+}
+
+void DescriptorSet::set(uint32_t slot, ArrayProxy<BufferHandle> buffers) {
     // バッファのディスクリプタ情報を設定
-    std::vector<vk::DescriptorBufferInfo> bufferInfos;
+    RV_ASSERT(slot < m_descriptors.size(), "slot is out of range: {}", slot);
+    Descriptor& descriptor = m_descriptors[slot];
+    if (!std::holds_alternative<BufferInfos>(descriptor.infos)) {
+        descriptor.infos = BufferInfos{};
+    }
+    // NOTE: Reuse the storage of the previous infos
+    auto& bufferInfos = std::get<BufferInfos>(descriptor.infos);
+    bufferInfos.clear();
     for (const auto& buffer : buffers) {
         bufferInfos.push_back(buffer->getInfo());
+        if (descriptor.dynamicRange) {
+            bufferInfos.back().setRange(descriptor.dynamicRange);
+        }
     }
-    m_descriptors[name].binding.descriptorCount = buffers.size();
-    m_descriptors[name].infos = bufferInfos;
+    descriptor.binding.descriptorCount = buffers.size();
+    markDirty(slot);
 }
 
-void DescriptorSet::set(const std::string& name, ArrayProxy<ImageHandle> images) {
+void DescriptorSet::set(uint32_t slot, ArrayProxy<ImageHandle> images) {
     // イメージのディスクリプタ情報を設定
-    ImageInfos imageInfos;
+    RV_ASSERT(slot < m_descriptors.size(), "slot is out of range: {}", slot);
+    Descriptor& descriptor = m_descriptors[slot];
+    if (!std::holds_alternative<ImageInfos>(descriptor.infos)) {
+        descriptor.infos = ImageInfos{};
+    }
+    auto& imageInfos = std::get<ImageInfos>(descriptor.infos);
+    imageInfos.clear();
     for (const auto& image : images) {
         imageInfos.push_back(image->getInfo());
     }
-    m_descriptors[name].binding.descriptorCount = images.size();
-    m_descriptors[name].infos = imageInfos;
+    descriptor.binding.descriptorCount = images.size();
+    markDirty(slot);
 }
 
-void DescriptorSet::set(const std::string& name, ArrayProxy<TopAccelHandle> accels) {
+void DescriptorSet::set(uint32_t slot, ArrayProxy<TopAccelHandle> accels) {
     // アクセラレーション構造のディスクリプタ情報を設定
-    AccelInfos accelInfos;
+    RV_ASSERT(slot < m_descriptors.size(), "slot is out of range: {}", slot);
+    Descriptor& descriptor = m_descriptors[slot];
+    if (!std::holds_alternative<AccelInfos>(descriptor.infos)) {
+        descriptor.infos = AccelInfos{};
+    }
+    auto& accelInfos = std::get<AccelInfos>(descriptor.infos);
+    accelInfos.clear();
     for (const auto& accel : accels) {
         accelInfos.push_back(accel->getInfo());
     }
-    m_descriptors[name].binding.descriptorCount = accels.size();
-    m_descriptors[name].infos = accelInfos;
+    descriptor.binding.descriptorCount = accels.size();
+    markDirty(slot);
 }
 
-void DescriptorSet::addResources(ShaderHandle shader) {
-    // シェーダーリソースを解析してディスクリプタ情報を更新
-    vk::ShaderStageFlags stage = shader->getStage();
-    SpvReflectShaderModule module;
-    SpvReflectResult result = spvReflectCreateShaderModule(shader->getSpvCodeSize(), shader->getSpvCodePtr(), &module);
-    if (result != SPV_REFLECT_RESULT_SUCCESS) {
-        throw std::runtime_error("Failed to create SPIRV-Reflect m_shader module.");
+void DescriptorSet::writeDescriptorBuffer(const Descriptor& descriptor) const {
+    // vkGetDescriptorEXT でバッファに直接書き込む
+    vk::Device device = m_context->getDevice();
+    const DescriptorBuffer& descriptorBuffer = m_context->getDescriptorBuffer();
+    vk::DescriptorType type = descriptor.binding.descriptorType;
+    size_t descriptorSize = descriptorBuffer.getDescriptorSize(type);
+    auto* dst = static_cast<uint8_t*>(
+        descriptorBuffer.getMapped(m_bufferAllocation.offset + descriptor.bufferOffset));
+
+    vk::DescriptorGetInfoEXT getInfo;
+    getInfo.setType(type);
+    if (const auto* bufferInfos = std::get_if<BufferInfos>(&descriptor.infos)) {
+        for (size_t i = 0; i < bufferInfos->size(); i++) {
+            const auto& bufferInfo = (*bufferInfos)[i];
+            vk::DescriptorAddressInfoEXT addressInfo;
+            addressInfo.setAddress(device.getBufferAddress({bufferInfo.buffer}) + bufferInfo.offset);
+            addressInfo.setRange(bufferInfo.range);
+            if (type == vk::DescriptorType::eUniformBuffer) {
+                getInfo.data.setPUniformBuffer(&addressInfo);
+            } else {
+                getInfo.data.setPStorageBuffer(&addressInfo);
+            }
+            device.getDescriptorEXT(getInfo, descriptorSize, dst + i * descriptorSize);
+        }
+    } else if (const auto* imageInfos = std::get_if<ImageInfos>(&descriptor.infos)) {
+        for (size_t i = 0; i < imageInfos->size(); i++) {
+            const auto& imageInfo = (*imageInfos)[i];
+            switch (type) {
+                case vk::DescriptorType::eSampler:
+                    getInfo.data.setPSampler(&imageInfo.sampler);
+                    break;
+                case vk::DescriptorType::eCombinedImageSampler:
+                    getInfo.data.setPCombinedImageSampler(&imageInfo);
+                    break;
+                case vk::DescriptorType::eSampledImage:
+                    getInfo.data.setPSampledImage(&imageInfo);
+                    break;
+                default:
+                    getInfo.data.setPStorageImage(&imageInfo);
+                    break;
+            }
+            device.getDescriptorEXT(getInfo, descriptorSize, dst + i * descriptorSize);
+        }
+    } else if (const auto* accelInfos = std::get_if<AccelInfos>(&descriptor.infos)) {
+        for (size_t i = 0; i < accelInfos->size(); i++) {
+            getInfo.data.setAccelerationStructure(device.getAccelerationStructureAddressKHR(
+                {(*accelInfos)[i].pAccelerationStructures[0]}));
+            device.getDescriptorEXT(getInfo, descriptorSize, dst + i * descriptorSize);
+        }
     }
+}
 
-    uint32_t count = 0;
-    result = spvReflectEnumerateDescriptorBindings(&module, &count, nullptr);
-    if (result != SPV_REFLECT_RESULT_SUCCESS) {
-        spvReflectDestroyShaderModule(&module);
-        throw std::runtime_error("Failed to enumerate descriptor bindings.");
+void DescriptorSet::setDynamic(uint32_t slot, vk::DeviceSize range) {
+    Descriptor& descriptor = m_descriptors[slot];
+    switch (descriptor.binding.descriptorType) {
+        case vk::DescriptorType::eUniformBuffer:
+            descriptor.binding.descriptorType = vk::DescriptorType::eUniformBufferDynamic;
+            break;
+        case vk::DescriptorType::eStorageBuffer:
+            descriptor.binding.descriptorType = vk::DescriptorType::eStorageBufferDynamic;
+            break;
+        default:
+            throw std::runtime_error("Dynamic offsets are only for uniform and storage buffers.");
     }
+    descriptor.dynamicRange = range;
+}
 
-    std::vector<SpvReflectDescriptorBinding*> bindings(count);
-    result = spvReflectEnumerateDescriptorBindings(&module, &count, bindings.data());
-    if (result != SPV_REFLECT_RESULT_SUCCESS) {
-        spvReflectDestroyShaderModule(&module);
-        throw std::runtime_error("Failed to enumerate descriptor bindings.");
+void DescriptorSet::markDirty(uint32_t slot) {
+    if (!m_descriptors[slot].dirty) {
+        m_descriptors[slot].dirty = true;
+        m_dirtySlots.push_back(slot);
     }
+}
 
-    for (const auto* binding : bindings) {
-        updateBindingMap(binding, stage);
+auto DescriptorSet::replaceBuffer(vk::Buffer oldBuffer, const vk::DescriptorBufferInfo& newInfo)
+    -> bool {
+    bool replaced = false;
+    for (uint32_t slot = 0; slot < m_descriptors.size(); slot++) {
+        if (auto* bufferInfos = std::get_if<BufferInfos>(&m_descriptors[slot].infos)) {
+            for (auto& bufferInfo : *bufferInfos) {
+                if (bufferInfo.buffer == oldBuffer) {
+                    bufferInfo = newInfo;
+                    markDirty(slot);
+                    replaced = true;
+                }
+            }
+        }
     }
+    return replaced;
+}
 
-    spvReflectDestroyShaderModule(&module);
+auto DescriptorSet::replaceImage(vk::ImageView oldView, const vk::DescriptorImageInfo& newInfo)
+    -> bool {
+    bool replaced = false;
+    for (uint32_t slot = 0; slot < m_descriptors.size(); slot++) {
+        if (auto* imageInfos = std::get_if<ImageInfos>(&m_descriptors[slot].infos)) {
+            for (auto& imageInfo : *imageInfos) {
+                if (imageInfo.imageView == oldView) {
+                    // NOTE: Keep the layout this set was written with
+                    imageInfo.imageView = newInfo.imageView;
+                    imageInfo.sampler = newInfo.sampler;
+                    markDirty(slot);
+                    replaced = true;
+                }
+            }
+        }
+    }
+    return replaced;
+}
+
+void DescriptorSet::addResources(ShaderHandle shader) {
+    // シェーダーのリフレクション結果からディスクリプタ情報を更新
+    for (const auto& binding : shader->getBindings()) {
+        // NOTE: Other sets (e.g. BindlessHeap) are not owned by this set
+        if (binding.set == m_set) {
+            updateBindingMap(binding);
+        }
+    }
 }
 
-void DescriptorSet::updateBindingMap(const SpvReflectDescriptorBinding* binding, vk::ShaderStageFlags stage) {
-    const std::string& name = binding->name;
-    if (m_descriptors.contains(name)) {
-        auto& desc_binding = m_descriptors[name].binding;
-        if (desc_binding.binding != binding->binding) {
+void DescriptorSet::updateBindingMap(const ShaderBinding& binding) {
+    const std::string& name = binding.name;
+    if (m_slots.contains(name)) {
+        auto& desc_binding = m_descriptors[m_slots[name]].binding;
+        if (desc_binding.binding != binding.binding.binding) {
             throw std::runtime_error("binding does not match.");
         }
-        desc_binding.stageFlags |= stage;
+        desc_binding.stageFlags |= binding.binding.stageFlags;
     } else {
-        m_descriptors[name] = {
-            .binding = vk::DescriptorSetLayoutBinding()
-                           .setBinding(binding->binding)
-                           .setDescriptorType(static_cast<vk::DescriptorType>(binding->descriptor_type))
-                           .setDescriptorCount(binding->count)
-                           .setStageFlags(stage),
-        };
+        for (const auto& descriptor : m_descriptors) {
+            RV_ASSERT(descriptor.binding.binding != binding.binding.binding,
+                      "Binding {} of set {} is used by two resources ({}).",
+                      binding.binding.binding, m_set, name);
+        }
+        m_slots[name] = static_cast<uint32_t>(m_descriptors.size());
+        m_descriptors.push_back({
+            .binding = binding.binding,
+        });
     }
 }
 }  // namespace rv
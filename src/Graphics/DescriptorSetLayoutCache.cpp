@@ -0,0 +1,59 @@
+#include "reactive/Graphics/DescriptorSetLayoutCache.hpp"
+
+#include <algorithm>
+
+#include "reactive/common.hpp"
+
+namespace rv {
+namespace {
+auto isSameBinding(const vk::DescriptorSetLayoutBinding& a, const vk::DescriptorSetLayoutBinding& b)
+    -> bool {
+    return a.binding == b.binding && a.descriptorType == b.descriptorType &&
+           a.descriptorCount == b.descriptorCount && a.stageFlags == b.stageFlags;
+}
+}  // namespace
+
+DescriptorSetLayoutCache::DescriptorSetLayoutCache(const Context& context)
+    : m_context{&context} {}
+
+auto DescriptorSetLayoutCache::getOrCreate(ArrayProxy<vk::DescriptorSetLayoutBinding> bindings,
+                                           vk::DescriptorSetLayoutCreateFlags flags)
+    -> vk::DescriptorSetLayout {
+    std::vector<vk::DescriptorSetLayoutBinding> sorted{bindings.begin(), bindings.end()};
+    std::ranges::sort(sorted, {}, &vk::DescriptorSetLayoutBinding::binding);
+
+    size_t hash = 0;
+    hashCombine(hash, static_cast<uint32_t>(flags));
+    for (const auto& binding : sorted) {
+        RV_ASSERT(!binding.pImmutableSamplers, "Immutable samplers are not supported by the cache.");
+        hashCombine(hash, binding.binding);
+        hashCombine(hash, static_cast<uint32_t>(binding.descriptorType));
+        hashCombine(hash, binding.descriptorCount);
+        hashCombine(hash, static_cast<uint32_t>(binding.stageFlags));
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& entries = m_layouts[hash];
+    for (const auto& entry : entries) {
+        if (entry.flags == flags &&
+            std::ranges::equal(entry.bindings, sorted, isSameBinding)) {
+            return *entry.layout;
+        }
+    }
+
+    vk::DescriptorSetLayoutCreateInfo layoutInfo;
+    layoutInfo.setFlags(flags);
+    layoutInfo.setBindings(sorted);
+    vk::UniqueDescriptorSetLayout layout =
+        m_context->getDevice().createDescriptorSetLayoutUnique(layoutInfo);
+    vk::DescriptorSetLayout handle = *layout;
+    entries.push_back({flags, std::move(sorted), std::move(layout)});
+    m_layoutCount++;
+    return handle;
+}
+
+auto DescriptorSetLayoutCache::getLayoutCount() const -> uint32_t {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_layoutCount;
+}
+}  // namespace rv
@@ -3,52 +3,72 @@
 #include <ktx.h>
 #include <ktxvulkan.h>
 
+#include "reactive/Graphics/BindlessHeap.hpp"
 #include "reactive/Graphics/Buffer.hpp"
 #include "reactive/Graphics/CommandBuffer.hpp"
+#include "reactive/Graphics/UploadManager.hpp"
 #include "reactive/common.hpp"
 
 namespace {
 uint32_t calculateMipLevels(uint32_t width, uint32_t height) {
     return static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
 }
+
+vk::ImageCreateInfo toVkImageCreateInfo(const rv::ImageCreateInfo& createInfo) {
+    uint32_t mipLevels = createInfo.mipLevels;
+    if (mipLevels == std::numeric_limits<uint32_t>::max()) {
+        mipLevels = calculateMipLevels(createInfo.extent.width, createInfo.extent.height);
+    }
+
+    // NOTE: initialLayout must be Undefined or PreInitialized
+    // NOTE: queueFamily is ignored if sharingMode is not concurrent
+    vk::ImageCreateInfo imageInfo;
+    imageInfo.setImageType(createInfo.imageType);
+    imageInfo.setFormat(createInfo.format);
+    imageInfo.setExtent(createInfo.extent);
+    imageInfo.setMipLevels(mipLevels);
+    imageInfo.setSamples(vk::SampleCountFlagBits::e1);
+    imageInfo.setUsage(createInfo.usage);
+    imageInfo.setArrayLayers(1);
+    return imageInfo;
+}
 }  // namespace
 
 namespace rv {
 Image::Image(const Context& context, const ImageCreateInfo& createInfo)
+    : Image(context, createInfo, {}, 0) {}
+
+Image::Image(const Context& context,
+             const ImageCreateInfo& createInfo,
+             vk::DeviceMemory memory,
+             vk::DeviceSize memoryOffset)
     // NOTE: layout is updated by transitionLayout after this ctor.
     : m_context{&context},
       m_debugName{createInfo.debugName},
+      m_usage{createInfo.usage},
+      m_imageType{createInfo.imageType},
       m_hasOwnership{true},
+      m_bindless{createInfo.bindless},
       m_extent{createInfo.extent},
       m_format{createInfo.format},
       m_mipLevels{createInfo.mipLevels} {
-    // Compute mipmap level
-    if (m_mipLevels == std::numeric_limits<uint32_t>::max()) {
-        m_mipLevels = calculateMipLevels(m_extent.width, m_extent.height);
-    }
-
-    // NOTE: initialLayout must be Undefined or PreInitialized
-    // NOTE: queueFamily is ignored if sharingMode is not concurrent
-    vk::ImageCreateInfo imageInfo;
-    imageInfo.setImageType(createInfo.imageType);
-    imageInfo.setFormat(m_format);
-    imageInfo.setExtent(m_extent);
-    imageInfo.setMipLevels(m_mipLevels);
-    imageInfo.setSamples(vk::SampleCountFlagBits::e1);
-    imageInfo.setUsage(createInfo.usage);
-    imageInfo.setArrayLayers(m_layerCount);
+    vk::ImageCreateInfo imageInfo = toVkImageCreateInfo(createInfo);
+    m_mipLevels = imageInfo.mipLevels;
     m_image = m_context->getDevice().createImage(imageInfo);
-
-    vk::MemoryRequirements requirements = m_context->getDevice().getImageMemoryRequirements(m_image);
-    uint32_t memoryTypeIndex = m_context->findMemoryTypeIndex(  //
-        requirements, vk::MemoryPropertyFlagBits::eDeviceLocal);
-
-    vk::MemoryAllocateInfo memoryInfo;
-    memoryInfo.setAllocationSize(requirements.size);
-    memoryInfo.setMemoryTypeIndex(memoryTypeIndex);
-    m_memory = m_context->getDevice().allocateMemory(memoryInfo);
-
-    m_context->getDevice().bindImageMemory(m_image, m_memory, 0);
+    initSubresourceStates(vk::ImageLayout::eUndefined);
+
+    if (memory) {
+        // NOTE: m_allocation and m_memory stay empty, so the memory is not freed
+        m_context->getDevice().bindImageMemory(m_image, memory, memoryOffset);
+    } else {
+        vk::MemoryRequirements requirements =
+            m_context->getDevice().getImageMemoryRequirements(m_image);
+        m_allocation = m_context->getMemoryAllocator().allocate(
+            requirements, Context::getMemoryTypeRequest(MemoryIntent::GpuOnly), false,
+            MemoryAllocator::getCategory(m_debugName, "Image"));
+        m_context->getDevice().bindImageMemory(m_image, m_allocation.memory,
+                                               m_allocation.offset);
+    }
 
     // Image view
     if (createInfo.viewInfo.has_value()) {
@@ -101,16 +121,91 @@ Image::Image(const Context* context,
              uint32_t layerCount)
     : m_context{context},
       m_image{image},
+      // NOTE: KTX textures are uploaded with VK_IMAGE_USAGE_SAMPLED_BIT
+      m_usage{vk::ImageUsageFlagBits::eSampled},
       m_memory{deviceMemory},
       m_viewType{viewType},
       m_hasOwnership{true},
-      m_layout{imageLayout},
       m_extent{width, height, depth},
       m_format{imageFormat},
       m_mipLevels{levelCount},
-      m_layerCount{layerCount} {}
+      m_layerCount{layerCount} {
+    initSubresourceStates(imageLayout);
+}
+
+auto Image::hasUniformLayout() const -> bool {
+    return std::ranges::all_of(m_subresourceStates, [&](const ImageSubresourceState& state) {
+        return state.layout == m_subresourceStates.front().layout;
+    });
+}
+
+void Image::initSubresourceStates(vk::ImageLayout layout) {
+    m_subresourceStates.resize(m_mipLevels * m_layerCount);
+    setLayout(layout);
+}
+
+void Image::setLayout(vk::ImageLayout layout) {
+    for (auto& state : m_subresourceStates) {
+        state.layout = layout;
+        state.stage = vk::PipelineStageFlagBits2::eAllCommands;
+        state.access = layout == vk::ImageLayout::eUndefined
+                           ? vk::AccessFlags2{}
+                           : vk::AccessFlags2{vk::AccessFlagBits2::eMemoryWrite};
+    }
+}
+
+auto Image::getMemoryRequirements(const Context& context, const ImageCreateInfo& createInfo)
+    -> vk::MemoryRequirements {
+    vk::ImageCreateInfo imageInfo = toVkImageCreateInfo(createInfo);
+    vk::DeviceImageMemoryRequirements requirementsInfo{&imageInfo};
+    return context.getDevice().getImageMemoryRequirements(requirementsInfo).memoryRequirements;
+}
+
+void Image::writeBindlessImage() {
+    if (!m_bindless || !m_context->hasBindlessHeap()) {
+        return;
+    }
+    BindlessHeap& heap = m_context->getBindlessHeap();
+    if (m_usage & vk::ImageUsageFlagBits::eSampled) {
+        if (m_sampledImageIndex == BindlessHeap::InvalidIndex) {
+            m_sampledImageIndex = heap.allocate(BindlessType::SampledImage);
+        }
+        if (m_sampledImageIndex != BindlessHeap::InvalidIndex) {
+            heap.writeImage(BindlessType::SampledImage, m_sampledImageIndex,
+                            {{}, m_view, vk::ImageLayout::eShaderReadOnlyOptimal});
+        }
+    }
+    if (m_usage & vk::ImageUsageFlagBits::eStorage) {
+        if (m_storageImageIndex == BindlessHeap::InvalidIndex) {
+            m_storageImageIndex = heap.allocate(BindlessType::StorageImage);
+        }
+        if (m_storageImageIndex != BindlessHeap::InvalidIndex) {
+            heap.writeImage(BindlessType::StorageImage, m_storageImageIndex,
+                            {{}, m_view, vk::ImageLayout::eGeneral});
+        }
+    }
+}
+
+void Image::writeBindlessSampler() {
+    if (!m_bindless || !m_context->hasBindlessHeap()) {
+        return;
+    }
+    BindlessHeap& heap = m_context->getBindlessHeap();
+    if (m_samplerIndex == BindlessHeap::InvalidIndex) {
+        m_samplerIndex = heap.allocate(BindlessType::Sampler);
+    }
+    if (m_samplerIndex != BindlessHeap::InvalidIndex) {
+        heap.writeImage(BindlessType::Sampler, m_samplerIndex, {m_sampler, {}, {}});
+    }
+}
 
 Image::~Image() {
+    if (m_context && m_context->hasBindlessHeap()) {
+        BindlessHeap& heap = m_context->getBindlessHeap();
+        heap.free(BindlessType::SampledImage, m_sampledImageIndex);
+        heap.free(BindlessType::StorageImage, m_storageImageIndex);
+        heap.free(BindlessType::Sampler, m_samplerIndex);
+    }
     if (m_hasOwnership) {
         if (m_sampler) {
             m_context->getDevice().destroySampler(m_sampler);
@@ -118,8 +213,12 @@ Image::~Image() {
         if (m_view) {
             m_context->getDevice().destroyImageView(m_view);
         }
-        m_context->getDevice().freeMemory(m_memory);
         m_context->getDevice().destroyImage(m_image);
+        if (m_allocation.memory) {
+            m_context->getMemoryAllocator().free(m_allocation);
+        } else {
+            m_context->getDevice().freeMemory(m_memory);
+        }
     }
 }
 
@@ -152,27 +251,9 @@ ImageHandle Image::loadFromFile(const Context& context,
     });
 
     // Copy to image
-    BufferHandle stagingBuffer = context.createBuffer({
-        .usage = BufferUsage::Staging,
-        .memory = MemoryUsage::Host,
-        .size = width * height * comp * sizeof(unsigned char),
-    });
-    stagingBuffer->copy(pixels);
-
-    context.oneTimeSubmit([&](CommandBufferHandle commandBuffer) {
-        commandBuffer->transitionLayout(image, vk::ImageLayout::eTransferDstOptimal);
-        commandBuffer->copyBufferToImage(stagingBuffer, image);
-
-        // TODO: refactor
-        vk::ImageLayout newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-        if (mipLevels > 1) {
-            newLayout = vk::ImageLayout::eTransferSrcOptimal;
-        }
-        commandBuffer->transitionLayout(image, newLayout);
-        if (mipLevels > 1) {
-            image->generateMipmaps(*commandBuffer);
-        }
-    });
+    // NOTE: Mipmaps are generated by UploadManager
+    context.getUploadManager().uploadImage(image, pixels,
+                                           width * height * comp * sizeof(unsigned char));
 
     stbi_image_free(pixels);
 
@@ -198,18 +279,7 @@ ImageHandle Image::loadFromFileHDR(const Context& context, const std::filesystem
     });
 
     // Copy to image
-    BufferHandle stagingBuffer = context.createBuffer({
-        .usage = BufferUsage::Staging,
-        .memory = MemoryUsage::Host,
-        .size = width * height * comp * sizeof(float),
-    });
-    stagingBuffer->copy(pixels);
-
-    context.oneTimeSubmit([&](CommandBufferHandle commandBuffer) {
-        commandBuffer->transitionLayout(image, vk::ImageLayout::eTransferDstOptimal);
-        commandBuffer->copyBufferToImage(stagingBuffer, image);
-        commandBuffer->transitionLayout(image, vk::ImageLayout::eShaderReadOnlyOptimal);
-    });
+    context.getUploadManager().uploadImage(image, pixels, width * height * comp * sizeof(float));
 
     stbi_image_free(pixels);
 
@@ -269,8 +339,11 @@ void Image::generateMipmaps(const CommandBuffer& commandBuffer) {
     RV_ASSERT(m_mipLevels > 1, "m_mipLevels is not set greater than 1 when the m_image is created.");
 
     commandBuffer.beginDebugLabel("GenerateMipmap");
-    vk::ImageLayout oldLayout = m_layout;
-    vk::ImageLayout newLayout = m_layout;
+    // Mips return to the layout of mip 0
+    vk::ImageLayout finalLayout = getLayout(0, 0);
+    if (finalLayout == vk::ImageLayout::eUndefined) {
+        finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    }
 
     // Check if image format supports linear blitting
     vk::Filter filter = vk::Filter::eLinear;
@@ -295,44 +368,14 @@ void Image::generateMipmaps(const CommandBuffer& commandBuffer) {
     }
 
     // TODO: support 3D
-    // TODO: move to command buffer
-    vk::ImageMemoryBarrier barrier{};
-    barrier.image = m_image;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.subresourceRange.aspectMask = m_aspect;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
-    barrier.subresourceRange.levelCount = 1;
-
     int32_t mipWidth = m_extent.width;
     int32_t mipHeight = m_extent.height;
 
     for (uint32_t i = 1; i < m_mipLevels; i++) {
-        // Src (i - 1)
-        {
-            // TODO: access maskをしっかり設定する
-            // NOTE: level = 0 についてはまだ遷移していないので old = 既存のレイアウトとする
-            barrier.subresourceRange.baseMipLevel = i - 1;
-            barrier.oldLayout = i == 1 ? oldLayout : vk::ImageLayout::eTransferDstOptimal;
-            barrier.newLayout = vk::ImageLayout::eTransferSrcOptimal;
-            barrier.srcAccessMask = {};
-            barrier.dstAccessMask = vk::AccessFlagBits::eTransferRead;
-            commandBuffer.imageBarrier(barrier, vk::PipelineStageFlagBits::eTransfer,
-                                       vk::PipelineStageFlagBits::eTransfer);
-        }
-        // Dst (i)
-        {
-            // NOTE: Dst はこれから書きこまれるので old = undef でよい
-            // ただし省略すると古い情報が残るので上書きすること
-            barrier.subresourceRange.baseMipLevel = i;
-            barrier.oldLayout = vk::ImageLayout::eUndefined;
-            barrier.newLayout = vk::ImageLayout::eTransferDstOptimal;
-            barrier.srcAccessMask = {};
-            barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
-            commandBuffer.imageBarrier(barrier, vk::PipelineStageFlagBits::eTransfer,
-                                       vk::PipelineStageFlagBits::eTransfer);
-        }
+        // NOTE: Only mips i - 1 and i are transitioned,
+        // so reading mip i - 1 and writing mip i don't stall other mips.
+        commandBuffer.transitionLayout(*this, vk::ImageLayout::eTransferSrcOptimal, i - 1);
+        commandBuffer.transitionLayout(*this, vk::ImageLayout::eTransferDstOptimal, i);
 
         vk::ImageBlit blit{};
         blit.srcOffsets[0] = vk::Offset3D{0, 0, 0};
@@ -349,6 +392,7 @@ void Image::generateMipmaps(const CommandBuffer& commandBuffer) {
         blit.dstSubresource.baseArrayLayer = 0;
         blit.dstSubresource.layerCount = 1;
 
+        commandBuffer.flushBarriers();
         commandBuffer.m_commandBuffer->blitImage(m_image, vk::ImageLayout::eTransferSrcOptimal, m_image,
                                                vk::ImageLayout::eTransferDstOptimal, blit, filter);
 
@@ -358,28 +402,10 @@ void Image::generateMipmaps(const CommandBuffer& commandBuffer) {
             mipHeight /= 2;
     }
 
-    // レベル[0, 1, 2, ..., N-1, N] のうち、[0, N-1]までをまとめて遷移
-    barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = m_mipLevels - 1;
-    barrier.oldLayout = vk::ImageLayout::eTransferSrcOptimal;
-    barrier.newLayout = newLayout;
-    barrier.srcAccessMask = vk::AccessFlagBits::eTransferRead;
-    barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
-    commandBuffer.imageBarrier(barrier, vk::PipelineStageFlagBits::eTransfer,
-                               vk::PipelineStageFlagBits::eAllCommands);
-
-    // レベルNを遷移
-    barrier.subresourceRange.baseMipLevel = m_mipLevels - 1;
-    barrier.subresourceRange.levelCount = 1;
-    barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
-    barrier.newLayout = newLayout;
-    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
-    barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
-    commandBuffer.imageBarrier(barrier, vk::PipelineStageFlagBits::eTransfer,
-                               vk::PipelineStageFlagBits::eAllCommands);
+    // [0, N-1] are TransferSrc and N is TransferDst.
+    // Both runs are transitioned with one barrier call.
+    commandBuffer.transitionLayout(*this, finalLayout, 0, m_mipLevels);
 
     commandBuffer.endDebugLabel();
-
-    m_layout = newLayout;
 }
 }  // namespace rv
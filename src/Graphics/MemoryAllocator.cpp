@@ -0,0 +1,437 @@
+#include "reactive/Graphics/MemoryAllocator.hpp"
+
+#include <bit>
+
+#include "reactive/common.hpp"
+
+namespace rv {
+MemoryAllocator::MemoryAllocator(const Context& context, vk::DeviceSize blockSize)
+    : m_context{&context}, m_blockSize{std::bit_floor(blockSize)} {
+    m_memoryProperties = m_context->getPhysicalDevice().getMemoryProperties();
+    m_bufferImageGranularity = m_context->getPhysicalDeviceLimits().bufferImageGranularity;
+    m_memoryBudgetEnabled =
+        m_context->isDeviceExtensionEnabled(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+    // [memoryType][linear or optimal]
+    m_pools.resize(m_memoryProperties.memoryTypeCount * 2);
+
+    m_heapStats.resize(m_memoryProperties.memoryHeapCount);
+    m_heapBudgets.resize(m_memoryProperties.memoryHeapCount);
+    for (uint32_t i = 0; i < m_memoryProperties.memoryHeapCount; i++) {
+        m_heapStats[i].flags = m_memoryProperties.memoryHeaps[i].flags;
+        m_heapStats[i].heapSize = m_memoryProperties.memoryHeaps[i].size;
+    }
+    m_typeStats.resize(m_memoryProperties.memoryTypeCount);
+    for (uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; i++) {
+        m_typeStats[i].flags = m_memoryProperties.memoryTypes[i].propertyFlags;
+        m_typeStats[i].heapIndex = m_memoryProperties.memoryTypes[i].heapIndex;
+    }
+    updateDriverBudget();
+}
+
+MemoryAllocator::~MemoryAllocator() {
+    if (m_stats.allocationCount > 0 || m_stats.dedicatedCount > 0) {
+        spdlog::warn("MemoryAllocator destroyed with {} live allocations.",
+                     m_stats.allocationCount + m_stats.dedicatedCount);
+    }
+    for (auto& pool : m_pools) {
+        for (auto& block : pool) {
+            freeDeviceMemory(block->memory, block->size, block->memoryTypeIndex);
+        }
+    }
+}
+
+auto MemoryAllocator::allocate(const vk::MemoryRequirements& requirements,
+                               MemoryTypeRequest request,
+                               bool linear,
+                               std::string_view category) -> MemoryAllocation {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    request.fallbackHeapBits |= getOverBudgetHeapBits(requirements.size);
+    uint32_t memoryTypeIndex = m_context->findMemoryTypeIndex(requirements, request);
+    vk::DeviceSize blockSize = getBlockSize(memoryTypeIndex);
+    vk::DeviceSize nodeSize =
+        std::bit_ceil(std::max({requirements.size, requirements.alignment, MinNodeSize}));
+
+    MemoryAllocation allocation;
+    allocation.memoryTypeIndex = memoryTypeIndex;
+    allocation.size = requirements.size;
+    allocation.categoryIndex = getCategoryIndex(category);
+
+    // Large resources get their own memory
+    if (nodeSize > blockSize / 2) {
+        allocation.memory =
+            allocateDeviceMemory(requirements.size, memoryTypeIndex, &allocation.mapped);
+        m_stats.dedicatedCount++;
+        addUsedSize(allocation, requirements.size);
+        return allocation;
+    }
+
+    uint32_t order = static_cast<uint32_t>(std::countr_zero(nodeSize / MinNodeSize));
+    uint32_t poolIndex = getPoolIndex(memoryTypeIndex, linear);
+
+    vk::DeviceSize offset = 0;
+    MemoryBlock* block = nullptr;
+    for (auto& candidate : m_pools[poolIndex]) {
+        if (allocateNode(*candidate, order, offset)) {
+            block = candidate.get();
+            break;
+        }
+    }
+    if (!block) {
+        block = createBlock(memoryTypeIndex, poolIndex);
+        if (!allocateNode(*block, order, offset)) {
+            throw std::runtime_error("Failed to allocate memory from a new block.");
+        }
+    }
+
+    block->usedSize += nodeSize;
+    block->allocationCount++;
+    m_stats.allocationCount++;
+
+    allocation.memory = block->memory;
+    allocation.offset = offset;
+    allocation.block = block;
+    allocation.order = order;
+    addUsedSize(allocation, nodeSize);
+    if (block->mapped) {
+        allocation.mapped = static_cast<uint8_t*>(block->mapped) + offset;
+    }
+    return allocation;
+}
+
+void MemoryAllocator::free(const MemoryAllocation& allocation) {
+    if (!allocation.memory) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!allocation.block) {
+        freeDeviceMemory(allocation.memory, allocation.size, allocation.memoryTypeIndex);
+        m_stats.dedicatedCount--;
+        subUsedSize(allocation, allocation.size);
+        return;
+    }
+
+    MemoryBlock* block = allocation.block;
+    vk::DeviceSize nodeSize = MinNodeSize << allocation.order;
+    freeNode(*block, allocation.order, allocation.offset);
+    block->usedSize -= nodeSize;
+    block->allocationCount--;
+    m_stats.allocationCount--;
+    subUsedSize(allocation, nodeSize);
+
+    // Release empty blocks, but keep the last one of each pool
+    // so that create/destroy loops don't hit vkAllocateMemory every time.
+    auto& pool = m_pools[block->poolIndex];
+    if (block->allocationCount == 0 && pool.size() > 1) {
+        freeDeviceMemory(block->memory, block->size, block->memoryTypeIndex);
+        std::erase_if(pool, [&](const auto& b) { return b.get() == block; });
+        m_stats.blockCount--;
+    }
+}
+
+auto MemoryAllocator::getDefragmentationSources() const -> std::vector<const MemoryBlock*> {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<const MemoryBlock*> sources;
+    for (const auto& pool : m_pools) {
+        if (pool.size() < 2) {
+            continue;
+        }
+
+        const MemoryBlock* source = nullptr;
+        vk::DeviceSize freeSize = 0;
+        for (const auto& block : pool) {
+            freeSize += block->size - block->usedSize;
+            if (!source || block->usedSize < source->usedSize) {
+                source = block.get();
+            }
+        }
+
+        // The rest of the pool must be able to hold the contents
+        vk::DeviceSize otherFreeSize = freeSize - (source->size - source->usedSize);
+        if (source->usedSize * 2 <= source->size && source->usedSize <= otherFreeSize) {
+            sources.push_back(source);
+        }
+    }
+    return sources;
+}
+
+auto MemoryAllocator::allocateForMove(const MemoryAllocation& allocation,
+                                      const std::vector<const MemoryBlock*>& excludedBlocks)
+    -> std::optional<MemoryAllocation> {
+    RV_ASSERT(allocation.block, "Dedicated allocations cannot be moved.");
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Fill the fullest blocks first
+    std::vector<MemoryBlock*> candidates;
+    for (auto& block : m_pools[allocation.block->poolIndex]) {
+        if (std::ranges::find(excludedBlocks, block.get()) == excludedBlocks.end()) {
+            candidates.push_back(block.get());
+        }
+    }
+    std::ranges::sort(candidates, std::greater{}, &MemoryBlock::usedSize);
+
+    for (MemoryBlock* block : candidates) {
+        vk::DeviceSize offset = 0;
+        if (!allocateNode(*block, allocation.order, offset)) {
+            continue;
+        }
+
+        vk::DeviceSize nodeSize = MinNodeSize << allocation.order;
+        block->usedSize += nodeSize;
+        block->allocationCount++;
+        m_stats.allocationCount++;
+
+        MemoryAllocation newAllocation = allocation;
+        newAllocation.memory = block->memory;
+        newAllocation.offset = offset;
+        newAllocation.block = block;
+        newAllocation.mapped =
+            block->mapped ? static_cast<uint8_t*>(block->mapped) + offset : nullptr;
+        addUsedSize(newAllocation, nodeSize);
+        return newAllocation;
+    }
+    return std::nullopt;
+}
+
+auto MemoryAllocator::getStats() const -> MemoryAllocatorStats {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+auto MemoryAllocator::getMemoryStats() const -> MemoryStats {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    MemoryStats stats;
+    stats.total = m_stats;
+    stats.heaps = m_heapStats;
+    stats.types = m_typeStats;
+    for (uint32_t i = 0; i < stats.heaps.size(); i++) {
+        stats.heaps[i].softBudget = m_heapBudgets[i].softBudget;
+    }
+    for (uint32_t i = 0; i < m_categories.size(); i++) {
+        stats.categories[m_categories[i]] = m_categoryStats[i];
+    }
+    return stats;
+}
+
+void MemoryAllocator::setSoftBudget(uint32_t heapIndex,
+                                    vk::DeviceSize budget,
+                                    MemoryBudgetPolicy policy) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    RV_ASSERT(heapIndex < m_heapBudgets.size(), "heapIndex is out of range: {}", heapIndex);
+    m_heapBudgets[heapIndex] = {budget, policy, false};
+}
+
+auto MemoryAllocator::getCategory(std::string_view debugName, std::string_view fallback)
+    -> std::string_view {
+    size_t pos = debugName.rfind("::");
+    if (pos == std::string_view::npos || pos + 2 == debugName.size()) {
+        return fallback;
+    }
+    return debugName.substr(pos + 2);
+}
+
+auto MemoryAllocator::getPoolIndex(uint32_t memoryTypeIndex, bool linear) const -> uint32_t {
+    // NOTE: Buddy nodes are aligned to at least MinNodeSize,
+    // so linear and optimal resources never share a granularity page
+    // unless bufferImageGranularity is larger than that.
+    bool separate = m_bufferImageGranularity > MinNodeSize;
+    return memoryTypeIndex * 2 + (separate && !linear ? 1 : 0);
+}
+
+auto MemoryAllocator::getBlockSize(uint32_t memoryTypeIndex) const -> vk::DeviceSize {
+    // Use smaller blocks for small heaps (e.g. 256 MB BAR heap)
+    uint32_t heapIndex = m_memoryProperties.memoryTypes[memoryTypeIndex].heapIndex;
+    vk::DeviceSize heapSize = m_memoryProperties.memoryHeaps[heapIndex].size;
+    vk::DeviceSize heapBlockSize = std::bit_floor(std::max(heapSize / 8, MinNodeSize));
+    return std::min(m_blockSize, heapBlockSize);
+}
+
+auto MemoryAllocator::getCategoryIndex(std::string_view category) -> uint32_t {
+    // NOTE: Few categories exist, so linear search is enough
+    for (uint32_t i = 0; i < m_categories.size(); i++) {
+        if (m_categories[i] == category) {
+            return i;
+        }
+    }
+    m_categories.emplace_back(category);
+    m_categoryStats.emplace_back();
+    return static_cast<uint32_t>(m_categories.size() - 1);
+}
+
+void MemoryAllocator::checkBudget(uint32_t memoryTypeIndex, vk::DeviceSize size) {
+    uint32_t heapIndex = m_memoryProperties.memoryTypes[memoryTypeIndex].heapIndex;
+    HeapBudget& budget = m_heapBudgets[heapIndex];
+    if (budget.softBudget == 0) {
+        return;
+    }
+
+    vk::DeviceSize newSize = m_heapStats[heapIndex].reservedSize + size;
+    if (newSize <= budget.softBudget) {
+        budget.warned = false;
+        return;
+    }
+
+    if (budget.policy == MemoryBudgetPolicy::Fail) {
+        throw std::runtime_error(fmt::format(
+            "Memory heap {} exceeds the soft budget: {} MB > {} MB", heapIndex,
+            newSize / (1024 * 1024), budget.softBudget / (1024 * 1024)));
+    }
+
+    // Warn once until the heap goes back under the budget
+    if (!budget.warned) {
+        spdlog::warn("Memory heap {} exceeds the soft budget: {} MB > {} MB", heapIndex,
+                     newSize / (1024 * 1024), budget.softBudget / (1024 * 1024));
+        budget.warned = true;
+    }
+}
+
+auto MemoryAllocator::getOverBudgetHeapBits(vk::DeviceSize size) const -> uint32_t {
+    uint32_t heapBits = 0;
+    for (uint32_t i = 0; i < m_heapStats.size(); i++) {
+        const MemoryHeapStats& heapStats = m_heapStats[i];
+        vk::DeviceSize softBudget = m_heapBudgets[i].softBudget;
+        bool overSoftBudget = softBudget > 0 && heapStats.reservedSize + size > softBudget;
+        bool overDriverBudget = heapStats.usage + size > heapStats.budget;
+        if (overSoftBudget || overDriverBudget) {
+            heapBits |= 1u << i;
+        }
+    }
+    return heapBits;
+}
+
+void MemoryAllocator::updateDriverBudget() {
+    if (!m_memoryBudgetEnabled) {
+        for (auto& heapStats : m_heapStats) {
+            heapStats.budget = heapStats.heapSize;
+            heapStats.usage = heapStats.reservedSize;
+        }
+        return;
+    }
+
+    vk::PhysicalDeviceMemoryBudgetPropertiesEXT budgetProps;
+    vk::PhysicalDeviceMemoryProperties2 memoryProps2;
+    memoryProps2.pNext = &budgetProps;
+    m_context->getPhysicalDevice().getMemoryProperties2(&memoryProps2);
+    for (uint32_t i = 0; i < m_heapStats.size(); i++) {
+        m_heapStats[i].budget = budgetProps.heapBudget[i];
+        m_heapStats[i].usage = budgetProps.heapUsage[i];
+    }
+}
+
+void MemoryAllocator::addUsedSize(const MemoryAllocation& allocation, vk::DeviceSize size) {
+    MemoryTypeStats& typeStats = m_typeStats[allocation.memoryTypeIndex];
+    typeStats.usedSize += size;
+    typeStats.allocationCount++;
+    m_heapStats[typeStats.heapIndex].usedSize += size;
+    m_categoryStats[allocation.categoryIndex].usedSize += size;
+    m_categoryStats[allocation.categoryIndex].allocationCount++;
+    m_stats.usedSize += size;
+}
+
+void MemoryAllocator::subUsedSize(const MemoryAllocation& allocation, vk::DeviceSize size) {
+    MemoryTypeStats& typeStats = m_typeStats[allocation.memoryTypeIndex];
+    typeStats.usedSize -= size;
+    typeStats.allocationCount--;
+    m_heapStats[typeStats.heapIndex].usedSize -= size;
+    m_categoryStats[allocation.categoryIndex].usedSize -= size;
+    m_categoryStats[allocation.categoryIndex].allocationCount--;
+    m_stats.usedSize -= size;
+}
+
+auto MemoryAllocator::allocateDeviceMemory(vk::DeviceSize size,
+                                           uint32_t memoryTypeIndex,
+                                           void** mapped) -> vk::DeviceMemory {
+    checkBudget(memoryTypeIndex, size);
+
+    vk::MemoryAllocateFlagsInfo flagsInfo{vk::MemoryAllocateFlagBits::eDeviceAddress};
+    vk::MemoryAllocateInfo memoryInfo;
+    memoryInfo.setAllocationSize(size);
+    memoryInfo.setMemoryTypeIndex(memoryTypeIndex);
+    memoryInfo.setPNext(&flagsInfo);
+    vk::DeviceMemory memory = m_context->getDevice().allocateMemory(memoryInfo);
+
+    m_stats.allocateMemoryCount++;
+    m_stats.reservedSize += size;
+    m_typeStats[memoryTypeIndex].reservedSize += size;
+    m_heapStats[m_typeStats[memoryTypeIndex].heapIndex].reservedSize += size;
+    updateDriverBudget();
+
+    // Host visible memory is persistently mapped
+    vk::MemoryPropertyFlags props = m_memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags;
+    if (props & vk::MemoryPropertyFlagBits::eHostVisible) {
+        *mapped = m_context->getDevice().mapMemory(memory, 0, VK_WHOLE_SIZE);
+    }
+    return memory;
+}
+
+void MemoryAllocator::freeDeviceMemory(vk::DeviceMemory memory,
+                                       vk::DeviceSize size,
+                                       uint32_t memoryTypeIndex) {
+    // NOTE: vkFreeMemory implicitly unmaps the memory
+    m_context->getDevice().freeMemory(memory);
+    m_stats.freeMemoryCount++;
+    m_stats.reservedSize -= size;
+    m_typeStats[memoryTypeIndex].reservedSize -= size;
+    m_heapStats[m_typeStats[memoryTypeIndex].heapIndex].reservedSize -= size;
+    updateDriverBudget();
+}
+
+auto MemoryAllocator::createBlock(uint32_t memoryTypeIndex, uint32_t poolIndex) -> MemoryBlock* {
+    auto block = std::make_unique<MemoryBlock>();
+    block->size = getBlockSize(memoryTypeIndex);
+    block->memoryTypeIndex = memoryTypeIndex;
+    block->poolIndex = poolIndex;
+    block->memory = allocateDeviceMemory(block->size, memoryTypeIndex, &block->mapped);
+
+    uint32_t maxOrder = static_cast<uint32_t>(std::countr_zero(block->size / MinNodeSize));
+    block->freeLists.resize(maxOrder + 1);
+    block->freeLists[maxOrder].insert(0);
+
+    spdlog::debug("Allocate memory block: type={}, size={} MB", memoryTypeIndex,
+                  block->size / (1024 * 1024));
+
+    m_stats.blockCount++;
+    m_pools[poolIndex].push_back(std::move(block));
+    return m_pools[poolIndex].back().get();
+}
+
+auto MemoryAllocator::allocateNode(MemoryBlock& block, uint32_t order, vk::DeviceSize& offset)
+    -> bool {
+    for (uint32_t i = order; i < block.freeLists.size(); i++) {
+        if (block.freeLists[i].empty()) {
+            continue;
+        }
+
+        // Take the lowest node to keep allocations packed
+        vk::DeviceSize nodeOffset = *block.freeLists[i].begin();
+        block.freeLists[i].erase(block.freeLists[i].begin());
+
+        // Split until the requested order
+        while (i > order) {
+            i--;
+            block.freeLists[i].insert(nodeOffset + (MinNodeSize << i));
+        }
+        offset = nodeOffset;
+        return true;
+    }
+    return false;
+}
+
+void MemoryAllocator::freeNode(MemoryBlock& block, uint32_t order, vk::DeviceSize offset) {
+    // Merge with the buddy while it is free
+    while (order + 1 < block.freeLists.size()) {
+        vk::DeviceSize buddy = offset ^ (MinNodeSize << order);
+        auto it = block.freeLists[order].find(buddy);
+        if (it == block.freeLists[order].end()) {
+            break;
+        }
+        block.freeLists[order].erase(it);
+        offset = std::min(offset, buddy);
+        order++;
+    }
+    block.freeLists[order].insert(offset);
+}
+}  // namespace rv
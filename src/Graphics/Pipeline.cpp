@@ -1,33 +1,72 @@
 #include "reactive/Graphics/Pipeline.hpp"
 
+#include <algorithm>
 #include <regex>
 
 #include "reactive/Compiler/Compiler.hpp"
 #include "reactive/Graphics/ArrayProxy.hpp"
+#include "reactive/Graphics/BindlessHeap.hpp"
 #include "reactive/Graphics/Buffer.hpp"
 #include "reactive/Graphics/CommandBuffer.hpp"
+#include "reactive/Graphics/PipelineCache.hpp"
+#include "reactive/Graphics/ThreadPool.hpp"
 #include "reactive/Scene/Mesh.hpp"
 #include "reactive/Scene/Object.hpp"
+#include "reactive/common.hpp"
 
 namespace rv {
-GraphicsPipeline::GraphicsPipeline(const Context& context,
-                                   const GraphicsPipelineCreateInfo& createInfo)
-    : Pipeline{context} {
-    m_shaderStageFlags = vk::ShaderStageFlagBits::eAllGraphics;
-    m_bindPoint = vk::PipelineBindPoint::eGraphics;
-    m_pushSize = createInfo.pushSize;
+void Pipeline::createPipelineLayout(vk::DescriptorSetLayout descSetLayout,
+                                    vk::DescriptorSetLayout pushDescSetLayout,
+                                    bool bindless) {
+    m_bindless = bindless;
+    m_descriptorBuffer = m_context->hasDescriptorBuffer();
+    if (m_bindless && m_descriptorBuffer) {
+        throw std::runtime_error("Bindless pipelines are not supported with the descriptor buffer backend.");
+    }
 
     vk::PushConstantRange pushRange;
     pushRange.setOffset(0);
-    pushRange.setSize(createInfo.pushSize);
+    pushRange.setSize(m_pushSize);
     pushRange.setStageFlags(m_shaderStageFlags);
 
+    std::vector<vk::DescriptorSetLayout> setLayouts;
+    if (bindless) {
+        RV_ASSERT(m_context->hasBindlessHeap(), "BindlessHeap is not enabled on this device.");
+        setLayouts.push_back(m_context->getBindlessHeap().getLayout());
+    }
+    m_descSetIndex = static_cast<uint32_t>(setLayouts.size());
+    if (descSetLayout) {
+        setLayouts.push_back(descSetLayout);
+    }
+    m_pushDescSetIndex = static_cast<uint32_t>(setLayouts.size());
+    if (pushDescSetLayout) {
+        setLayouts.push_back(pushDescSetLayout);
+    }
+
     vk::PipelineLayoutCreateInfo layoutInfo;
-    layoutInfo.setSetLayouts(createInfo.descSetLayout);
+    layoutInfo.setSetLayouts(setLayouts);
     if (m_pushSize) {
         layoutInfo.setPushConstantRanges(pushRange);
     }
     m_pipelineLayout = m_context->getDevice().createPipelineLayoutUnique(layoutInfo);
+}
+
+auto Pipeline::getCreateFlags() const -> vk::PipelineCreateFlags {
+    if (m_descriptorBuffer) {
+        return vk::PipelineCreateFlagBits::eDescriptorBufferEXT;
+    }
+    return {};
+}
+
+GraphicsPipeline::GraphicsPipeline(const Context& context,
+                                   const GraphicsPipelineCreateInfo& createInfo)
+    : Pipeline{context} {
+    m_shaderStageFlags = vk::ShaderStageFlagBits::eAllGraphics;
+    m_bindPoint = vk::PipelineBindPoint::eGraphics;
+    m_pushSize = createInfo.pushSize;
+
+    createPipelineLayout(createInfo.descSetLayout, createInfo.pushDescSetLayout,
+                         createInfo.bindless);
 
     std::vector<vk::PipelineShaderStageCreateInfo> shaderStages(2);
     shaderStages[0].setModule(createInfo.vertexShader->getModule());
@@ -123,6 +162,7 @@ GraphicsPipeline::GraphicsPipeline(const Context& context,
     pipelineInfo.setPDepthStencilState(&depthStencil);
     pipelineInfo.setPColorBlendState(&colorBlending);
     pipelineInfo.setLayout(*m_pipelineLayout);
+    pipelineInfo.setFlags(getCreateFlags());
     pipelineInfo.setSubpass(0);
     pipelineInfo.setPNext(&renderingInfo);
 
@@ -156,7 +196,8 @@ GraphicsPipeline::GraphicsPipeline(const Context& context,
     pipelineInfo.setPVertexInputState(&vertexInputInfo);
     pipelineInfo.setPDynamicState(&dynamicStateInfo);
 
-    auto result = m_context->getDevice().createGraphicsPipelineUnique({}, pipelineInfo);
+    auto result = m_context->getDevice().createGraphicsPipelineUnique(
+        m_context->getPipelineCache().getCache(), pipelineInfo);
     if (result.result != vk::Result::eSuccess) {
         throw std::runtime_error("failed to create a m_pipeline!");
     }
@@ -171,17 +212,8 @@ MeshShaderPipeline::MeshShaderPipeline(const Context& context,
     m_bindPoint = vk::PipelineBindPoint::eGraphics;
     m_pushSize = createInfo.pushSize;
 
-    vk::PushConstantRange pushRange;
-    pushRange.setOffset(0);
-    pushRange.setSize(createInfo.pushSize);
-    pushRange.setStageFlags(m_shaderStageFlags);
-
-    vk::PipelineLayoutCreateInfo layoutInfo;
-    layoutInfo.setSetLayouts(createInfo.descSetLayout);
-    if (m_pushSize) {
-        layoutInfo.setPushConstantRanges(pushRange);
-    }
-    m_pipelineLayout = m_context->getDevice().createPipelineLayoutUnique(layoutInfo);
+    createPipelineLayout(createInfo.descSetLayout, createInfo.pushDescSetLayout,
+                         createInfo.bindless);
 
     std::vector<vk::PipelineShaderStageCreateInfo> shaderStages;
     if (createInfo.taskShader && createInfo.taskShader->getModule()) {
@@ -290,11 +322,13 @@ MeshShaderPipeline::MeshShaderPipeline(const Context& context,
     pipelineInfo.setPDepthStencilState(&depthStencil);
     pipelineInfo.setPColorBlendState(&colorBlending);
     pipelineInfo.setLayout(*m_pipelineLayout);
+    pipelineInfo.setFlags(getCreateFlags());
     pipelineInfo.setSubpass(0);
     pipelineInfo.setPDynamicState(&dynamicStateInfo);
     pipelineInfo.setPNext(&renderingInfo);
 
-    auto result = m_context->getDevice().createGraphicsPipelineUnique({}, pipelineInfo);
+    auto result = m_context->getDevice().createGraphicsPipelineUnique(
+        m_context->getPipelineCache().getCache(), pipelineInfo);
     if (result.result != vk::Result::eSuccess) {
         throw std::runtime_error("failed to create a m_pipeline!");
     }
@@ -308,17 +342,8 @@ ComputePipeline::ComputePipeline(const Context& context,
     m_bindPoint = vk::PipelineBindPoint::eCompute;
     m_pushSize = createInfo.pushSize;
 
-    vk::PushConstantRange pushRange;
-    pushRange.setOffset(0);
-    pushRange.setSize(m_pushSize);
-    pushRange.setStageFlags(m_shaderStageFlags);
-
-    vk::PipelineLayoutCreateInfo layoutInfo;
-    layoutInfo.setSetLayouts(createInfo.descSetLayout);
-    if (m_pushSize) {
-        layoutInfo.setPushConstantRanges(pushRange);
-    }
-    m_pipelineLayout = m_context->getDevice().createPipelineLayoutUnique(layoutInfo);
+    createPipelineLayout(createInfo.descSetLayout, createInfo.pushDescSetLayout,
+                         createInfo.bindless);
 
     vk::PipelineShaderStageCreateInfo stage;
     stage.setStage(createInfo.computeShader->getStage());
@@ -328,7 +353,9 @@ ComputePipeline::ComputePipeline(const Context& context,
     vk::ComputePipelineCreateInfo pipelineInfo;
     pipelineInfo.setStage(stage);
     pipelineInfo.setLayout(*m_pipelineLayout);
-    auto res = m_context->getDevice().createComputePipelinesUnique({}, pipelineInfo);
+    pipelineInfo.setFlags(getCreateFlags());
+    auto res = m_context->getDevice().createComputePipelinesUnique(
+        m_context->getPipelineCache().getCache(), pipelineInfo);
     if (res.result != vk::Result::eSuccess) {
         throw std::runtime_error("failed to create a m_pipeline.");
     }
@@ -393,33 +420,83 @@ RayTracingPipeline::RayTracingPipeline(const Context& context,
                                 VK_SHADER_UNUSED_KHR, chitIndex, ahitIndex, VK_SHADER_UNUSED_KHR});
     }
 
-    vk::PushConstantRange pushRange;
-    pushRange.setOffset(0);
-    pushRange.setSize(m_pushSize);
-    pushRange.setStageFlags(m_shaderStageFlags);
-
-    vk::PipelineLayoutCreateInfo layoutInfo;
-    layoutInfo.setSetLayouts(createInfo.descSetLayout);
-    if (m_pushSize) {
-        layoutInfo.setPushConstantRanges(pushRange);
-    }
-    m_pipelineLayout = m_context->getDevice().createPipelineLayoutUnique(layoutInfo);
+    createPipelineLayout(createInfo.descSetLayout, createInfo.pushDescSetLayout,
+                         createInfo.bindless);
 
     vk::RayTracingPipelineCreateInfoKHR pipelineInfo;
     pipelineInfo.setStages(m_shaderStages);
     pipelineInfo.setGroups(m_shaderGroups);
     pipelineInfo.setMaxPipelineRayRecursionDepth(createInfo.maxRayRecursionDepth);
     pipelineInfo.setLayout(*m_pipelineLayout);
-    auto res =
-        m_context->getDevice().createRayTracingPipelineKHRUnique(nullptr, nullptr, pipelineInfo);
-    if (res.result != vk::Result::eSuccess) {
-        throw std::runtime_error("failed to create a m_pipeline.");
+    pipelineInfo.setFlags(getCreateFlags());
+    if (m_context->isDeviceExtensionEnabled(VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME)) {
+        createPipelineDeferred(pipelineInfo);
+    } else {
+        auto res = m_context->getDevice().createRayTracingPipelineKHRUnique(
+            nullptr, m_context->getPipelineCache().getCache(), pipelineInfo);
+        if (res.result != vk::Result::eSuccess) {
+            throw std::runtime_error("failed to create a m_pipeline.");
+        }
+        m_pipeline = std::move(res.value);
     }
-    m_pipeline = std::move(res.value);
 
     createSBT();
 }
 
+void RayTracingPipeline::createPipelineDeferred(const vk::RayTracingPipelineCreateInfoKHR& pipelineInfo) {
+    vk::Device device = m_context->getDevice();
+
+    // NOTE: Helpers may still be joining after this returns, so they share the operation.
+    auto operation = std::make_shared<vk::UniqueDeferredOperationKHR>(
+        device.createDeferredOperationKHRUnique());
+
+    vk::Pipeline pipeline;
+    vk::Result result = device.createRayTracingPipelinesKHR(
+        **operation, m_context->getPipelineCache().getCache(), 1, &pipelineInfo, nullptr, &pipeline);
+
+    if (result == vk::Result::eOperationDeferredKHR) {
+        // The calling thread joins too, so the workers only add parallelism
+        ThreadPool& threadPool = m_context->getThreadPool();
+        uint32_t concurrency = device.getDeferredOperationMaxConcurrencyKHR(**operation);
+        // NOTE: The maximum concurrency may be 0 once the operation has completed
+        uint32_t helperCount =
+            std::min(std::max(concurrency, 1u), threadPool.getThreadCount() + 1) - 1;
+        for (uint32_t i = 0; i < helperCount; i++) {
+            threadPool.submit([device, operation]() {
+                vk::Result joinResult = device.joinDeferredOperationKHR(**operation);
+                while (joinResult == vk::Result::eThreadIdleKHR) {
+                    std::this_thread::yield();
+                    joinResult = device.joinDeferredOperationKHR(**operation);
+                }
+            });
+        }
+
+        while (true) {
+            vk::Result joinResult = device.joinDeferredOperationKHR(**operation);
+            if (joinResult == vk::Result::eSuccess) {
+                break;
+            }
+            if (joinResult == vk::Result::eThreadDoneKHR) {
+                // Other threads are finishing the remaining work
+                if (device.getDeferredOperationResultKHR(**operation) != vk::Result::eNotReady) {
+                    break;
+                }
+            } else if (joinResult != vk::Result::eThreadIdleKHR) {
+                throw std::runtime_error("failed to join a deferred operation: " +
+                                         vk::to_string(joinResult));
+            }
+            std::this_thread::yield();
+        }
+        result = device.getDeferredOperationResultKHR(**operation);
+    }
+
+    if (result != vk::Result::eSuccess && result != vk::Result::eOperationNotDeferredKHR) {
+        throw std::runtime_error("failed to create a m_pipeline: " + vk::to_string(result));
+    }
+    m_pipeline = vk::UniquePipeline{
+        pipeline, vk::ObjectDestroy<vk::Device, VULKAN_HPP_DEFAULT_DISPATCHER_TYPE>{device}};
+}
+
 void RayTracingPipeline::createSBT() {
     // Get Ray Tracing Properties
     auto rtProperties =
@@ -448,7 +525,7 @@ void RayTracingPipeline::createSBT() {
     vk::DeviceSize sbtSize = m_raygenRegion.size + m_missRegion.size + m_hitRegion.size;
     m_sbtBuffer = m_context->createBuffer({
         .usage = BufferUsage::ShaderBindingTable,
-        .memory = MemoryUsage::Host,
+        .memory = MemoryIntent::Dynamic,
         .size = sbtSize,
     });
 
@@ -0,0 +1,118 @@
+#include "reactive/Graphics/PipelineCache.hpp"
+
+#include <cstring>
+#include <fstream>
+
+#include "reactive/Timer/CPUTimer.hpp"
+#include "reactive/common.hpp"
+
+namespace rv {
+namespace {
+constexpr uint32_t FileMagic = 0x43505652;  // "RVPC"
+constexpr uint32_t FileVersion = 1;
+}  // namespace
+
+struct PipelineCache::FileHeader {
+    uint32_t magic = FileMagic;
+    uint32_t version = FileVersion;
+    uint32_t vendorID = 0;
+    uint32_t deviceID = 0;
+    uint32_t driverVersion = 0;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE] = {};
+    uint64_t dataSize = 0;
+    uint64_t dataHash = 0;
+
+    auto operator==(const FileHeader& other) const -> bool {
+        return std::memcmp(this, &other, sizeof(FileHeader)) == 0;
+    }
+};
+
+PipelineCache::PipelineCache(const Context& context) : m_context{&context} {
+    m_props = m_context->getPhysicalDevice().getProperties();
+    m_cache = m_context->getDevice().createPipelineCacheUnique({});
+}
+
+auto PipelineCache::load(const std::filesystem::path& path) -> bool {
+    CPUTimer timer;
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        spdlog::info("PipelineCache: {} not found. Starting cold.", path.string());
+        return false;
+    }
+
+    auto fileSize = static_cast<size_t>(file.tellg());
+    file.seekg(0);
+    FileHeader header;
+    std::memset(&header, 0, sizeof(FileHeader));
+    if (fileSize < sizeof(FileHeader) ||
+        !file.read(reinterpret_cast<char*>(&header), sizeof(FileHeader))) {
+        spdlog::warn("PipelineCache: {} is truncated. Starting cold.", path.string());
+        return false;
+    }
+
+    std::vector<uint8_t> data(fileSize - sizeof(FileHeader));
+    if (!file.read(reinterpret_cast<char*>(data.data()), data.size())) {
+        spdlog::warn("PipelineCache: failed to read {}. Starting cold.", path.string());
+        return false;
+    }
+
+    // Device, driver and contents must all match
+    if (header != makeHeader(data.size(), hashBytes(data.data(), data.size()))) {
+        spdlog::warn("PipelineCache: {} was written by another device or driver, or is corrupted. Starting cold.",
+                     path.string());
+        return false;
+    }
+
+    vk::PipelineCacheCreateInfo cacheInfo;
+    cacheInfo.setInitialDataSize(data.size());
+    cacheInfo.setPInitialData(data.data());
+    m_cache = m_context->getDevice().createPipelineCacheUnique(cacheInfo);
+    m_warm = true;
+
+    spdlog::info("PipelineCache: loaded {} bytes from {} in {:.2f} ms", data.size(), path.string(),
+                 timer.elapsedInMilli());
+    return true;
+}
+
+void PipelineCache::save(const std::filesystem::path& path) const {
+    CPUTimer timer;
+    std::vector<uint8_t> data = m_context->getDevice().getPipelineCacheData(*m_cache);
+    FileHeader header = makeHeader(data.size(), hashBytes(data.data(), data.size()));
+
+    std::filesystem::path tempPath = path;
+    tempPath += ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+        if (!file) {
+            spdlog::warn("PipelineCache: failed to write {}", tempPath.string());
+            return;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tempPath, path, error);
+    if (error) {
+        spdlog::warn("PipelineCache: failed to replace {}: {}", path.string(), error.message());
+        std::filesystem::remove(tempPath, error);
+        return;
+    }
+    spdlog::info("PipelineCache: saved {} bytes to {} in {:.2f} ms", data.size(), path.string(),
+                 timer.elapsedInMilli());
+}
+
+auto PipelineCache::makeHeader(size_t dataSize, uint64_t dataHash) const -> FileHeader {
+    FileHeader header;
+    std::memset(&header, 0, sizeof(FileHeader));
+    header.magic = FileMagic;
+    header.version = FileVersion;
+    header.vendorID = m_props.vendorID;
+    header.deviceID = m_props.deviceID;
+    header.driverVersion = m_props.driverVersion;
+    std::memcpy(header.pipelineCacheUUID, m_props.pipelineCacheUUID.data(), VK_UUID_SIZE);
+    header.dataSize = dataSize;
+    header.dataHash = dataHash;
+    return header;
+}
+}  // namespace rv
@@ -0,0 +1,270 @@
+#include "reactive/Graphics/PipelineRegistry.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#include "reactive/Graphics/Pipeline.hpp"
+#include "reactive/Graphics/Shader.hpp"
+#include "reactive/common.hpp"
+
+namespace rv {
+namespace {
+// Stored in place of a state given as "dynamic"
+constexpr uint64_t DynamicWord = ~0ull;
+
+template <typename T>
+auto toWord(T value) -> uint64_t {
+    if constexpr (std::is_same_v<T, float>) {
+        return std::bit_cast<uint32_t>(value);
+    } else if constexpr (std::is_enum_v<T>) {
+        return static_cast<uint64_t>(value);
+    } else if constexpr (vk::isVulkanHandleType<T>::value) {
+        return uint64_t(static_cast<typename T::CType>(value));
+    } else {
+        // vk::Flags
+        return static_cast<typename T::MaskType>(value);
+    }
+}
+
+template <typename T>
+void addState(std::vector<uint64_t>& key, const std::variant<T, std::string>& state) {
+    const T* value = std::get_if<T>(&state);
+    key.push_back(value ? toWord(*value) : DynamicWord);
+}
+
+void addShader(std::vector<uint64_t>& key,
+               std::vector<ShaderHandle>& shaders,
+               const ShaderHandle& shader) {
+    if (!shader) {
+        key.push_back(0);
+        return;
+    }
+    shaders.push_back(shader);
+    key.push_back(shader->getCodeHash());
+    key.push_back(shader->getSpvCodeSize());
+    key.push_back(toWord(shader->getStage()));
+}
+
+template <typename CreateInfo>
+void addLayout(std::vector<uint64_t>& key, const CreateInfo& createInfo) {
+    // NOTE: DescriptorSetLayoutCache gives identical layouts the same handle
+    key.push_back(toWord(createInfo.descSetLayout));
+    key.push_back(createInfo.bindless);
+    key.push_back(toWord(createInfo.pushDescSetLayout));
+    key.push_back(createInfo.pushSize);
+}
+
+void addFormats(std::vector<uint64_t>& key,
+                ArrayProxy<vk::Format> colorFormats,
+                vk::Format depthFormat) {
+    key.push_back(colorFormats.size());
+    for (vk::Format format : colorFormats) {
+        key.push_back(toWord(format));
+    }
+    key.push_back(toWord(depthFormat));
+}
+
+template <typename CreateInfo>
+void addRaster(std::vector<uint64_t>& key, const CreateInfo& createInfo) {
+    addState(key, createInfo.polygonMode);
+    addState(key, createInfo.cullMode);
+    addState(key, createInfo.frontFace);
+    addState(key, createInfo.lineWidth);
+    key.push_back(createInfo.alphaBlending);
+}
+
+auto copyCode(const ShaderHandle& shader) -> std::vector<uint8_t> {
+    const auto* code = static_cast<const uint8_t*>(shader->getSpvCodePtr());
+    return {code, code + shader->getSpvCodeSize()};
+}
+
+auto isSameCode(const std::vector<std::vector<uint8_t>>& codes,
+                const std::vector<ShaderHandle>& shaders) -> bool {
+    if (codes.size() != shaders.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < codes.size(); i++) {
+        if (codes[i].size() != shaders[i]->getSpvCodeSize() ||
+            std::memcmp(codes[i].data(), shaders[i]->getSpvCodePtr(), codes[i].size()) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Keeps create infos of different pipeline types apart
+enum class PipelineType : uint64_t {
+    Graphics,
+    MeshShader,
+    Compute,
+    RayTracing,
+};
+}  // namespace
+
+auto PipelineRegistry::KeyHash::operator()(const Key& key) const -> size_t {
+    size_t hash = 0;
+    for (uint64_t word : key) {
+        hashCombine(hash, word);
+    }
+    return hash;
+}
+
+PipelineRegistry::PipelineRegistry(const Context& context) : m_context{&context} {}
+
+template <typename T, typename CreateInfo>
+auto PipelineRegistry::findOrCreate(const Key& key,
+                                    const std::vector<ShaderHandle>& shaders,
+                                    const CreateInfo& createInfo) -> std::shared_ptr<T> {
+    std::promise<PipelineHandle> promise;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        Entry& entry = m_entries[key];
+        PipelineHandle pipeline = entry.pipeline.lock();
+        if (pipeline || entry.pending.valid()) {
+            // NOTE: Shaders are keyed by a 64-bit hash, so the code is compared on a match
+            if (!isSameCode(entry.shaderCodes, shaders)) {
+                spdlog::warn("PipelineRegistry: SPIR-V hash collision, pipeline not shared.");
+                m_missCount++;
+                lock.unlock();
+                return std::make_shared<T>(*m_context, createInfo);
+            }
+            m_hitCount++;
+            if (pipeline) {
+                return std::static_pointer_cast<T>(pipeline);
+            }
+            // Another thread is building the same pipeline
+            std::shared_future<PipelineHandle> pending = entry.pending;
+            lock.unlock();
+            return std::static_pointer_cast<T>(pending.get());
+        }
+        m_missCount++;
+        entry.shaderCodes.clear();
+        for (const auto& shader : shaders) {
+            entry.shaderCodes.push_back(copyCode(shader));
+        }
+        entry.pending = promise.get_future().share();
+        if (m_entries.size() > m_pruneThreshold) {
+            pruneLocked();
+        }
+    }
+
+    // NOTE: Built outside the lock so that different pipelines are created in parallel.
+    // Pending entries are never pruned, so `key` is still present below.
+    std::shared_ptr<T> pipeline;
+    try {
+        pipeline = std::make_shared<T>(*m_context, createInfo);
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_entries.at(key).pending = {};
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Entry& entry = m_entries.at(key);
+    entry.pipeline = pipeline;
+    entry.pending = {};
+    promise.set_value(pipeline);
+    return pipeline;
+}
+
+auto PipelineRegistry::getOrCreate(const GraphicsPipelineCreateInfo& createInfo)
+    -> GraphicsPipelineHandle {
+    Key key{toWord(PipelineType::Graphics)};
+    std::vector<ShaderHandle> shaders;
+    addLayout(key, createInfo);
+    addShader(key, shaders, createInfo.vertexShader);
+    addShader(key, shaders, createInfo.fragmentShader);
+    key.push_back(createInfo.vertexStride);
+    key.push_back(createInfo.vertexAttributes.size());
+    for (const auto& attribute : createInfo.vertexAttributes) {
+        key.push_back(attribute.offset);
+        key.push_back(toWord(attribute.format));
+    }
+    addFormats(key, createInfo.colorFormats, createInfo.depthFormat);
+    key.push_back(toWord(createInfo.topology));
+    addRaster(key, createInfo);
+    return findOrCreate<GraphicsPipeline>(key, shaders, createInfo);
+}
+
+auto PipelineRegistry::getOrCreate(const MeshShaderPipelineCreateInfo& createInfo)
+    -> MeshShaderPipelineHandle {
+    Key key{toWord(PipelineType::MeshShader)};
+    std::vector<ShaderHandle> shaders;
+    addLayout(key, createInfo);
+    addShader(key, shaders, createInfo.taskShader);
+    addShader(key, shaders, createInfo.meshShader);
+    addShader(key, shaders, createInfo.fragmentShader);
+    addFormats(key, createInfo.colorFormats, createInfo.depthFormat);
+    addRaster(key, createInfo);
+    return findOrCreate<MeshShaderPipeline>(key, shaders, createInfo);
+}
+
+auto PipelineRegistry::getOrCreate(const ComputePipelineCreateInfo& createInfo)
+    -> ComputePipelineHandle {
+    Key key{toWord(PipelineType::Compute)};
+    std::vector<ShaderHandle> shaders;
+    addLayout(key, createInfo);
+    addShader(key, shaders, createInfo.computeShader);
+    return findOrCreate<ComputePipeline>(key, shaders, createInfo);
+}
+
+auto PipelineRegistry::getOrCreate(const RayTracingPipelineCreateInfo& createInfo)
+    -> RayTracingPipelineHandle {
+    // NOTE: callableGroups are not used by RayTracingPipeline
+    Key key{toWord(PipelineType::RayTracing)};
+    std::vector<ShaderHandle> shaders;
+    addLayout(key, createInfo);
+    addShader(key, shaders, createInfo.rgenGroup.raygenShader);
+    key.push_back(createInfo.missGroups.size());
+    for (const auto& group : createInfo.missGroups) {
+        addShader(key, shaders, group.missShader);
+    }
+    key.push_back(createInfo.hitGroups.size());
+    for (const auto& group : createInfo.hitGroups) {
+        addShader(key, shaders, group.chitShader);
+        addShader(key, shaders, group.ahitShader);
+    }
+    key.push_back(createInfo.maxRayRecursionDepth);
+    return findOrCreate<RayTracingPipeline>(key, shaders, createInfo);
+}
+
+auto PipelineRegistry::getHitCount() const -> uint64_t {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_hitCount;
+}
+
+auto PipelineRegistry::getMissCount() const -> uint64_t {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_missCount;
+}
+
+auto PipelineRegistry::getPipelineCount() const -> uint32_t {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint32_t count = 0;
+    for (const auto& [key, entry] : m_entries) {
+        count += !entry.pipeline.expired();
+    }
+    return count;
+}
+
+void PipelineRegistry::prune() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    pruneLocked();
+}
+
+void PipelineRegistry::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::erase_if(m_entries, [](const auto& item) { return !item.second.pending.valid(); });
+    m_pruneThreshold = std::max(MinPruneThreshold, m_entries.size() * 2);
+}
+
+void PipelineRegistry::pruneLocked() {
+    std::erase_if(m_entries, [](const auto& item) {
+        return item.second.pipeline.expired() && !item.second.pending.valid();
+    });
+    // NOTE: Doubled so that pruning stays amortized when most pipelines are alive
+    m_pruneThreshold = std::max(MinPruneThreshold, m_entries.size() * 2);
+}
+}  // namespace rv
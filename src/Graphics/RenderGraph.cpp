@@ -0,0 +1,579 @@
+#include "reactive/Graphics/RenderGraph.hpp"
+
+#include "reactive/Graphics/Buffer.hpp"
+#include "reactive/Graphics/CommandBuffer.hpp"
+#include "reactive/Graphics/Image.hpp"
+#include "reactive/Graphics/UploadRing.hpp"
+#include "reactive/common.hpp"
+
+namespace rv {
+namespace {
+auto isSameImage(const ImageCreateInfo& a, const ImageCreateInfo& b) -> bool {
+    if (a.usage != b.usage || a.extent != b.extent || a.imageType != b.imageType ||
+        a.format != b.format || a.mipLevels != b.mipLevels || a.bindless != b.bindless ||
+        a.debugName != b.debugName) {
+        return false;
+    }
+    if (a.viewInfo.has_value() != b.viewInfo.has_value() ||
+        (a.viewInfo && a.viewInfo->aspect != b.viewInfo->aspect)) {
+        return false;
+    }
+    if (a.samplerInfo.has_value() != b.samplerInfo.has_value()) {
+        return false;
+    }
+    return !a.samplerInfo || (a.samplerInfo->filter == b.samplerInfo->filter &&
+                              a.samplerInfo->addressMode == b.samplerInfo->addressMode &&
+                              a.samplerInfo->mipmapMode == b.samplerInfo->mipmapMode);
+}
+}  // namespace
+
+void RenderGraphPassBuilder::read(ImageHandle image, const ResourceAccess& access) {
+    uint32_t resource = m_graph->getResourceIndex(image.get(), image, {});
+    m_graph->addAccess(m_passIndex, resource, access, false);
+}
+
+void RenderGraphPassBuilder::read(BufferHandle buffer, const ResourceAccess& access) {
+    uint32_t resource = m_graph->getResourceIndex(buffer.get(), {}, buffer);
+    m_graph->addAccess(m_passIndex, resource, access, false);
+}
+
+void RenderGraphPassBuilder::write(ImageHandle image, const ResourceAccess& access) {
+    uint32_t resource = m_graph->getResourceIndex(image.get(), image, {});
+    m_graph->addAccess(m_passIndex, resource, access, true);
+}
+
+void RenderGraphPassBuilder::write(BufferHandle buffer, const ResourceAccess& access) {
+    uint32_t resource = m_graph->getResourceIndex(buffer.get(), {}, buffer);
+    m_graph->addAccess(m_passIndex, resource, access, true);
+}
+
+void RenderGraphPassBuilder::read(TransientImage image, const ResourceAccess& access) {
+    m_graph->addAccess(m_passIndex, image.index, access, false);
+}
+
+void RenderGraphPassBuilder::write(TransientImage image, const ResourceAccess& access) {
+    m_graph->addAccess(m_passIndex, image.index, access, true);
+}
+
+RenderGraph::RenderGraph(const Context& context) : m_context{&context} {}
+
+void RenderGraph::addPass(std::string name, const SetupFunc& setup, ExecuteFunc execute) {
+    uint32_t passIndex = static_cast<uint32_t>(m_passes.size());
+    m_passes.push_back({std::move(name), std::move(execute)});
+
+    RenderGraphPassBuilder builder{*this, passIndex};
+    setup(builder);
+    m_passes[passIndex].sideEffect = builder.m_sideEffect;
+    m_compiled = false;
+}
+
+void RenderGraph::setOutput(ImageHandle image) {
+    m_resources[getResourceIndex(image.get(), image, {})].output = true;
+    m_compiled = false;
+}
+
+void RenderGraph::setOutput(BufferHandle buffer) {
+    m_resources[getResourceIndex(buffer.get(), {}, buffer)].output = true;
+    m_compiled = false;
+}
+
+auto RenderGraph::createTransientImage(const ImageCreateInfo& createInfo) -> TransientImage {
+    uint32_t index = static_cast<uint32_t>(m_resources.size());
+    m_resources.push_back({.transientInfo = createInfo});
+    m_compiled = false;
+    return {index};
+}
+
+auto RenderGraph::getImage(TransientImage image) const -> ImageHandle {
+    RV_ASSERT(m_compiled, "Transient images are created by compile().");
+    return m_resources[image.index].image;
+}
+
+void RenderGraph::reset() {
+    m_passes.clear();
+    m_resources.clear();
+    m_resourceIndices.clear();
+    m_order.clear();
+    m_levelOffsets.clear();
+    m_imageBarriers.clear();
+    m_imageBarrierResources.clear();
+    m_bufferBarriers.clear();
+    m_compiled = false;
+    m_stats = {};
+}
+
+void RenderGraph::compile() {
+    m_stats = {};
+    m_stats.passCount = static_cast<uint32_t>(m_passes.size());
+    cullPasses();
+    sortPasses();
+    allocateTransients();
+    buildBarriers();
+    m_compiled = true;
+}
+
+void RenderGraph::execute(CommandBufferHandle commandBuffer) {
+    RV_ASSERT(m_compiled, "RenderGraph must be compiled before execute().");
+
+    for (uint32_t level = 0; level < getLevelCount(); level++) {
+        const auto& imageBarriers = m_imageBarriers[level];
+        const auto& bufferBarriers = m_bufferBarriers[level];
+        if (!imageBarriers.empty() || !bufferBarriers.empty()) {
+            // NOTE: Barriers queued by the previous pass are ordered before the graph's
+            commandBuffer->flushBarriers();
+            vk::DependencyInfo dependencyInfo;
+            dependencyInfo.setImageMemoryBarriers(imageBarriers);
+            dependencyInfo.setBufferMemoryBarriers(bufferBarriers);
+            commandBuffer->m_commandBuffer->pipelineBarrier2(dependencyInfo);
+        }
+
+        // NOTE: Updated before the passes so that CommandBuffer helpers in them see the new layout
+        for (uint32_t j = 0; j < imageBarriers.size(); j++) {
+            const auto& barrier = imageBarriers[j];
+            Image& image = *m_resources[m_imageBarrierResources[level][j]].image;
+            for (auto& state : image.m_subresourceStates) {
+                state = {barrier.newLayout, barrier.dstStageMask, barrier.dstAccessMask};
+            }
+        }
+
+        for (uint32_t i = m_levelOffsets[level]; i < m_levelOffsets[level + 1]; i++) {
+            Pass& pass = m_passes[m_order[i]];
+            commandBuffer->beginDebugLabel(pass.name.c_str());
+            pass.execute(commandBuffer);
+            commandBuffer->endDebugLabel();
+        }
+    }
+}
+
+auto RenderGraph::getPassOrder() const -> std::vector<std::string> {
+    std::vector<std::string> names;
+    for (uint32_t passIndex : m_order) {
+        names.push_back(m_passes[passIndex].name);
+    }
+    return names;
+}
+
+auto RenderGraph::getResourceIndex(const void* key, ImageHandle image, BufferHandle buffer)
+    -> uint32_t {
+    RV_ASSERT(key, "RenderGraph resource is null.");
+    auto it = m_resourceIndices.find(key);
+    if (it != m_resourceIndices.end()) {
+        return it->second;
+    }
+    uint32_t index = static_cast<uint32_t>(m_resources.size());
+    m_resources.push_back({std::move(image), std::move(buffer)});
+    m_resourceIndices[key] = index;
+    return index;
+}
+
+void RenderGraph::addAccess(uint32_t passIndex,
+                            uint32_t resource,
+                            const ResourceAccess& access,
+                            bool write) {
+    RV_ASSERT(!write || isWriteAccess(access.access),
+              "Pass {} declares a write without write access.", m_passes[passIndex].name);
+
+    // Merge accesses to the same resource in a pass
+    for (auto& passAccess : m_passes[passIndex].accesses) {
+        if (passAccess.resource != resource) {
+            continue;
+        }
+        bool isImage = m_resources[resource].image || m_resources[resource].transientInfo;
+        RV_ASSERT(!isImage || passAccess.access.layout == access.layout,
+                  "Pass {} uses an image in two layouts.", m_passes[passIndex].name);
+        passAccess.access.stage |= access.stage;
+        passAccess.access.access |= access.access;
+        passAccess.write |= write;
+        return;
+    }
+    m_passes[passIndex].accesses.push_back({resource, access, write});
+}
+
+void RenderGraph::cullPasses() {
+    std::vector<bool> needed(m_resources.size(), false);
+    for (uint32_t i = 0; i < m_resources.size(); i++) {
+        needed[i] = m_resources[i].output;
+    }
+
+    // Walk backwards from the outputs.
+    // NOTE: Writers are kept conservatively because a pass may
+    // write only a part of the resource.
+    m_order.clear();
+    for (int32_t i = static_cast<int32_t>(m_passes.size()) - 1; i >= 0; i--) {
+        const Pass& pass = m_passes[i];
+        bool alive = pass.sideEffect;
+        for (const auto& passAccess : pass.accesses) {
+            alive |= passAccess.write && needed[passAccess.resource];
+        }
+        if (!alive) {
+            m_stats.culledPassCount++;
+            continue;
+        }
+        for (const auto& passAccess : pass.accesses) {
+            needed[passAccess.resource] = true;
+        }
+        m_order.push_back(static_cast<uint32_t>(i));
+    }
+    std::ranges::reverse(m_order);
+}
+
+void RenderGraph::sortPasses() {
+    // Dependency level = longest chain of dependencies before the pass.
+    // Passes of the same level are independent, so they share one
+    // barrier batch recorded before the level.
+    struct Usage {
+        int32_t lastWriter = -1;
+        std::vector<uint32_t> readers;
+
+        // Reads in another layout wait for the readers before them,
+        // since the layout transition is a write
+        vk::ImageLayout readLayout = vk::ImageLayout::eUndefined;
+        uint32_t readLevel = 0;
+    };
+    std::vector<Usage> usages(m_resources.size());
+    std::vector<uint32_t> levels(m_passes.size(), 0);
+
+    auto getReadLevel = [&](const Usage& usage, vk::ImageLayout layout) {
+        uint32_t level = usage.readLevel;
+        if (!usage.readers.empty() && layout != usage.readLayout) {
+            for (uint32_t reader : usage.readers) {
+                level = std::max(level, levels[reader] + 1);
+            }
+        }
+        return level;
+    };
+
+    for (uint32_t passIndex : m_order) {
+        uint32_t level = 0;
+        for (const auto& passAccess : m_passes[passIndex].accesses) {
+            const Usage& usage = usages[passAccess.resource];
+            if (usage.lastWriter >= 0) {
+                level = std::max(level, levels[usage.lastWriter] + 1);
+            }
+            if (passAccess.write) {
+                for (uint32_t reader : usage.readers) {
+                    level = std::max(level, levels[reader] + 1);
+                }
+            } else {
+                level = std::max(level, getReadLevel(usage, passAccess.access.layout));
+            }
+        }
+        levels[passIndex] = level;
+
+        for (const auto& passAccess : m_passes[passIndex].accesses) {
+            Usage& usage = usages[passAccess.resource];
+            if (passAccess.write) {
+                usage.lastWriter = static_cast<int32_t>(passIndex);
+                usage.readers.clear();
+                usage.readLevel = 0;
+            } else {
+                usage.readLevel = getReadLevel(usage, passAccess.access.layout);
+                usage.readLayout = passAccess.access.layout;
+                usage.readers.push_back(passIndex);
+            }
+        }
+    }
+
+    std::ranges::stable_sort(m_order, {}, [&](uint32_t passIndex) { return levels[passIndex]; });
+
+    m_levelOffsets.clear();
+    for (uint32_t i = 0; i < m_order.size(); i++) {
+        while (m_levelOffsets.size() <= levels[m_order[i]]) {
+            m_levelOffsets.push_back(i);
+        }
+    }
+    m_levelOffsets.push_back(static_cast<uint32_t>(m_order.size()));
+}
+
+void RenderGraph::allocateTransients() {
+    struct Lifetime {
+        uint32_t resource;
+        uint32_t first;
+        uint32_t last;
+        vk::MemoryRequirements requirements;
+    };
+
+    for (auto& resource : m_resources) {
+        if (resource.transientInfo) {
+            resource.image = {};
+            resource.aliasPrevious = -1;
+        }
+    }
+    for (auto& cache : m_transientImages) {
+        cache.used = false;
+    }
+
+    // Lifetimes in levels, since passes of a level have no barriers between them.
+    // Culled transients get no memory.
+    std::vector<std::optional<std::pair<uint32_t, uint32_t>>> ranges(m_resources.size());
+    for (uint32_t level = 0; level < getLevelCount(); level++) {
+        for (uint32_t i = m_levelOffsets[level]; i < m_levelOffsets[level + 1]; i++) {
+            for (const auto& passAccess : m_passes[m_order[i]].accesses) {
+                auto& range = ranges[passAccess.resource];
+                range = range ? std::pair{range->first, level} : std::pair{level, level};
+            }
+        }
+    }
+    std::vector<Lifetime> lifetimes;
+    for (uint32_t i = 0; i < m_resources.size(); i++) {
+        if (m_resources[i].transientInfo && ranges[i]) {
+            vk::MemoryRequirements requirements =
+                Image::getMemoryRequirements(*m_context, *m_resources[i].transientInfo);
+            lifetimes.push_back({i, ranges[i]->first, ranges[i]->second, requirements});
+            m_stats.transientUnaliasedSize += requirements.size;
+        }
+    }
+
+    // Greedy packing: largest images first, each into the first slot
+    // whose users don't overlap with it
+    std::ranges::sort(lifetimes, std::greater{},
+                      [](const Lifetime& lifetime) { return lifetime.requirements.size; });
+    struct SlotPlan {
+        vk::MemoryRequirements requirements;
+        std::vector<const Lifetime*> users;
+    };
+    std::vector<SlotPlan> plans;
+    for (const auto& lifetime : lifetimes) {
+        auto overlaps = [&](const Lifetime* user) {
+            return user->first <= lifetime.last && lifetime.first <= user->last;
+        };
+        SlotPlan* target = nullptr;
+        for (auto& plan : plans) {
+            if ((plan.requirements.memoryTypeBits & lifetime.requirements.memoryTypeBits) &&
+                std::ranges::none_of(plan.users, overlaps)) {
+                target = &plan;
+                break;
+            }
+        }
+        if (!target) {
+            target = &plans.emplace_back(SlotPlan{lifetime.requirements, {}});
+        }
+        target->requirements.size = std::max(target->requirements.size, lifetime.requirements.size);
+        target->requirements.alignment =
+            std::max(target->requirements.alignment, lifetime.requirements.alignment);
+        target->requirements.memoryTypeBits &= lifetime.requirements.memoryTypeBits;
+        target->users.push_back(&lifetime);
+    }
+
+    // Keep resources alive until the GPU has finished the previous frames
+    UploadRing& uploadRing = m_context->getUploadRing();
+    auto retireSlotImages = [&](uint32_t slot) {
+        std::erase_if(m_transientImages, [&](TransientImageCache& cache) {
+            if (cache.slot != slot) {
+                return false;
+            }
+            uploadRing.retire(cache.image);
+            return true;
+        });
+    };
+    for (uint32_t slot = static_cast<uint32_t>(plans.size()); slot < m_transientSlots.size();
+         slot++) {
+        retireSlotImages(slot);
+        uploadRing.retire(m_transientSlots[slot].memory);
+    }
+    m_transientSlots.resize(plans.size());
+
+    for (uint32_t slot = 0; slot < plans.size(); slot++) {
+        SlotPlan& plan = plans[slot];
+        TransientSlot& transientSlot = m_transientSlots[slot];
+
+        // Reuse the memory if the plan fits in it
+        bool fits = transientSlot.memory &&
+                    transientSlot.requirements.size >= plan.requirements.size &&
+                    transientSlot.memory->offset % plan.requirements.alignment == 0 &&
+                    (plan.requirements.memoryTypeBits & (1u << transientSlot.memory->memoryTypeIndex));
+        if (!fits) {
+            if (transientSlot.memory) {
+                retireSlotImages(slot);
+                uploadRing.retire(transientSlot.memory);
+            }
+            const Context* context = m_context;
+            MemoryAllocation allocation = m_context->getMemoryAllocator().allocate(
+                plan.requirements, Context::getMemoryTypeRequest(MemoryIntent::GpuOnly), false,
+                "Transient");
+            transientSlot.memory = std::shared_ptr<MemoryAllocation>(
+                new MemoryAllocation{allocation}, [context](MemoryAllocation* memory) {
+                    context->getMemoryAllocator().free(*memory);
+                    delete memory;
+                });
+            transientSlot.requirements = plan.requirements;
+        }
+        m_stats.transientMemorySize += transientSlot.requirements.size;
+
+        std::ranges::sort(plan.users, {}, &Lifetime::first);
+        for (uint32_t i = 0; i < plan.users.size(); i++) {
+            Resource& resource = m_resources[plan.users[i]->resource];
+            resource.aliasPrevious = i > 0 ? static_cast<int32_t>(plan.users[i - 1]->resource) : -1;
+
+            // Reuse an identical image in the same slot
+            for (auto& cache : m_transientImages) {
+                if (!cache.used && cache.slot == slot &&
+                    isSameImage(cache.createInfo, *resource.transientInfo)) {
+                    cache.used = true;
+                    resource.image = cache.image;
+                    break;
+                }
+            }
+            if (!resource.image) {
+                resource.image = std::make_shared<Image>(*m_context, *resource.transientInfo,
+                                                         transientSlot.memory->memory,
+                                                         transientSlot.memory->offset);
+                m_transientImages.push_back({*resource.transientInfo, slot, resource.image, true});
+            }
+        }
+    }
+
+    // Drop images that were not declared in this graph
+    std::erase_if(m_transientImages, [&](TransientImageCache& cache) {
+        if (cache.used) {
+            return false;
+        }
+        uploadRing.retire(cache.image);
+        return true;
+    });
+}
+
+void RenderGraph::buildBarriers() {
+    // NOTE: Work before the graph is unknown, so the first use of
+    // each resource waits for all previous writes.
+    // Transient images start undefined. Slot memory and cached images are reused
+    // across executions, so the first image of a slot also waits for all previous
+    // work, and later images wait only for the previous image in the same memory.
+    std::vector<ResourceState> states(m_resources.size());
+    for (uint32_t i = 0; i < m_resources.size(); i++) {
+        if (m_resources[i].image && !m_resources[i].transientInfo) {
+            RV_ASSERT(m_resources[i].image->hasUniformLayout(),
+                      "RenderGraph requires images whose mips share one layout.");
+            states[i].layout = m_resources[i].image->getLayout();
+        }
+        states[i].writeStage = vk::PipelineStageFlagBits2::eAllCommands;
+        states[i].writeAccess = vk::AccessFlagBits2::eMemoryWrite;
+    }
+
+    std::vector<bool> started(m_resources.size(), false);
+    m_imageBarriers.assign(getLevelCount(), {});
+    m_imageBarrierResources.assign(getLevelCount(), {});
+    m_bufferBarriers.assign(getLevelCount(), {});
+    for (uint32_t level = 0; level < getLevelCount(); level++) {
+        // Merge the accesses of the level into one batch.
+        // sortPasses() puts writes and reads in different layouts in different levels.
+        std::vector<PassAccess> accesses;
+        for (uint32_t i = m_levelOffsets[level]; i < m_levelOffsets[level + 1]; i++) {
+            for (const auto& passAccess : m_passes[m_order[i]].accesses) {
+                auto it = std::ranges::find(accesses, passAccess.resource, &PassAccess::resource);
+                if (it == accesses.end()) {
+                    accesses.push_back(passAccess);
+                    continue;
+                }
+                RV_ASSERT(!it->write && !passAccess.write &&
+                              it->access.layout == passAccess.access.layout,
+                          "Passes of the same level conflict on a resource.");
+                it->access.stage |= passAccess.access.stage;
+                it->access.access |= passAccess.access.access;
+            }
+        }
+
+        for (const auto& [resource, access, write] : accesses) {
+            ResourceState& state = states[resource];
+            int32_t aliasPrevious = m_resources[resource].aliasPrevious;
+            if (!started[resource] && aliasPrevious >= 0) {
+                // Aliasing barrier: wait until the previous image is no longer used
+                const ResourceState& previous = states[aliasPrevious];
+                state.writeStage = previous.writeStage | previous.readStage;
+                state.writeAccess = previous.writeAccess;
+            }
+            started[resource] = true;
+            const ImageHandle& image = m_resources[resource].image;
+            bool layoutChanged = image && access.layout != vk::ImageLayout::eUndefined &&
+                                 access.layout != state.layout;
+
+            vk::PipelineStageFlags2 srcStage;
+            vk::AccessFlags2 srcAccess;
+            bool needBarrier = false;
+            if (write || layoutChanged) {
+                // Write-after-write and write-after-read.
+                // Layout transitions are writes too.
+                srcStage = state.writeStage | state.readStage;
+                srcAccess = state.writeAccess;
+                needBarrier = layoutChanged || srcStage;
+            } else if (state.writeAccess) {
+                // Read-after-write, unless the write is already visible to this read
+                bool visible = !(access.stage & ~state.visibleStage) &&
+                               !(access.access & ~state.visibleAccess);
+                srcStage = state.writeStage;
+                srcAccess = state.writeAccess;
+                needBarrier = !visible;
+            }
+
+            if (needBarrier) {
+                if (image) {
+                    vk::ImageAspectFlags aspect = image->getAspectMask();
+                    if (!aspect) {
+                        aspect = vk::ImageAspectFlagBits::eColor;
+                    }
+                    vk::ImageMemoryBarrier2 barrier;
+                    barrier.setSrcStageMask(srcStage);
+                    barrier.setSrcAccessMask(srcAccess);
+                    barrier.setDstStageMask(access.stage);
+                    barrier.setDstAccessMask(access.access);
+                    barrier.setOldLayout(state.layout);
+                    barrier.setNewLayout(layoutChanged ? access.layout : state.layout);
+                    barrier.setImage(image->getImage());
+                    barrier.setSubresourceRange(
+                        {aspect, 0, image->getMipLevels(), 0, image->getLayerCount()});
+                    m_imageBarriers[level].push_back(barrier);
+                    m_imageBarrierResources[level].push_back(resource);
+                    m_stats.imageBarrierCount++;
+                } else {
+                    vk::BufferMemoryBarrier2 barrier;
+                    barrier.setSrcStageMask(srcStage);
+                    barrier.setSrcAccessMask(srcAccess);
+                    barrier.setDstStageMask(access.stage);
+                    barrier.setDstAccessMask(access.access);
+                    barrier.setBuffer(m_resources[resource].buffer->getBuffer());
+                    barrier.setOffset(0);
+                    barrier.setSize(VK_WHOLE_SIZE);
+                    m_bufferBarriers[level].push_back(barrier);
+                    m_stats.bufferBarrierCount++;
+                }
+
+                if (write || layoutChanged) {
+                    state.visibleStage = access.stage;
+                    state.visibleAccess = access.access;
+                    state.readStage = {};
+                } else {
+                    state.visibleStage |= access.stage;
+                    state.visibleAccess |= access.access;
+                }
+                if (layoutChanged) {
+                    state.layout = access.layout;
+                }
+            }
+
+            if (write) {
+                state.writeStage = access.stage;
+                state.writeAccess = access.access;
+                state.visibleStage = {};
+                state.visibleAccess = {};
+                state.readStage = {};
+            } else {
+                state.readStage |= access.stage;
+            }
+        }
+
+        if (!m_imageBarriers[level].empty() || !m_bufferBarriers[level].empty()) {
+            m_stats.barrierBatchCount++;
+        }
+    }
+}
+
+auto RenderGraph::isWriteAccess(vk::AccessFlags2 access) -> bool {
+    constexpr vk::AccessFlags2 writeAccess =
+        vk::AccessFlagBits2::eShaderWrite | vk::AccessFlagBits2::eShaderStorageWrite |
+        vk::AccessFlagBits2::eColorAttachmentWrite |
+        vk::AccessFlagBits2::eDepthStencilAttachmentWrite | vk::AccessFlagBits2::eTransferWrite |
+        vk::AccessFlagBits2::eHostWrite | vk::AccessFlagBits2::eMemoryWrite |
+        vk::AccessFlagBits2::eAccelerationStructureWriteKHR;
+    return static_cast<bool>(access & writeAccess);
+}
+}  // namespace rv
@@ -1,5 +1,9 @@
 #include "reactive/Graphics/Shader.hpp"
 
+#include <SPIRV-Reflect/spirv_reflect.h>
+
+#include "reactive/common.hpp"
+
 namespace rv {
 Shader::Shader(const Context& context, const ShaderCreateInfo& createInfo)
     : m_pCode(createInfo.pCode), m_codeSize(createInfo.codeSize), m_stage(createInfo.stage) {
@@ -7,5 +11,46 @@ Shader::Shader(const Context& context, const ShaderCreateInfo& createInfo)
     moduleInfo.setPCode(reinterpret_cast<const uint32_t*>(m_pCode));
     moduleInfo.setCodeSize(m_codeSize);
     m_shaderModule = context.getDevice().createShaderModuleUnique(moduleInfo);
+
+    // NOTE: pCode is not owned, so hash and reflect while it is still valid
+    m_codeHash = hashBytes(m_pCode, m_codeSize);
+    reflectBindings();
+}
+
+void Shader::reflectBindings() {
+    SpvReflectShaderModule module;
+    SpvReflectResult result = spvReflectCreateShaderModule(m_codeSize, m_pCode, &module);
+    if (result != SPV_REFLECT_RESULT_SUCCESS) {
+        throw std::runtime_error("Failed to create SPIRV-Reflect shader module.");
+    }
+
+    uint32_t count = 0;
+    result = spvReflectEnumerateDescriptorBindings(&module, &count, nullptr);
+    if (result != SPV_REFLECT_RESULT_SUCCESS) {
+        spvReflectDestroyShaderModule(&module);
+        throw std::runtime_error("Failed to enumerate descriptor bindings.");
+    }
+
+    std::vector<SpvReflectDescriptorBinding*> bindings(count);
+    result = spvReflectEnumerateDescriptorBindings(&module, &count, bindings.data());
+    if (result != SPV_REFLECT_RESULT_SUCCESS) {
+        spvReflectDestroyShaderModule(&module);
+        throw std::runtime_error("Failed to enumerate descriptor bindings.");
+    }
+
+    m_bindings.reserve(count);
+    for (const auto* binding : bindings) {
+        m_bindings.push_back({
+            .name = binding->name,
+            .set = binding->set,
+            .binding = vk::DescriptorSetLayoutBinding()
+                           .setBinding(binding->binding)
+                           .setDescriptorType(static_cast<vk::DescriptorType>(binding->descriptor_type))
+                           .setDescriptorCount(binding->count)
+                           .setStageFlags(m_stage),
+        });
+    }
+
+    spvReflectDestroyShaderModule(&module);
 }
 }  // namespace rv
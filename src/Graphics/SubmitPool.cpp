@@ -0,0 +1,119 @@
+#include "reactive/Graphics/SubmitPool.hpp"
+
+#include "reactive/Graphics/CommandBuffer.hpp"
+#include "reactive/Graphics/Fence.hpp"
+
+namespace rv {
+struct SubmitState {
+    std::mutex mutex;
+    FenceHandle fence;
+
+    // Set once the fence has signaled. The fence is recycled after that.
+    bool finished = false;
+};
+
+auto SubmitFuture::finished() const -> bool {
+    if (!m_state) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    if (!m_state->finished && m_state->fence->finished()) {
+        m_state->finished = true;
+    }
+    return m_state->finished;
+}
+
+void SubmitFuture::wait() const {
+    if (!m_state) {
+        return;
+    }
+    // NOTE: SubmitPool never recycles the fence while this lock is held
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    if (!m_state->finished) {
+        m_state->fence->wait();
+        m_state->finished = true;
+    }
+}
+
+SubmitPool::SubmitPool(const Context& context) : m_context{&context} {}
+
+SubmitPool::~SubmitPool() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& submit : m_inflightSubmits) {
+        SubmitFuture future;
+        future.m_state = submit.state;
+        future.wait();
+    }
+    m_inflightSubmits.clear();
+}
+
+auto SubmitPool::acquireCommandBuffer(vk::QueueFlags flag) -> CommandBufferHandle {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    collectLocked();
+
+    auto& freeCommandBuffers = m_freeCommandBuffers[{flag, std::this_thread::get_id()}];
+    if (freeCommandBuffers.empty()) {
+        CommandBufferHandle commandBuffer = m_context->allocateCommandBuffer(flag);
+        commandBuffer->m_ownsStaging = true;
+        return commandBuffer;
+    }
+
+    // NOTE: Command pools are created with eResetCommandBuffer,
+    // so begin() implicitly resets the command buffer.
+    CommandBufferHandle commandBuffer = freeCommandBuffers.back();
+    freeCommandBuffers.pop_back();
+    return commandBuffer;
+}
+
+auto SubmitPool::submit(CommandBufferHandle commandBuffer) -> SubmitFuture {
+    FenceHandle fence;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        collectLocked();
+        if (m_freeFences.empty()) {
+            fence = m_context->createFence({.signaled = false});
+        } else {
+            fence = m_freeFences.back();
+            m_freeFences.pop_back();
+        }
+    }
+
+    m_context->submit(commandBuffer, fence);
+
+    auto state = std::make_shared<SubmitState>();
+    state->fence = fence;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_inflightSubmits.push_back({state, commandBuffer, std::this_thread::get_id()});
+
+    SubmitFuture future;
+    future.m_state = state;
+    return future;
+}
+
+void SubmitPool::collect() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    collectLocked();
+}
+
+void SubmitPool::collectLocked() {
+    std::erase_if(m_inflightSubmits, [&](InflightSubmit& submit) {
+        // Skip states that are being waited on
+        std::unique_lock<std::mutex> stateLock(submit.state->mutex, std::try_to_lock);
+        if (!stateLock.owns_lock()) {
+            return false;
+        }
+        if (!submit.state->finished && !submit.state->fence->finished()) {
+            return false;
+        }
+
+        submit.state->finished = true;
+        submit.state->fence->reset();
+        m_freeFences.push_back(std::move(submit.state->fence));
+        submit.commandBuffer->m_stagingBuffers.clear();
+        m_freeCommandBuffers[{submit.commandBuffer->getQueueFlags(), submit.tid}].push_back(
+            std::move(submit.commandBuffer));
+        return true;
+    });
+}
+}  // namespace rv
@@ -1,5 +1,7 @@
 #include "reactive/Graphics/Swapchain.hpp"
-#include "reactive/Graphics/Fence.hpp"
+#include "reactive/Graphics/DescriptorAllocator.hpp"
+#include "reactive/Graphics/DescriptorBuffer.hpp"
+#include "reactive/Graphics/UploadRing.hpp"
 
 namespace rv {
 rv::Swapchain::Swapchain(const Context& context,
@@ -8,6 +10,11 @@ rv::Swapchain::Swapchain(const Context& context,
                          uint32_t height,
                          vk::PresentModeKHR presentMode)
     : m_context{&context}, m_surface{surface}, m_presentMode{presentMode} {
+    m_context->getUploadRing().setFrameCount(m_inflightCount);
+    m_context->getDescriptorAllocator().setFrameCount(m_inflightCount);
+    if (m_context->hasDescriptorBuffer()) {
+        m_context->getDescriptorBuffer().setFrameCount(m_inflightCount);
+    }
     resize(width, height);
 }
 
@@ -66,28 +73,27 @@ void Swapchain::resize(uint32_t width, uint32_t height) {
     m_imageCount = static_cast<uint32_t>(m_swapchainImages.size());
 
     m_commandBuffers.resize(m_inflightCount);
-    m_fences.resize(m_inflightCount);
+    m_frameSubmits.resize(m_inflightCount);
     m_imageAcquiredSemaphores.resize(m_inflightCount);
     m_renderCompleteSemaphores.resize(m_inflightCount);
     for (uint32_t i = 0; i < m_inflightCount; i++) {
         m_commandBuffers[i] = m_context->allocateCommandBuffer();
-        m_fences[i] = m_context->createFence({.signaled = true});
         m_imageAcquiredSemaphores[i] = m_context->getDevice().createSemaphoreUnique({});
         m_renderCompleteSemaphores[i] = m_context->getDevice().createSemaphoreUnique({});
     }
 }
 
 void Swapchain::waitNextFrame() {
-    // Wait fence
-    m_fences[m_inflightIndex]->wait();
+    // Wait for the previous use of this frame slot
+    m_context->waitSemaphore(m_frameSubmits[m_inflightIndex]);
+
+    // Reclaim staging memory and transient descriptor sets used by this frame
+    m_context->beginFrame(m_inflightIndex);
 
     // Acquire next image
     auto acquireResult = m_context->getDevice().acquireNextImageKHR(
         *m_swapchain, UINT64_MAX, *m_imageAcquiredSemaphores[m_inflightIndex]);
     m_imageIndex = acquireResult.value;
-
-    // Reset fence
-    m_fences[m_inflightIndex]->reset();
 }
 
 void Swapchain::presentImage() {
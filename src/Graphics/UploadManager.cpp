@@ -0,0 +1,285 @@
+#include "reactive/Graphics/UploadManager.hpp"
+
+#include "reactive/Graphics/Buffer.hpp"
+#include "reactive/Graphics/CommandBuffer.hpp"
+#include "reactive/Graphics/Image.hpp"
+#include "reactive/common.hpp"
+
+namespace rv {
+UploadManager::UploadManager(const Context& context) : m_context{&context} {
+    vk::SemaphoreTypeCreateInfo typeInfo{vk::SemaphoreType::eTimeline, 0};
+    vk::SemaphoreCreateInfo semaphoreInfo;
+    semaphoreInfo.setPNext(&typeInfo);
+    m_semaphore = m_context->getDevice().createSemaphoreUnique(semaphoreInfo);
+    m_context->setDebugName(*m_semaphore, "UploadManager::m_semaphore");
+}
+
+UploadManager::~UploadManager() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // NOTE: Pending uploads are dropped without being submitted
+    if (m_submittedValue > getCompletedValueLocked()) {
+        vk::SemaphoreWaitInfo waitInfo;
+        waitInfo.setSemaphores(*m_semaphore);
+        waitInfo.setValues(m_submittedValue);
+        if (m_context->getDevice().waitSemaphores(waitInfo, UINT64_MAX) != vk::Result::eSuccess) {
+            spdlog::error("UploadManager: failed to wait for in-flight uploads.");
+        }
+    }
+    m_inflightBatches.clear();
+}
+
+auto UploadManager::uploadBuffer(BufferHandle dstBuffer,
+                                 const void* data,
+                                 vk::DeviceSize size,
+                                 vk::DeviceSize dstOffset) -> UploadTicket {
+    RV_ASSERT(dstOffset + size <= dstBuffer->getSize(),
+              "Upload range exceeds the buffer: offset={}, size={}", dstOffset, size);
+
+    BufferHandle stagingBuffer = createStagingBuffer(data, size);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pendingBatch.bufferUploads.push_back({dstBuffer, stagingBuffer, dstOffset, size});
+    return addPendingLocked(size);
+}
+
+auto UploadManager::uploadImage(ImageHandle dstImage,
+                                const void* data,
+                                vk::DeviceSize size,
+                                vk::ImageLayout newLayout) -> UploadTicket {
+    BufferHandle stagingBuffer = createStagingBuffer(data, size);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // NOTE: Descriptors written before the flush already see the final layout
+    dstImage->setLayout(newLayout);
+    m_pendingBatch.imageUploads.push_back({dstImage, stagingBuffer, newLayout});
+    return addPendingLocked(size);
+}
+
+auto UploadManager::flush() -> UploadTicket {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return flushLocked();
+}
+
+auto UploadManager::isComplete(UploadTicket ticket) const -> bool {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return ticket.value <= getCompletedValueLocked();
+}
+
+void UploadManager::wait(UploadTicket ticket) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (ticket.value > m_submittedValue) {
+            flushLocked();
+        }
+    }
+
+    vk::SemaphoreWaitInfo waitInfo;
+    waitInfo.setSemaphores(*m_semaphore);
+    waitInfo.setValues(ticket.value);
+    if (m_context->getDevice().waitSemaphores(waitInfo, UINT64_MAX) != vk::Result::eSuccess) {
+        throw std::runtime_error("Failed to wait for upload ticket.");
+    }
+}
+
+auto UploadManager::hasPendingUploads() const -> bool {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return !m_pendingBatch.bufferUploads.empty() || !m_pendingBatch.imageUploads.empty();
+}
+
+auto UploadManager::getLastTicket() const -> UploadTicket {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return {m_submittedValue};
+}
+
+auto UploadManager::createStagingBuffer(const void* data, vk::DeviceSize size) const
+    -> BufferHandle {
+    RV_ASSERT(size > 0, "Upload size must be greater than 0.");
+    BufferHandle stagingBuffer = m_context->createBuffer({
+        .usage = BufferUsage::Staging,
+        .memory = MemoryIntent::Upload,
+        .size = size,
+        .debugName = "UploadManager::stagingBuffer",
+    });
+    stagingBuffer->copy(data);
+    return stagingBuffer;
+}
+
+auto UploadManager::addPendingLocked(vk::DeviceSize size) -> UploadTicket {
+    m_pendingSize += size;
+    if (m_pendingSize >= FlushThreshold) {
+        return flushLocked();
+    }
+
+    // NOTE: Each batch reserves two values (transfer and acquire)
+    return {m_submittedValue + 2};
+}
+
+auto UploadManager::flushLocked() -> UploadTicket {
+    collectLocked();
+    if (m_pendingBatch.bufferUploads.empty() && m_pendingBatch.imageUploads.empty()) {
+        return {m_submittedValue};
+    }
+
+    Batch batch = std::move(m_pendingBatch);
+    m_pendingBatch = {};
+    m_pendingSize = 0;
+    batch.value = m_submittedValue + 2;
+
+    // Without a dedicated transfer family, everything is recorded on the general queue
+    bool useTransferQueue = m_context->hasQueue(QueueFlags::Transfer);
+    vk::QueueFlags copyFlag = useTransferQueue ? QueueFlags::Transfer : QueueFlags::General;
+    uint32_t srcFamily = m_context->getQueueFamily(copyFlag);
+    uint32_t dstFamily = m_context->getQueueFamily(QueueFlags::General);
+
+    // Copy
+    CommandBufferHandle copyCommandBuffer = m_context->allocateCommandBuffer(copyFlag);
+    copyCommandBuffer->begin(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+    for (auto& upload : batch.bufferUploads) {
+        vk::BufferCopy region{0, upload.dstOffset, upload.size};
+        copyCommandBuffer->copyBuffer(upload.stagingBuffer, upload.dstBuffer, region);
+    }
+    for (auto& upload : batch.imageUploads) {
+        // NOTE: Previous contents are discarded
+        upload.dstImage->setLayout(vk::ImageLayout::eUndefined);
+        copyCommandBuffer->transitionLayout(upload.dstImage, vk::ImageLayout::eTransferDstOptimal);
+        copyCommandBuffer->copyBufferToImage(upload.stagingBuffer, upload.dstImage);
+    }
+
+    // Queue family ownership transfer
+    // Release and acquire barriers must be identical
+    std::vector<vk::BufferMemoryBarrier> bufferBarriers;
+    std::vector<vk::ImageMemoryBarrier> imageBarriers;
+    if (useTransferQueue) {
+        for (auto& upload : batch.bufferUploads) {
+            vk::BufferMemoryBarrier barrier;
+            barrier.setSrcQueueFamilyIndex(srcFamily);
+            barrier.setDstQueueFamilyIndex(dstFamily);
+            barrier.setBuffer(upload.dstBuffer->getBuffer());
+            barrier.setOffset(upload.dstOffset);
+            barrier.setSize(upload.size);
+            bufferBarriers.push_back(barrier);
+        }
+        for (auto& upload : batch.imageUploads) {
+            vk::ImageMemoryBarrier barrier;
+            barrier.setSrcQueueFamilyIndex(srcFamily);
+            barrier.setDstQueueFamilyIndex(dstFamily);
+            barrier.setImage(upload.dstImage->getImage());
+            barrier.setOldLayout(vk::ImageLayout::eTransferDstOptimal);
+            barrier.setNewLayout(vk::ImageLayout::eTransferDstOptimal);
+            barrier.subresourceRange.aspectMask = upload.dstImage->getAspectMask();
+            barrier.subresourceRange.baseMipLevel = 0;
+            barrier.subresourceRange.levelCount = upload.dstImage->getMipLevels();
+            barrier.subresourceRange.baseArrayLayer = 0;
+            barrier.subresourceRange.layerCount = upload.dstImage->getLayerCount();
+            imageBarriers.push_back(barrier);
+        }
+
+        // Release: dstAccessMask is ignored
+        for (auto& barrier : bufferBarriers) {
+            barrier.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite);
+        }
+        for (auto& barrier : imageBarriers) {
+            barrier.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite);
+        }
+        if (!bufferBarriers.empty()) {
+            copyCommandBuffer->bufferBarrier(bufferBarriers, vk::PipelineStageFlagBits::eTransfer,
+                                             vk::PipelineStageFlagBits::eBottomOfPipe);
+        }
+        if (!imageBarriers.empty()) {
+            copyCommandBuffer->imageBarrier(imageBarriers, vk::PipelineStageFlagBits::eTransfer,
+                                            vk::PipelineStageFlagBits::eBottomOfPipe);
+        }
+        copyCommandBuffer->end();
+        batch.commandBuffers.push_back(copyCommandBuffer);
+    }
+
+    // Acquire on the general queue (or continue the copy command buffer)
+    CommandBufferHandle generalCommandBuffer = copyCommandBuffer;
+    if (useTransferQueue) {
+        generalCommandBuffer = m_context->allocateCommandBuffer(QueueFlags::General);
+        generalCommandBuffer->begin(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+
+        // Acquire: srcAccessMask is ignored
+        for (auto& barrier : bufferBarriers) {
+            barrier.setSrcAccessMask({});
+            barrier.setDstAccessMask(vk::AccessFlagBits::eMemoryRead |
+                                     vk::AccessFlagBits::eMemoryWrite);
+        }
+        for (auto& barrier : imageBarriers) {
+            barrier.setSrcAccessMask({});
+            barrier.setDstAccessMask(vk::AccessFlagBits::eTransferRead |
+                                     vk::AccessFlagBits::eTransferWrite);
+        }
+        if (!bufferBarriers.empty()) {
+            generalCommandBuffer->bufferBarrier(bufferBarriers,
+                                                vk::PipelineStageFlagBits::eTopOfPipe,
+                                                vk::PipelineStageFlagBits::eAllCommands);
+        }
+        if (!imageBarriers.empty()) {
+            generalCommandBuffer->imageBarrier(imageBarriers,
+                                               vk::PipelineStageFlagBits::eTopOfPipe,
+                                               vk::PipelineStageFlagBits::eAllCommands);
+        }
+    }
+
+    // Blit is not supported on transfer-only queues
+    for (auto& upload : batch.imageUploads) {
+        if (upload.dstImage->getMipLevels() > 1) {
+            upload.dstImage->generateMipmaps(*generalCommandBuffer);
+        }
+        generalCommandBuffer->transitionLayout(upload.dstImage, upload.newLayout);
+    }
+    generalCommandBuffer->end();
+    batch.commandBuffers.push_back(generalCommandBuffer);
+
+    if (useTransferQueue) {
+        submit(QueueFlags::Transfer, copyCommandBuffer, 0, batch.value - 1);
+        submit(QueueFlags::General, generalCommandBuffer, batch.value - 1, batch.value);
+    } else {
+        submit(QueueFlags::General, generalCommandBuffer, 0, batch.value);
+    }
+
+    spdlog::debug("UploadManager: flushed {} buffers and {} images (ticket={}).",
+                  batch.bufferUploads.size(), batch.imageUploads.size(), batch.value);
+
+    m_submittedValue = batch.value;
+    m_inflightBatches.push_back(std::move(batch));
+    return {m_submittedValue};
+}
+
+void UploadManager::collectLocked() {
+    uint64_t completedValue = getCompletedValueLocked();
+    std::erase_if(m_inflightBatches,
+                  [&](const Batch& batch) { return batch.value <= completedValue; });
+}
+
+auto UploadManager::getCompletedValueLocked() const -> uint64_t {
+    if (m_completedValue < m_submittedValue) {
+        m_completedValue = m_context->getDevice().getSemaphoreCounterValue(*m_semaphore);
+    }
+    return m_completedValue;
+}
+
+void UploadManager::submit(vk::QueueFlags flag,
+                           const CommandBufferHandle& commandBuffer,
+                           uint64_t waitValue,
+                           uint64_t signalValue) const {
+    // NOTE: Context::submit is not used because it flushes this manager
+    vk::SemaphoreSubmitInfo waitInfo{*m_semaphore, waitValue,
+                                     vk::PipelineStageFlagBits2::eAllCommands};
+    vk::SemaphoreSubmitInfo signalInfo{*m_semaphore, signalValue,
+                                       vk::PipelineStageFlagBits2::eAllCommands};
+    vk::CommandBufferSubmitInfo commandBufferInfo{*commandBuffer->m_commandBuffer};
+
+    vk::SubmitInfo2 submitInfo;
+    if (waitValue > 0) {
+        submitInfo.setWaitSemaphoreInfos(waitInfo);
+    }
+    submitInfo.setCommandBufferInfos(commandBufferInfo);
+    submitInfo.setSignalSemaphoreInfos(signalInfo);
+
+    m_context->getQueue(flag).submit2(submitInfo);
+}
+}  // namespace rv
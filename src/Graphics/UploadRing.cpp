@@ -0,0 +1,89 @@
+#include "reactive/Graphics/UploadRing.hpp"
+
+#include "reactive/Graphics/Buffer.hpp"
+#include "reactive/common.hpp"
+
+namespace rv {
+UploadRing::UploadRing(const Context& context, vk::DeviceSize frameSize)
+    : m_context{&context}, m_frameSize{frameSize} {
+    setFrameCount(1);
+}
+
+UploadRing::~UploadRing() {
+    // NOTE: Destructors of retired resources may retire others,
+    // so they are released while this object is still alive
+    for (uint32_t i = 0; i < m_frames.size(); i++) {
+        std::vector<std::shared_ptr<void>> retired;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        retired.swap(m_frames[i].retired);
+    }
+}
+
+void UploadRing::setFrameCount(uint32_t frameCount) {
+    RV_ASSERT(frameCount > 0, "frameCount must be greater than 0.");
+    // NOTE: Released after unlocking (see beginFrame)
+    std::vector<Frame> oldFrames;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_buffer && m_frames.size() == frameCount) {
+        return;
+    }
+
+    oldFrames.swap(m_frames);
+    m_frames.resize(frameCount);
+    m_frameIndex = 0;
+    m_buffer = m_context->createBuffer({
+        .usage = BufferUsage::Staging,
+        .memory = MemoryIntent::Upload,
+        .size = m_frameSize * frameCount,
+        .debugName = "UploadRing::m_buffer",
+    });
+}
+
+void UploadRing::beginFrame(uint32_t frameIndex) {
+    // NOTE: Released outside the lock because destructors may retire other resources
+    std::vector<std::shared_ptr<void>> retired;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        RV_ASSERT(frameIndex < m_frames.size(), "frameIndex is out of range: {}", frameIndex);
+        m_frameIndex = frameIndex;
+        m_frames[m_frameIndex].head = 0;
+        retired.swap(m_frames[m_frameIndex].retired);
+    }
+}
+
+auto UploadRing::allocate(vk::DeviceSize size, vk::DeviceSize alignment) -> UploadRingAllocation {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Frame& frame = m_frames[m_frameIndex];
+
+    vk::DeviceSize offset = (frame.head + alignment - 1) / alignment * alignment;
+    if (offset + size <= m_frameSize) {
+        frame.head = offset + size;
+        vk::DeviceSize ringOffset = m_frameSize * m_frameIndex + offset;
+        return {
+            .buffer = m_buffer->getBuffer(),
+            .offset = ringOffset,
+            .mapped = static_cast<uint8_t*>(m_buffer->map()) + ringOffset,
+        };
+    }
+
+    // Fall back to a temporary buffer that lives until this frame slot is reused
+    spdlog::debug("UploadRing: frame segment overflowed ({} bytes requested).", size);
+    BufferHandle overflowBuffer = m_context->createBuffer({
+        .usage = BufferUsage::Staging,
+        .memory = MemoryIntent::Upload,
+        .size = size,
+        .debugName = "UploadRing::overflowBuffer",
+    });
+    frame.retired.push_back(overflowBuffer);
+    return {
+        .buffer = overflowBuffer->getBuffer(),
+        .offset = 0,
+        .mapped = overflowBuffer->map(),
+    };
+}
+
+void UploadRing::retire(std::shared_ptr<void> resource) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_frames[m_frameIndex].retired.push_back(std::move(resource));
+}
+}  // namespace rv
@@ -1,6 +1,7 @@
 #include "reactive/Scene/Mesh.hpp"
 
 #include "reactive/Graphics/CommandBuffer.hpp"
+#include "reactive/Graphics/UploadManager.hpp"
 
 namespace rv {
 auto Vertex::getAttributeDescriptions() -> std::vector<VertexAttributeDescription> {
@@ -70,10 +71,10 @@ Mesh::Mesh(const Context& context,
         m_vertexBuffer->copy(m_vertices.data());
         m_indexBuffer->copy(m_indices.data());
     } else {
-        m_context->oneTimeSubmit([&](CommandBufferHandle commandBuffer) {
-            commandBuffer->copyBuffer(m_vertexBuffer, m_vertices.data());
-            commandBuffer->copyBuffer(m_indexBuffer, m_indices.data());
-        });
+        // NOTE: Subsequent submits wait for the upload on the GPU
+        UploadManager& uploadManager = m_context->getUploadManager();
+        uploadManager.uploadBuffer(m_vertexBuffer, m_vertices.data(), m_vertexBuffer->getSize());
+        uploadManager.uploadBuffer(m_indexBuffer, m_indices.data(), m_indexBuffer->getSize());
     }
 }
 